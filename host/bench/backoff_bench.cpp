@@ -0,0 +1,215 @@
+// Reconnect backoff: checks the delays backoff.h hands out, then simulates a
+// fleet coming back after an outage against a server that can only take so
+// many handshakes per second, comparing the old fixed 5 s retry with
+// decorrelated jitter, with and without retry hints from the server. Reports
+// handshakes, the worst second of handshake load and how long the fleet
+// took to reconnect. Jitter may not cost more handshakes than the fixed
+// retry and has to lower the peak after a backend outage, and every policy
+// has to get everyone back; otherwise the run fails.
+//
+// usage: backoff_bench [lanterns] [handshakes/s]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "backoff.h"
+
+// mirror the Kconfig defaults
+#define BASE_MS 1000
+#define CAP_MS (300 * 1000)
+
+#define FIXED_RETRY_MS 5000     // the websocket client's reconnect_timeout_ms before
+#define HINT_MS (30 * 1000)
+#define HORIZON_MS (2 * 3600 * 1000)
+
+typedef enum policy_t {
+    POLICY_FIXED = 0,
+    POLICY_JITTER,
+    POLICY_JITTER_HINT,     // the server sheds load with close 1013 and a retry-after
+} policy_t;
+
+static const char* policy_names[] = { "fixed 5 s", "jitter", "jitter + hint" };
+
+typedef struct scenario_t {
+    const char* name;
+    uint32_t outage_ms;     // server unreachable from 0 until then
+    bool network_up;        // the lanterns' Wi-Fi comes back at outage_ms, all at once
+    bool lower_peak;        // jitter must spread the load; not when everyone starts within one base delay
+} scenario_t;
+
+typedef struct result_t {
+    uint64_t handshakes;
+    uint32_t peak;          // handshakes in the busiest second
+    uint32_t p50_ms;        // after the outage ends
+    uint32_t p99_ms;
+    uint32_t all_ms;
+    bool everyone;
+} result_t;
+
+typedef struct attempt_t {
+    uint32_t at_ms;
+    uint32_t lantern;
+    bool operator>(const attempt_t& o) const { return at_ms > o.at_ms; }
+} attempt_t;
+
+static result_t simulate(const scenario_t& sc, policy_t policy, uint32_t lanterns, uint32_t capacity) {
+    std::vector<backoff_t> backoff(lanterns);
+    std::priority_queue<attempt_t, std::vector<attempt_t>, std::greater<attempt_t>> pending;
+    for (uint32_t i = 0; i < lanterns; i++) {
+        backoff_init(&backoff[i], BASE_MS, CAP_MS, i * 2654435761u + 1);
+        uint32_t at;
+        if (sc.network_up) {
+            // got an address when the access point came back
+            at = sc.outage_ms + (policy == POLICY_FIXED ? 0 : backoff_first(&backoff[i]));
+        }
+        else {
+            // every connection dropped when the server went away
+            at = policy == POLICY_FIXED ? FIXED_RETRY_MS : backoff_next(&backoff[i], 0);
+        }
+        pending.push({ at, i });
+    }
+
+    result_t r = {};
+    std::vector<uint32_t> per_second;
+    std::vector<uint32_t> connected_at;
+    while (!pending.empty()) {
+        attempt_t a = pending.top();
+        pending.pop();
+        if (a.at_ms > HORIZON_MS) {
+            break;
+        }
+
+        uint32_t second = a.at_ms / 1000;
+        if (per_second.size() <= second) {
+            per_second.resize(second + 1, 0);
+        }
+        per_second[second]++;
+        r.handshakes++;
+
+        bool up = a.at_ms >= sc.outage_ms;
+        if (up && per_second[second] <= capacity) {
+            connected_at.push_back(a.at_ms - sc.outage_ms);
+            continue;
+        }
+
+        uint32_t delay;
+        if (policy == POLICY_FIXED) {
+            delay = FIXED_RETRY_MS;
+        }
+        else {
+            // an unreachable server gives no hint; a busy one can
+            uint32_t hint = up && policy == POLICY_JITTER_HINT ? HINT_MS : 0;
+            delay = backoff_next(&backoff[a.lantern], hint);
+        }
+        pending.push({ a.at_ms + delay, a.lantern });
+    }
+
+    r.peak = per_second.empty() ? 0 : *std::max_element(per_second.begin(), per_second.end());
+    r.everyone = connected_at.size() == lanterns;
+    std::sort(connected_at.begin(), connected_at.end());
+    if (!connected_at.empty()) {
+        r.p50_ms = connected_at[connected_at.size() / 2];
+        r.p99_ms = connected_at[std::min(connected_at.size() - 1, connected_at.size() * 99 / 100)];
+        r.all_ms = connected_at.back();
+    }
+    return r;
+}
+
+static bool check_delays() {
+    bool ok = true;
+    std::mt19937 rng(11);
+
+    for (int run = 0; run < 1000; run++) {
+        backoff_t b;
+        backoff_init(&b, BASE_MS, CAP_MS, rng());
+        uint32_t first = backoff_first(&b);
+        ok &= first <= BASE_MS;
+
+        uint32_t previous = BASE_MS;
+        for (int i = 0; i < 50; i++) {
+            uint32_t hint = rng() % 8 == 0 ? rng() % (2 * CAP_MS) : 0;
+            uint32_t d = backoff_next(&b, hint);
+            if (hint) {
+                uint32_t h = std::min(hint, (uint32_t)BACKOFF_HINT_MAX_MS);
+                ok &= d >= h && d <= std::max(h + h / 2, (uint32_t)CAP_MS);
+            }
+            else {
+                ok &= d >= BASE_MS && d <= std::min(3 * previous, (uint32_t)CAP_MS);
+            }
+            previous = d;
+        }
+        ok &= b.failures == 50;
+
+        // after a failure the first attempt backs off too
+        ok &= backoff_first(&b) >= BASE_MS;
+        backoff_reset(&b);
+        ok &= backoff_first(&b) <= BASE_MS;
+    }
+    if (!ok) {
+        printf("delay out of range\n");
+    }
+
+    typedef struct close_case_t {
+        std::vector<uint8_t> payload;
+        uint32_t hint_ms;
+    } close_case_t;
+    std::vector<close_case_t> cases = {
+        { { 0x03, 0xf5, '3', '0' }, 30000 },
+        { { 0x03, 0xf4, '5', ' ', 's' }, 5000 },
+        { { 0x03, 0xf5 }, 0 },
+        { { 0x03, 0xf5, 'l', 'a', 't', 'e', 'r' }, 0 },
+        { { 0x03, 0xe8, '3', '0' }, 0 },       // normal closure
+        { { 0x03 }, 0 },
+        { { 0x03, 0xf5, '9', '9', '9', '9', '9', '9', '9', '9', '9', '9', '9' }, BACKOFF_HINT_MAX_MS },
+    };
+    for (const close_case_t& c : cases) {
+        uint32_t hint = backoff_parse_close(c.payload.data(), c.payload.size());
+        if (hint != c.hint_ms) {
+            printf("close payload of %zu bytes: hint %u, expected %u\n", c.payload.size(), hint, c.hint_ms);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    uint32_t lanterns = argc > 1 ? atoi(argv[1]) : 10000;
+    uint32_t capacity = argc > 2 ? atoi(argv[2]) : 200;
+    if (lanterns == 0 || capacity == 0) {
+        fprintf(stderr, "usage: %s [lanterns] [handshakes/s]\n", argv[0]);
+        return 2;
+    }
+
+    bool ok = check_delays();
+
+    std::vector<scenario_t> scenarios = {
+        { "backend outage 2 min", 120 * 1000, false, true },
+        { "Wi-Fi outage", 60 * 1000, true, false },
+    };
+
+    printf("%u lanterns, server takes %u handshakes/s\n", lanterns, capacity);
+    printf("%-21s %-14s %10s %8s %8s %8s %8s\n", "scenario", "policy", "handshakes", "peak/s", "p50 s", "p99 s", "all s");
+    for (const scenario_t& sc : scenarios) {
+        result_t results[3];
+        for (int p = POLICY_FIXED; p <= POLICY_JITTER_HINT; p++) {
+            result_t& r = results[p];
+            r = simulate(sc, (policy_t)p, lanterns, capacity);
+            printf("%-21s %-14s %10llu %8u %8.1f %8.1f %8s\n", sc.name, policy_names[p], (unsigned long long)r.handshakes,
+                r.peak, r.p50_ms / 1000.0, r.p99_ms / 1000.0, r.everyone ? std::to_string(r.all_ms / 1000).c_str() : "never");
+            ok &= r.everyone;
+        }
+        ok &= results[POLICY_JITTER].handshakes <= results[POLICY_FIXED].handshakes;
+        ok &= !sc.lower_peak || results[POLICY_JITTER].peak < results[POLICY_FIXED].peak;
+        ok &= results[POLICY_JITTER_HINT].handshakes <= results[POLICY_JITTER].handshakes;
+    }
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
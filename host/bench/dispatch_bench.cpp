@@ -0,0 +1,536 @@
+// Replays inbound device API traffic through the firmware's dispatch code
+// (main/sockets/dispatch.cpp) the way handle_inbound() runs it on the sockets
+// task: extension frames go straight to handle_ext_frame(), everything else
+// is decoded into the protobuf arena, handled, and the arena reset. The LED,
+// touch feedback, coredump and kd_common ends are stubbed; animation programs
+// are still parsed, and replies are still packed into the arena. Reports
+// messages/s, allocations per message and handling latency, overall and per
+// kind of message.
+//
+// Without a capture, replays a synthetic mix and checks that every message
+// reached the right stub with the right contents; any mismatch fails the
+// run. Captures are the "rx <ms> <hex>" lines logged with
+// CONFIG_LANTERN_RX_CAPTURE; other log lines are skipped, so a saved monitor
+// log works as is.
+//
+// --rate paces the replay at that many messages per second and measures
+// latency from when each message was due, so a handler that falls behind
+// shows up as queueing. Without it messages are handled back to back.
+//
+// usage: dispatch_bench [--rate N] [--repeat N] [capture]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "device-api.pb-c.h"
+#include "kd_global.pb-c.h"
+#include "kd_lantern.pb-c.h"
+
+#include "dispatch.h"
+#include "sockets.h"
+#include "led.h"
+#include "led_program.h"
+#include "led_render.h"
+#include "pinout.h"
+#include "touch_feedback.h"
+#include "coredump_upload.h"
+#include "latency_trace.h"
+#include "kd_common.h"
+#include "esp_system.h"
+
+// mirror the Kconfig defaults
+#define LED_TRANSITION_MS 250
+#define PB_ARENA_SIZE 4096
+
+#define SYNTHETIC_MESSAGES 100000
+
+static uint8_t arena_buffer[PB_ARENA_SIZE];
+static pb_arena_t arena;
+
+// Heap allocations made while a message is handled, glibc only
+#ifdef __GLIBC__
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t n, size_t size);
+extern "C" void* __libc_realloc(void* p, size_t size);
+
+static bool heap_counting = false;
+static uint64_t heap_allocs = 0;
+
+extern "C" void* malloc(size_t size) {
+    heap_allocs += heap_counting;
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size) {
+    heap_allocs += heap_counting;
+    return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* p, size_t size) {
+    heap_allocs += heap_counting;
+    return __libc_realloc(p, size);
+}
+#define HEAP_COUNTED 1
+#else
+static bool heap_counting = false;
+static uint64_t heap_allocs = 0;
+#define HEAP_COUNTED 0
+#endif
+
+// What reached the stubs
+typedef struct seen_t {
+    uint32_t set_color = 0;
+    uint32_t touch_responses = 0;
+    uint32_t touch_successes = 0;
+    uint32_t programs = 0;
+    uint32_t programs_rejected = 0;
+    uint32_t stream_frames = 0;
+    uint32_t traces = 0;
+    uint32_t coredump_acks = 0;
+    uint32_t replies = 0;
+    uint32_t restarts = 0;
+    led_state_t last_state = {};
+} seen_t;
+
+static seen_t seen;
+
+void led_state_init(led_state_t* state) {
+    led_render_default_state(state, LED_TRANSITION_MS);
+}
+
+bool led_play_program(const uint8_t* data, size_t len) {
+    static led_program_t programs[2];
+    static int next = 0;
+    next ^= 1;
+    if (led_program_parse(data, len, LED_COUNT, &programs[next]) != LED_PROGRAM_OK) {
+        seen.programs_rejected++;
+        return false;
+    }
+    seen.programs++;
+    return true;
+}
+
+bool led_play_stream_frame(const uint8_t* data, size_t len) {
+    seen.stream_frames++;
+    return true;
+}
+
+void touch_feedback_set_color(const led_state_t* state) {
+    seen.set_color++;
+    seen.last_state = *state;
+}
+
+void touch_feedback_response(bool success) {
+    seen.touch_responses++;
+    seen.touch_successes += success;
+}
+
+void latency_trace_arm(const uint8_t* payload, size_t len) {
+    seen.traces++;
+}
+
+void latency_trace_stage(trace_stage_t stage) {
+}
+
+void coredump_upload_ack(const uint8_t* payload, size_t len) {
+    seen.coredump_acks++;
+}
+
+// As on the sockets task: packed into the arena and sent right away
+void send_device_api_message(Kd__DeviceAPIMessage* message, tx_class_t cls, tx_key_t key) {
+    size_t len = kd__device_apimessage__get_packed_size(message);
+    uint8_t* buffer = (uint8_t*)pb_arena_alloc(&arena, len);
+    if (buffer == NULL) {
+        return;
+    }
+    kd__device_apimessage__pack(message, buffer);
+    seen.replies++;
+}
+
+void esp_restart(void) {
+    seen.restarts++;
+}
+
+void kd_common_get_claim_token(char* buffer, size_t* len) {
+    // about the size of the real one, a signed JWT
+    size_t n = std::min((size_t)600, *len - 1);
+    memset(buffer, 'c', n);
+    buffer[n] = '\0';
+    *len = n;
+}
+
+typedef std::vector<uint8_t> frame_t;
+
+static frame_t pack(Kd__DeviceAPIMessage* message) {
+    frame_t frame(kd__device_apimessage__get_packed_size(message));
+    kd__device_apimessage__pack(message, frame.data());
+    return frame;
+}
+
+static frame_t global_frame(Kd__KDGlobalMessage* global) {
+    Kd__DeviceAPIMessage message = KD__DEVICE_APIMESSAGE__INIT;
+    message.message_case = KD__DEVICE_APIMESSAGE__MESSAGE_KD_GLOBAL_MESSAGE;
+    message.kd_global_message = global;
+    return pack(&message);
+}
+
+static frame_t lantern_frame(Kd__KDLanternMessage* lantern) {
+    Kd__DeviceAPIMessage message = KD__DEVICE_APIMESSAGE__INIT;
+    message.message_case = KD__DEVICE_APIMESSAGE__MESSAGE_KD_LANTERN_MESSAGE;
+    message.kd_lantern_message = lantern;
+    return pack(&message);
+}
+
+static frame_t set_color_frame(LEDEffect_t effect, uint8_t r, uint8_t g, uint8_t b, uint8_t brightness) {
+    Kd__SetColor set_color = KD__SET_COLOR__INIT;
+    set_color.effect = (decltype(set_color.effect))effect;
+    set_color.red = r;
+    set_color.green = g;
+    set_color.blue = b;
+    set_color.effect_speed = 100;
+    set_color.effect_brightness = brightness;
+
+    Kd__KDLanternMessage lantern = KD__KDLANTERN_MESSAGE__INIT;
+    lantern.message_case = KD__KDLANTERN_MESSAGE__MESSAGE_SET_COLOR;
+    lantern.set_color = &set_color;
+    return lantern_frame(&lantern);
+}
+
+static frame_t touch_response_frame(bool success) {
+    Kd__TouchEventResponse response = KD__TOUCH_EVENT_RESPONSE__INIT;
+    response.success = success;
+
+    Kd__KDLanternMessage lantern = KD__KDLANTERN_MESSAGE__INIT;
+    lantern.message_case = KD__KDLANTERN_MESSAGE__MESSAGE_TOUCH_EVENT_RESPONSE;
+    lantern.touch_event_response = &response;
+    return lantern_frame(&lantern);
+}
+
+static frame_t join_response_frame(bool needs_claimed) {
+    Kd__JoinResponse response = KD__JOIN_RESPONSE__INIT;
+    response.needs_claimed = needs_claimed;
+
+    Kd__KDGlobalMessage global = KD__KDGLOBAL_MESSAGE__INIT;
+    global.message_case = KD__KDGLOBAL_MESSAGE__MESSAGE_JOIN_RESPONSE;
+    global.join_response = &response;
+    return global_frame(&global);
+}
+
+static frame_t ext_frame(ext_frame_type_t type, const frame_t& payload) {
+    frame_t frame(EXT_FRAME_HEADER_SIZE + payload.size());
+    frame[0] = EXT_FRAME_MARKER;
+    frame[1] = type;
+    std::copy(payload.begin(), payload.end(), frame.begin() + EXT_FRAME_HEADER_SIZE);
+    return frame;
+}
+
+// Every pixel through a few colors, in two tracks; see led_program.h
+static frame_t program_frame(std::mt19937& rng) {
+    frame_t p = { 'L', 'P', LED_PROGRAM_VERSION, 2, 0xd0, 0x07, 0, 0 };
+    for (int track = 0; track < 2; track++) {
+        uint8_t keys = 4;
+        frame_t t = { (uint8_t)(track * LED_COUNT / 2), LED_COUNT / 2, 50, 0, keys, 0 };
+        p.insert(p.end(), t.begin(), t.end());
+        for (int k = 0; k < keys; k++) {
+            uint16_t at = k * 500;
+            frame_t key = { (uint8_t)at, (uint8_t)(at >> 8), (uint8_t)rng(), (uint8_t)rng(), (uint8_t)rng(), 0 };
+            p.insert(p.end(), key.begin(), key.end());
+        }
+    }
+    return ext_frame(EXT_FRAME_ANIMATION_PROGRAM, p);
+}
+
+static std::string kind_of(const frame_t& frame) {
+    if (frame.size() >= EXT_FRAME_HEADER_SIZE && frame[0] == EXT_FRAME_MARKER) {
+        switch (frame[1]) {
+        case EXT_FRAME_ANIMATION_PROGRAM: return "ext program";
+        case EXT_FRAME_PIXEL_STREAM: return "ext pixel stream";
+        case EXT_FRAME_TRACE: return "ext trace";
+        case EXT_FRAME_COREDUMP_ACK: return "ext coredump ack";
+        default: return "ext " + std::to_string(frame[1]);
+        }
+    }
+
+    Kd__DeviceAPIMessage* message = kd__device_apimessage__unpack(NULL, frame.size(), frame.data());
+    if (message == NULL) {
+        return "undecodable";
+    }
+    std::string kind;
+    if (message->message_case == KD__DEVICE_APIMESSAGE__MESSAGE_KD_GLOBAL_MESSAGE) {
+        switch (message->kd_global_message->message_case) {
+        case KD__KDGLOBAL_MESSAGE__MESSAGE_JOIN_RESPONSE: kind = "join response"; break;
+        case KD__KDGLOBAL_MESSAGE__MESSAGE_OK_RESPONSE: kind = "ok response"; break;
+        case KD__KDGLOBAL_MESSAGE__MESSAGE_ERROR_RESPONSE: kind = "error response"; break;
+        case KD__KDGLOBAL_MESSAGE__MESSAGE_RESTART: kind = "restart"; break;
+        default: kind = "global " + std::to_string(message->kd_global_message->message_case); break;
+        }
+    }
+    else if (message->message_case == KD__DEVICE_APIMESSAGE__MESSAGE_KD_LANTERN_MESSAGE) {
+        switch (message->kd_lantern_message->message_case) {
+        case KD__KDLANTERN_MESSAGE__MESSAGE_SET_COLOR: kind = "set color"; break;
+        case KD__KDLANTERN_MESSAGE__MESSAGE_TOUCH_EVENT_RESPONSE: kind = "touch response"; break;
+        default: kind = "lantern " + std::to_string(message->kd_lantern_message->message_case); break;
+        }
+    }
+    else {
+        kind = "message " + std::to_string(message->message_case);
+    }
+    kd__device_apimessage__free_unpacked(message, NULL);
+    return kind;
+}
+
+// What the synthetic mix should have done to the stubs
+typedef struct expected_t {
+    seen_t seen;
+    uint32_t undecodable = 0;
+} expected_t;
+
+static std::vector<frame_t> synthetic(size_t count, expected_t* expected) {
+    std::mt19937 rng(23);
+    std::vector<frame_t> corpus;
+    seen_t& e = expected->seen;
+    while (corpus.size() < count) {
+        uint32_t pick = rng() % 100;
+        if (pick < 50) {
+            LEDEffect_t effect = (LEDEffect_t)(LED_SOLID + rng() % 5);
+            uint8_t r = rng(), g = rng(), b = rng(), brightness = rng();
+            corpus.push_back(set_color_frame(effect, r, g, b, brightness));
+            e.set_color++;
+            e.last_state.effect = effect;
+            e.last_state.color[0] = r;
+            e.last_state.color[1] = g;
+            e.last_state.color[2] = b;
+            e.last_state.brightness = brightness;
+        }
+        else if (pick < 70) {
+            corpus.push_back(program_frame(rng));
+            e.programs++;
+        }
+        else if (pick < 80) {
+            bool success = rng() % 4 != 0;
+            corpus.push_back(touch_response_frame(success));
+            e.touch_responses++;
+            e.touch_successes += success;
+        }
+        else if (pick < 85) {
+            corpus.push_back(join_response_frame(false));
+        }
+        else if (pick < 90) {
+            // answered with a ClaimDevice
+            corpus.push_back(join_response_frame(true));
+            e.replies++;
+        }
+        else if (pick < 95) {
+            frame_t arm(TRACE_ARM_SIZE);
+            corpus.push_back(ext_frame(EXT_FRAME_TRACE, arm));
+            e.traces++;
+        }
+        else if (pick < 99) {
+            frame_t ack = { 1, 0, 0, 0, 0, 4, 0, 0, COREDUMP_ACK_PROGRESS };
+            corpus.push_back(ext_frame(EXT_FRAME_COREDUMP_ACK, ack));
+            e.coredump_acks++;
+        }
+        else {
+            // a length that runs past the end
+            corpus.push_back({ 0x0a, 0xff, 0x01 });
+            expected->undecodable++;
+        }
+    }
+    return corpus;
+}
+
+static bool load_capture(const char* path, std::vector<frame_t>* corpus) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "can't read %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    char chunk[4096];
+    while (fgets(chunk, sizeof(chunk), f)) {
+        line += chunk;
+        if (line.back() != '\n' && !feof(f)) {
+            continue;
+        }
+        size_t at = line.find("rx ");
+        unsigned long ms;
+        int hex_at = 0;
+        if (at != std::string::npos && sscanf(line.c_str() + at, "rx %lu %n", &ms, &hex_at) == 1 && hex_at > 0) {
+            const char* hex = line.c_str() + at + hex_at;
+            frame_t frame;
+            unsigned byte;
+            while (sscanf(hex, "%2x", &byte) == 1) {
+                frame.push_back(byte);
+                hex += 2;
+            }
+            if (!frame.empty()) {
+                corpus->push_back(frame);
+            }
+        }
+        line.clear();
+    }
+    fclose(f);
+    return true;
+}
+
+typedef struct kind_stats_t {
+    std::vector<double> latency_us;
+    uint64_t arena_allocs = 0;
+    uint64_t heap_allocs = 0;
+    size_t bytes = 0;
+} kind_stats_t;
+
+static double percentile(std::vector<double>& v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+    size_t i = std::min(v.size() - 1, (size_t)(v.size() * p));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+static void print_row(const char* name, kind_stats_t& s) {
+    size_t n = s.latency_us.size();
+    double max = n ? *std::max_element(s.latency_us.begin(), s.latency_us.end()) : 0;
+    char heap[16] = "n/a";
+    if (HEAP_COUNTED) {
+        snprintf(heap, sizeof(heap), "%.2f", (double)s.heap_allocs / n);
+    }
+    printf("%-18s %8zu %7zu %7.2f %6s %8.2f %8.2f %8.2f\n", name, n, n ? s.bytes / n : 0,
+        (double)s.arena_allocs / n, heap, percentile(s.latency_us, 0.5), percentile(s.latency_us, 0.99), max);
+}
+
+int main(int argc, char** argv) {
+    double rate = 0;
+    int repeat = 1;
+    const char* capture = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            rate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = std::max(1, atoi(argv[++i]));
+        }
+        else if (argv[i][0] != '-' && capture == NULL) {
+            capture = argv[i];
+        }
+        else {
+            fprintf(stderr, "usage: %s [--rate N] [--repeat N] [capture]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<frame_t> corpus;
+    expected_t expected;
+    if (capture) {
+        if (!load_capture(capture, &corpus)) {
+            return 2;
+        }
+        if (corpus.empty()) {
+            fprintf(stderr, "no \"rx\" lines in %s\n", capture);
+            return 2;
+        }
+    }
+    else {
+        corpus = synthetic(SYNTHETIC_MESSAGES, &expected);
+    }
+
+    std::vector<std::string> kinds;
+    for (const frame_t& frame : corpus) {
+        kinds.push_back(kind_of(frame));
+    }
+
+    pb_arena_init(&arena, arena_buffer, sizeof(arena_buffer));
+
+    std::map<std::string, kind_stats_t> by_kind;
+    kind_stats_t all;
+    uint32_t undecodable = 0;
+    all.latency_us.reserve(corpus.size() * repeat);
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    size_t handled = 0;
+    for (int r = 0; r < repeat; r++) {
+        for (size_t i = 0; i < corpus.size(); i++, handled++) {
+            const frame_t& frame = corpus[i];
+            clock::time_point due = start;
+            if (rate > 0) {
+                due += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(handled / rate));
+                std::this_thread::sleep_until(due);
+            }
+            else {
+                due = clock::now();
+            }
+
+            uint32_t arena_before = arena.stats.allocs;
+            heap_allocs = 0;
+            heap_counting = true;
+
+            // as handle_inbound()
+            if (frame.size() >= EXT_FRAME_HEADER_SIZE && frame[0] == EXT_FRAME_MARKER) {
+                handle_ext_frame(frame.data(), frame.size());
+            }
+            else {
+                Kd__DeviceAPIMessage* message = kd__device_apimessage__unpack(&arena.allocator, frame.size(), frame.data());
+                if (message == NULL) {
+                    undecodable++;
+                }
+                else {
+                    handle_message(message, &arena);
+                }
+                pb_arena_reset(&arena);
+            }
+
+            heap_counting = false;
+            double us = std::chrono::duration<double, std::micro>(clock::now() - due).count();
+
+            kind_stats_t& k = by_kind[kinds[i]];
+            for (kind_stats_t* s : { &k, &all }) {
+                s->latency_us.push_back(us);
+                s->arena_allocs += arena.stats.allocs - arena_before;
+                s->heap_allocs += heap_allocs;
+                s->bytes += frame.size();
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+    printf("%zu messages (corpus of %zu) %s, %.0f messages/s\n", handled, corpus.size(),
+        rate > 0 ? "paced" : "back to back", handled / seconds);
+    printf("arena %zu bytes, peak %zu, %u heap fallbacks\n", arena.stats.size, arena.stats.peak, arena.stats.fallbacks);
+    printf("%-18s %8s %7s %7s %6s %8s %8s %8s\n", "kind", "count", "bytes", "arena", "heap", "p50 us", "p99 us", "max us");
+    for (auto& k : by_kind) {
+        print_row(k.first.c_str(), k.second);
+    }
+    print_row("all", all);
+
+    if (capture) {
+        return 0;
+    }
+
+    // each replay of the corpus should have done exactly this
+    const seen_t& e = expected.seen;
+    bool ok = seen.set_color == e.set_color * repeat
+        && seen.last_state.effect == e.last_state.effect
+        && memcmp(seen.last_state.color, e.last_state.color, 3) == 0
+        && seen.last_state.brightness == e.last_state.brightness
+        && seen.programs == e.programs * repeat && seen.programs_rejected == 0
+        && seen.touch_responses == e.touch_responses * repeat && seen.touch_successes == e.touch_successes * repeat
+        && seen.replies == e.replies * repeat
+        && seen.traces == e.traces * repeat
+        && seen.coredump_acks == e.coredump_acks * repeat
+        && seen.restarts == 0
+        && undecodable == expected.undecodable * repeat;
+    printf("%s\n", ok ? "every message reached its handler" : "MISMATCH");
+    return ok ? 0 : 1;
+}
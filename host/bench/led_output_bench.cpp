@@ -0,0 +1,137 @@
+// Compares the led_output stage against the per-channel multiply/divide the
+// effects used to do before packing into the wire buffer, for a fixed
+// brightness and for a fade from full to the given brightness, where the
+// brightness changes every frame.
+//
+// usage: led_output_bench [frames] [leds] [brightness]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <set>
+#include <vector>
+
+#include "led_output.h"
+#include "pinout.h"
+
+#define DEPTH_FRAMES 256
+#define INPUT_FRAMES 16
+
+static volatile uint32_t bench_sink;
+
+static void legacy_write(const led_pixel_t* frame, size_t count, uint8_t brightness, uint8_t* wire) {
+    for (size_t i = 0; i < count; i++) {
+        wire[i * 4 + 0] = frame[i].g * brightness / 255;
+        wire[i * 4 + 1] = frame[i].r * brightness / 255;
+        wire[i * 4 + 2] = frame[i].b * brightness / 255;
+        wire[i * 4 + 3] = 0;
+    }
+}
+
+static void fill_gradient(std::vector<led_pixel_t>& frame, uint32_t n) {
+    for (size_t i = 0; i < frame.size(); i++) {
+        frame[i].r = (uint8_t)(i * 7 + n);
+        frame[i].g = (uint8_t)(i * 3 + n * 2);
+        frame[i].b = (uint8_t)(i * 11 + n * 5);
+    }
+}
+
+// Brightness on frame n of a fade from 255 down to target that restarts every 256 frames
+static uint8_t fade_level(uint32_t n, uint8_t target) {
+    uint32_t t = n & 0xFF;
+    return (uint8_t)(255 - ((255 - target) * t) / 255);
+}
+
+template <typename F>
+static double time_frames(uint32_t frames, size_t leds, F write) {
+    std::vector<std::vector<led_pixel_t>> inputs(INPUT_FRAMES, std::vector<led_pixel_t>(leds));
+    for (uint32_t n = 0; n < INPUT_FRAMES; n++) {
+        fill_gradient(inputs[n], n);
+    }
+    std::vector<uint8_t> wire(leds * LED_OUTPUT_BYTES_PER_PIXEL);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < frames; n++) {
+        write(n, inputs[n % INPUT_FRAMES].data(), wire.data());
+        bench_sink += wire[0];
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / frames;
+}
+
+// Number of distinct time-averaged output levels reachable from the 256
+// input levels, a rough measure of usable depth at a given brightness.
+template <typename F>
+static size_t perceived_levels(F write) {
+    std::set<uint32_t> levels;
+    std::vector<uint8_t> wire(LED_OUTPUT_BYTES_PER_PIXEL);
+    for (int v = 0; v < 256; v++) {
+        led_pixel_t px = { (uint8_t)v, (uint8_t)v, (uint8_t)v };
+        uint32_t sum = 0;
+        for (int n = 0; n < DEPTH_FRAMES; n++) {
+            write(&px, wire.data());
+            sum += wire[0];
+        }
+        levels.insert(sum);
+    }
+    return levels.size();
+}
+
+int main(int argc, char** argv) {
+    uint32_t frames = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+    size_t leds = argc > 2 ? strtoul(argv[2], NULL, 10) : LED_COUNT;
+    uint8_t brightness = argc > 3 ? (uint8_t)strtoul(argv[3], NULL, 10) : 32;
+    if (frames == 0 || leds == 0) {
+        fprintf(stderr, "usage: %s [frames] [leds] [brightness]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<uint8_t> residual(leds * 3);
+    led_output_t lut;
+    led_output_init(&lut, residual.data(), leds);
+    led_output_set_brightness(&lut, brightness);
+
+    std::vector<uint8_t> dither_residual(leds * 3);
+    led_output_t dither;
+    led_output_init(&dither, dither_residual.data(), leds);
+    led_output_set_brightness(&dither, brightness);
+    led_output_set_dither(&dither, true);
+
+    printf("%u frames, %zu leds, brightness %u\n", frames, leds, brightness);
+    printf("%-14s %12s\n", "stage", "ns/frame");
+    printf("%-14s %12.1f\n", "legacy", time_frames(frames, leds, [&](uint32_t, const led_pixel_t* f, uint8_t* w) { legacy_write(f, leds, brightness, w); }));
+    printf("%-14s %12.1f\n", "lut", time_frames(frames, leds, [&](uint32_t, const led_pixel_t* f, uint8_t* w) { led_output_write(&lut, f, w); }));
+    printf("%-14s %12.1f\n", "lut+dither", time_frames(frames, leds, [&](uint32_t, const led_pixel_t* f, uint8_t* w) { led_output_write(&dither, f, w); }));
+
+    // a fade, with the LUT rebuilt for every frame's brightness or kept at
+    // the fade's start and scaled
+    printf("\n%-14s %12s\n", "fade", "ns/frame");
+    printf("%-14s %12.1f\n", "legacy", time_frames(frames, leds, [&](uint32_t n, const led_pixel_t* f, uint8_t* w) {
+        legacy_write(f, leds, fade_level(n, brightness), w);
+    }));
+    printf("%-14s %12.1f\n", "lut rebuild", time_frames(frames, leds, [&](uint32_t n, const led_pixel_t* f, uint8_t* w) {
+        led_output_set_brightness(&dither, fade_level(n, brightness));
+        led_output_write(&dither, f, w);
+    }));
+    printf("%-14s %12.1f\n", "lut scale", time_frames(frames, leds, [&](uint32_t n, const led_pixel_t* f, uint8_t* w) {
+        led_output_set_brightness(&dither, 255);
+        led_output_set_fade(&dither, fade_level(n, brightness));
+        led_output_write(&dither, f, w);
+    }));
+
+    uint8_t px_residual[3];
+    led_output_t single;
+    led_output_init(&single, px_residual, 1);
+    led_output_set_brightness(&single, brightness);
+
+    printf("\n%-14s %12s\n", "stage", "levels");
+    printf("%-14s %12zu\n", "legacy", perceived_levels([&](const led_pixel_t* f, uint8_t* w) { legacy_write(f, 1, brightness, w); }));
+    led_output_set_dither(&single, false);
+    printf("%-14s %12zu\n", "lut", perceived_levels([&](const led_pixel_t* f, uint8_t* w) { led_output_write(&single, f, w); }));
+    led_output_set_dither(&single, true);
+    printf("%-14s %12zu\n", "lut+dither", perceived_levels([&](const led_pixel_t* f, uint8_t* w) { led_output_write(&single, f, w); }));
+
+    return 0;
+}
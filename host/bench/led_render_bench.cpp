@@ -0,0 +1,207 @@
+// Renders every LEDEffect_t on the host and reports ns/frame plus a checksum
+// of a fixed frame sequence. Also checks that each effect renders the same
+// frames at 30 and 120 FPS. Exits non-zero when a checksum no longer matches
+// its golden value or an effect depends on the frame rate, so CI catches
+// both cost and output regressions.
+//
+// The rainbow is also timed at 1x to 1000x LED_COUNT against the frame
+// budget at LED_MAX_FPS. Host numbers; the ESP32-S3 is roughly an order of
+// magnitude slower per pixel.
+//
+// usage: led_render_bench [frames] [leds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "led_render.h"
+#include "led_transition.h"
+#include "led_program.h"
+#include "pinout.h"
+
+#define FRAME_INTERVAL_MS 33
+#define GOLDEN_FRAMES 1000
+#define FRAME_BUDGET_NS (1e9 / LED_MAX_FPS)
+
+typedef struct bench_effect_t {
+    LEDEffect_t effect;
+    const char* name;
+    uint32_t golden;
+} bench_effect_t;
+
+// Checksums of GOLDEN_FRAMES frames at LED_COUNT pixels. Update deliberately
+// when an effect is meant to change.
+static const bench_effect_t effects[] = {
+    { LED_OFF, "off", 0x36c1c385 },
+    { LED_SOLID, "solid", 0x1c7fde55 },
+    { LED_BLINK, "blink", 0xb888e477 },
+    { LED_BREATHE, "breathe", 0x24bf71c1 },
+    { LED_CYCLIC, "cyclic", 0x55f0ce37 },
+    { LED_RAINBOW, "rainbow", 0xcc24c8aa },
+    { LED_COLOR_WHEEL, "wheel", 0x71d4f47b },
+    { LED_PROGRAM, "program", 0x82e78846 },
+};
+
+static volatile uint32_t bench_sink;
+
+// 2 s loop: a red/blue chase over the whole ring plus a white pulse on pixel 0
+static const uint8_t bench_program_data[] = {
+    'L', 'P', LED_PROGRAM_VERSION, 2, 0xD0, 0x07, 0, 0,
+    0, LED_COUNT, 100, 0, 3, 0,
+    0x00, 0x00, 255, 0, 0, LED_EASE_IN_OUT,
+    0xE8, 0x03, 0, 0, 255, LED_EASE_IN_OUT,
+    0xD0, 0x07, 255, 0, 0, LED_EASE_LINEAR,
+    0, 1, 0, 0, 2, 0,
+    0x00, 0x00, 0, 0, 0, LED_EASE_IN,
+    0xD0, 0x07, 255, 255, 255, LED_EASE_LINEAR,
+};
+static led_program_t bench_program;
+
+static led_state_t bench_state(LEDEffect_t effect) {
+    led_state_t state;
+    state.effect = effect;
+    state.color[0] = 255;
+    state.color[1] = 127;
+    state.color[2] = 31;
+    state.speed = 10;
+    state.brightness = 200;
+    state.transition_ms = 0;
+    state.ease = LED_EASE_LINEAR;
+    state.program = &bench_program;
+    state.stream = NULL;
+    return state;
+}
+
+// FNV-1a over the rendered pixels
+static uint32_t hash_frame(uint32_t hash, const led_pixel_t* frame, size_t count) {
+    const uint8_t* bytes = (const uint8_t*)frame;
+    for (size_t i = 0; i < count * sizeof(led_pixel_t); i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t golden_checksum(LEDEffect_t effect) {
+    std::vector<led_pixel_t> frame(LED_COUNT);
+    led_render_ctx_t ctx;
+    led_render_init(&ctx);
+    led_state_t state = bench_state(effect);
+
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < GOLDEN_FRAMES; i++) {
+        led_render_frame(&ctx, &state, i * FRAME_INTERVAL_MS, frame.data(), frame.size());
+        hash = hash_frame(hash, frame.data(), frame.size());
+    }
+    return hash;
+}
+
+// Every 4th frame at 8 ms must equal the frame at 32 ms with the same timestamp
+static bool frame_rate_independent(LEDEffect_t effect) {
+    std::vector<led_pixel_t> slow(LED_COUNT);
+    std::vector<led_pixel_t> fast(LED_COUNT);
+    led_render_ctx_t slow_ctx;
+    led_render_ctx_t fast_ctx;
+    led_render_init(&slow_ctx);
+    led_render_init(&fast_ctx);
+    led_state_t state = bench_state(effect);
+
+    for (uint32_t t = 0; t < GOLDEN_FRAMES * 32; t += 8) {
+        led_render_frame(&fast_ctx, &state, t, fast.data(), fast.size());
+        if (t % 32 != 0) {
+            continue;
+        }
+        led_render_frame(&slow_ctx, &state, t, slow.data(), slow.size());
+        if (memcmp(slow.data(), fast.data(), slow.size() * sizeof(led_pixel_t)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static double time_frames(LEDEffect_t effect, uint32_t frames, size_t leds) {
+    std::vector<led_pixel_t> frame(leds);
+    led_render_ctx_t ctx;
+    led_render_init(&ctx);
+    led_state_t state = bench_state(effect);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < frames; i++) {
+        led_render_frame(&ctx, &state, i * FRAME_INTERVAL_MS, frame.data(), frame.size());
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // keep the last frame observable so the loop is not optimised away
+    bench_sink = hash_frame(0, frame.data(), frame.size());
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / frames;
+}
+
+// Crossfade from a live rainbow to a live spinner, restarted as soon as it
+// completes so every timed frame blends two effects
+static double time_transition(uint32_t frames, size_t leds) {
+    std::vector<led_pixel_t> frame(leds);
+    std::vector<led_pixel_t> scratch(leds);
+    led_render_ctx_t ctx;
+    led_render_init(&ctx);
+    led_transition_t tr;
+    led_transition_init(&tr, scratch.data(), leds);
+    led_state_t from = bench_state(LED_RAINBOW);
+    led_state_t to = bench_state(LED_CYCLIC);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < frames; i++) {
+        uint32_t now = i * FRAME_INTERVAL_MS;
+        if (!tr.active) {
+            led_transition_start(&tr, &from, &ctx, frame.data(), 200, now, 1000, LED_EASE_IN_OUT);
+        }
+        bench_sink += led_transition_render(&tr, &ctx, &to, now, frame.data());
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    bench_sink = hash_frame(0, frame.data(), frame.size());
+    return std::chrono::duration<double, std::nano>(end - start).count() / frames;
+}
+
+int main(int argc, char** argv) {
+    uint32_t frames = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+    size_t leds = argc > 2 ? strtoul(argv[2], NULL, 10) : LED_COUNT;
+    if (frames == 0 || leds == 0) {
+        fprintf(stderr, "usage: %s [frames] [leds]\n", argv[0]);
+        return 2;
+    }
+
+    printf("%u frames, %zu leds\n", frames, leds);
+    printf("%-10s %12s %12s  %-8s  %s\n", "effect", "ns/frame", "checksum", "golden", "fps");
+
+    if (led_program_parse(bench_program_data, sizeof(bench_program_data), LED_COUNT, &bench_program) != LED_PROGRAM_OK) {
+        fprintf(stderr, "bench program rejected\n");
+        return 1;
+    }
+
+    int failures = 0;
+    for (const bench_effect_t& e : effects) {
+        double ns = time_frames(e.effect, frames, leds);
+        uint32_t checksum = golden_checksum(e.effect);
+        bool ok = checksum == e.golden;
+        bool independent = frame_rate_independent(e.effect);
+        if (!ok || !independent) {
+            failures++;
+        }
+        printf("%-10s %12.1f   0x%08x  %-8s  %s\n", e.name, ns, checksum, ok ? "ok" : "MISMATCH", independent ? "ok" : "DEPENDS");
+    }
+
+    printf("%-10s %12.1f\n", "crossfade", time_transition(frames, leds));
+
+    // render cost against the frame budget as the ring grows
+    printf("\n%-10s %10s %12s %10s\n", "rainbow", "leds", "ns/frame", "budget");
+    for (size_t scale = 1; scale <= 1000; scale *= 10) {
+        double ns = time_frames(LED_RAINBOW, frames, LED_COUNT * scale);
+        printf("%-10s %10zu %12.1f %9.3f%%\n", "", (size_t)(LED_COUNT * scale), ns, 100.0 * ns / FRAME_BUDGET_NS);
+    }
+
+    return failures ? 1 : 0;
+}
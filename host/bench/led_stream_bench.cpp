@@ -0,0 +1,155 @@
+// Plays a simulated realtime stream through the jitter buffer: frames sent
+// at 30 FPS on the server clock, delayed by a random network trip (in order,
+// like TCP) and rendered at 60 FPS on a device clock with an unrelated epoch.
+// Reports the buffer's counters for increasing jitter and a Wi-Fi stall, and
+// the cost of a push plus render. Exits non-zero if jitter below the playout
+// delay causes a single late frame or underrun, or a stream that stops does
+// not go idle.
+//
+// usage: led_stream_bench [seconds] [delay_ms]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+#include "led_stream.h"
+#include "pinout.h"
+
+#define STREAM_INTERVAL_MS 33
+#define RENDER_INTERVAL_US 16667
+#define BASE_TRIP_MS 8
+#define CLOCK_EPOCH_MS 123456
+
+typedef struct scenario_t {
+    const char* name;
+    uint32_t jitter_ms;     // uniform extra trip time
+    uint32_t stall_ms;      // one outage halfway through, frames queue up behind it
+    bool must_be_clean;
+} scenario_t;
+
+static led_stream_t stream;
+static volatile uint32_t bench_sink;
+
+// deterministic so the counters are reproducible
+static uint32_t rng_state = 1;
+static uint32_t rng() {
+    rng_state = rng_state * 1664525u + 1013904223u;
+    return rng_state >> 8;
+}
+
+static double run(const scenario_t* s, uint32_t seconds, uint16_t delay_ms) {
+    led_stream_init(&stream, delay_ms, LED_STREAM_HOLD);
+    rng_state = 1;
+
+    uint32_t frames = seconds * 1000 / STREAM_INTERVAL_MS;
+    std::vector<uint32_t> arrivals(frames);
+    uint32_t previous = 0;
+    for (uint32_t k = 0; k < frames; k++) {
+        uint32_t sent = k * STREAM_INTERVAL_MS;
+        uint32_t arrival = sent + BASE_TRIP_MS + (s->jitter_ms ? rng() % (s->jitter_ms + 1) : 0);
+        uint32_t stall_at = seconds * 500;
+        if (s->stall_ms && sent >= stall_at && sent < stall_at + s->stall_ms) {
+            arrival = stall_at + s->stall_ms;
+        }
+        // in order, like TCP
+        arrival = arrival < previous ? previous : arrival;
+        arrivals[k] = previous = arrival;
+    }
+
+    std::vector<uint8_t> rgb(LED_COUNT * 3);
+    std::vector<led_pixel_t> frame(LED_COUNT);
+    uint32_t next = 0;
+    uint64_t render_us = 0;
+    // stop one interval after the last frame is due, before the end of the stream reads as an underrun
+    uint32_t end_ms = frames * STREAM_INTERVAL_MS + BASE_TRIP_MS + delay_ms;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t now = 0; now < end_ms; now++) {
+        while (next < frames && arrivals[next] <= now) {
+            for (size_t i = 0; i < rgb.size(); i++) {
+                rgb[i] = (uint8_t)(next + i);
+            }
+            led_stream_push(&stream, CLOCK_EPOCH_MS + now, next * STREAM_INTERVAL_MS, rgb.data(), LED_COUNT);
+            next++;
+        }
+        if (now * 1000 >= render_us) {
+            led_stream_render(&stream, CLOCK_EPOCH_MS + now, frame.data(), frame.size());
+            bench_sink += frame[0].r;
+            render_us += RENDER_INTERVAL_US;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / frames;
+}
+
+// A stream that stops has to go idle once its last frame is past the
+// underrun deadline, or the LED task renders it forever; it must not go idle
+// while frames are still coming. Returns false if either is wrong.
+static bool goes_idle(uint32_t frames, uint16_t delay_ms) {
+    led_stream_init(&stream, delay_ms, LED_STREAM_HOLD);
+
+    std::vector<uint8_t> rgb(LED_COUNT * 3, 0x80);
+    std::vector<led_pixel_t> frame(LED_COUNT);
+    uint32_t next = 0;
+    uint32_t last_due_ms = (frames - 1) * STREAM_INTERVAL_MS + BASE_TRIP_MS + delay_ms;
+    for (uint32_t now = 0; now < last_due_ms + 2000; now += RENDER_INTERVAL_US / 1000) {
+        while (next < frames && next * STREAM_INTERVAL_MS + BASE_TRIP_MS <= now) {
+            led_stream_push(&stream, CLOCK_EPOCH_MS + now, next * STREAM_INTERVAL_MS, rgb.data(), LED_COUNT);
+            next++;
+        }
+        led_stream_render(&stream, CLOCK_EPOCH_MS + now, frame.data(), frame.size());
+        if (now < last_due_ms && led_stream_is_idle(&stream) && stream.shown_any) {
+            return false;
+        }
+    }
+    return led_stream_is_idle(&stream);
+}
+
+int main(int argc, char** argv) {
+    uint32_t seconds = argc > 1 ? strtoul(argv[1], NULL, 10) : 60;
+    uint16_t delay_ms = argc > 2 ? strtoul(argv[2], NULL, 10) : 60;
+    if (seconds == 0) {
+        fprintf(stderr, "usage: %s [seconds] [delay_ms]\n", argv[0]);
+        return 2;
+    }
+
+    const scenario_t scenarios[] = {
+        { "steady", 0, 0, true },
+        { "jitter/4", delay_ms / 4u, 0, true },
+        { "jitter/2", delay_ms / 2u, 0, true },
+        { "jitter-1", delay_ms - 1u, 0, true },
+        { "jitter*2", delay_ms * 2u, 0, false },
+        { "stall", delay_ms / 4u, 300, false },
+    };
+
+    printf("%u s at %d FPS, rendered at 60 FPS, %u ms playout delay\n", seconds, 1000 / STREAM_INTERVAL_MS, delay_ms);
+    printf("%-9s %7s %7s %6s %6s %6s %6s %6s %6s %6s %5s %10s\n",
+        "scenario", "recv", "shown", "late", "ovfl", "skip", "under", "held", "err", "errmax", "depth", "ns/frame");
+
+    int failures = 0;
+    for (const scenario_t& s : scenarios) {
+        double ns = run(&s, seconds, delay_ms);
+        const led_stream_stats_t& st = stream.stats;
+        bool clean = st.late == 0 && st.underruns == 0 && st.overflow == 0;
+        if (s.must_be_clean && !clean) {
+            failures++;
+        }
+        printf("%-9s %7u %7u %6u %6u %6u %6u %6u %6u %6u %5u %10.1f%s\n", s.name,
+            st.received, st.shown, st.late, st.overflow, st.skipped, st.underruns, st.held,
+            st.present_err_avg_ms, st.present_err_max_ms, st.depth_max, ns,
+            s.must_be_clean && !clean ? "  FAIL" : "");
+    }
+
+    for (uint32_t frames : { 1u, 30u }) {
+        bool idle = goes_idle(frames, delay_ms);
+        if (!idle) {
+            failures++;
+        }
+        printf("%u-frame stream goes idle after its last frame: %s\n", frames, idle ? "yes" : "no  FAIL");
+    }
+
+    return failures ? 1 : 0;
+}
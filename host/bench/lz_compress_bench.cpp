@@ -0,0 +1,226 @@
+// Compression ratio and throughput of lz_compress on core dumps, compared
+// with the base64 encoding uploads used to go out in. Every run decodes the
+// output again and fails on a mismatch.
+//
+// With no files a synthetic dump is generated: task control blocks full of
+// pointers and stacks that are mostly FreeRTOS's 0xa5 fill pattern. Pass
+// real images (the partition contents, see tools/standin/coredump_server.py)
+// for real numbers.
+//
+// usage: lz_compress_bench [coredump...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "lz_compress.h"
+
+#define DEVICE_SEGMENT 1024     // raw bytes per coredump chunk frame
+#define MIN_BENCH_BYTES (8 << 20)
+
+static volatile uint32_t bench_sink;
+
+// Reference heatshrink decoder. Segments are decoded with a fresh bit reader
+// into one continuous output, which is the window.
+static bool decode_segment(const uint8_t* in, size_t len, std::vector<uint8_t>& out) {
+    size_t bit = 0;
+    auto get = [&](int n, uint32_t* v) {
+        if (bit + n > len * 8) {
+            return false;
+        }
+        *v = 0;
+        for (int i = 0; i < n; i++, bit++) {
+            *v = (*v << 1) | ((in[bit / 8] >> (7 - bit % 8)) & 1);
+        }
+        return true;
+    };
+
+    uint32_t tag;
+    while (get(1, &tag)) {
+        uint32_t v;
+        if (tag) {
+            if (!get(8, &v)) {
+                return true;
+            }
+            out.push_back(v);
+            continue;
+        }
+        if (!get(LZ_WINDOW_BITS + LZ_LOOKAHEAD_BITS, &v)) {
+            return true;
+        }
+        size_t distance = (v >> LZ_LOOKAHEAD_BITS) + 1;
+        size_t n = (v & (LZ_LOOKAHEAD - 1)) + 1;
+        if (distance > out.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < n; i++) {
+            out.push_back(out[out.size() - distance]);
+        }
+    }
+    return true;
+}
+
+typedef struct result_t {
+    size_t compressed;
+    double encode_mbps;
+    bool ok;
+} result_t;
+
+// Compresses in segments of the given size, flushing after each, as the
+// upload does per frame; segment 0 compresses in one go.
+static result_t run(const std::vector<uint8_t>& image, size_t segment) {
+    if (segment == 0) {
+        segment = image.size();
+    }
+    lz_encoder_t* enc = new lz_encoder_t;
+    std::vector<uint8_t> out(LZ_COMPRESS_BOUND(segment));
+    std::vector<std::vector<uint8_t>> segments;
+
+    lz_encoder_reset(enc);
+    for (size_t offset = 0; offset < image.size(); offset += segment) {
+        size_t n = std::min(segment, image.size() - offset);
+        size_t written = lz_compress(enc, image.data() + offset, n, true, out.data());
+        segments.emplace_back(out.begin(), out.begin() + written);
+    }
+
+    result_t result = {};
+    for (auto& s : segments) {
+        result.compressed += s.size();
+    }
+
+    std::vector<uint8_t> decoded;
+    result.ok = true;
+    for (auto& s : segments) {
+        result.ok &= decode_segment(s.data(), s.size(), decoded);
+    }
+    result.ok &= decoded == image;
+
+    // throughput over enough repetitions to time
+    size_t rounds = MIN_BENCH_BYTES / image.size() + 1;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++) {
+        lz_encoder_reset(enc);
+        for (size_t offset = 0; offset < image.size(); offset += segment) {
+            size_t n = std::min(segment, image.size() - offset);
+            bench_sink += lz_compress(enc, image.data() + offset, n, true, out.data());
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    result.encode_mbps = rounds * image.size() / seconds / 1e6;
+
+    delete enc;
+    return result;
+}
+
+static std::vector<uint8_t> synthetic_coredump() {
+    std::mt19937 rng(1);
+    std::vector<uint8_t> image;
+    auto word = [&](uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            image.push_back(v >> (i * 8));
+        }
+    };
+
+    // header: total length (patched below), version, task count, tcb size
+    for (int i = 0; i < 5; i++) {
+        word(0);
+    }
+
+    const int tasks = 14;
+    for (int t = 0; t < tasks; t++) {
+        uint32_t tcb = 0x3fc90000 + t * 0x400;
+        uint32_t stack_size = t % 3 == 0 ? 8192 : 4096;
+        uint32_t used = 600 + rng() % 1400;
+
+        // task header: tcb address, stack top and end
+        word(tcb);
+        word(0x3fca0000 + t * 0x2000 + stack_size - used);
+        word(0x3fca0000 + t * 0x2000 + stack_size);
+
+        // TCB: list items, priorities, name, mostly pointers and small ints
+        for (int i = 0; i < 89; i++) {
+            switch (i % 6) {
+            case 0: word(tcb + (rng() % 64) * 4); break;
+            case 1: word(0x3fc88000 + (rng() % 32) * 16); break;
+            case 2: word(rng() % 25); break;
+            case 3: word(0); break;
+            default: word(i == 13 ? 0x6b736174 + t : 0xa5a5a5a5); break;
+            }
+        }
+
+        // stack: the unused part keeps its fill pattern, frames hold return
+        // addresses into flash, saved registers and locals
+        for (uint32_t i = 0; i < (stack_size - used) / 4; i++) {
+            word(0xa5a5a5a5);
+        }
+        for (uint32_t i = 0; i < used / 4; i++) {
+            switch (rng() % 5) {
+            case 0: word(0x42000000 + (rng() % 0x40000 & ~3u)); break;
+            case 1: word(0x3fca0000 + t * 0x2000 + (rng() % stack_size & ~3u)); break;
+            case 2: word(0); break;
+            case 3: word(rng() % 256); break;
+            default: word(rng()); break;
+            }
+        }
+    }
+
+    uint32_t len = image.size();
+    memcpy(image.data(), &len, 4);
+    return image;
+}
+
+static bool read_file(const char* path, std::vector<uint8_t>& data) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        data.insert(data.end(), buffer, buffer + n);
+    }
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::pair<std::string, std::vector<uint8_t>>> inputs;
+    for (int i = 1; i < argc; i++) {
+        std::vector<uint8_t> data;
+        if (!read_file(argv[i], data) || data.empty()) {
+            fprintf(stderr, "usage: %s [coredump...]\ncan't read %s\n", argv[0], argv[i]);
+            return 2;
+        }
+        inputs.emplace_back(argv[i], std::move(data));
+    }
+    if (inputs.empty()) {
+        inputs.emplace_back("synthetic", synthetic_coredump());
+    }
+
+    printf("window %d, lookahead %d, encoder state %zu bytes\n\n", LZ_WINDOW, LZ_LOOKAHEAD, sizeof(lz_encoder_t));
+    printf("%-24s %9s %9s %9s %8s %8s %10s\n", "input", "bytes", "base64", "lz", "ratio", "vs b64", "MB/s");
+
+    bool ok = true;
+    for (auto& [name, image] : inputs) {
+        size_t base64 = (image.size() + 2) / 3 * 4;
+        for (size_t segment : { (size_t)0, (size_t)DEVICE_SEGMENT }) {
+            result_t r = run(image, segment);
+            char label[64];
+            snprintf(label, sizeof(label), "%.16s%s", name.c_str(), segment ? " /1k" : "");
+            printf("%-24s %9zu %9zu %9zu %7.2fx %7.2fx %10.1f%s\n", label, image.size(), base64, r.compressed,
+                (double)image.size() / r.compressed, (double)base64 / r.compressed, r.encode_mbps,
+                r.ok ? "" : "  ROUNDTRIP FAILED");
+            ok &= r.ok;
+        }
+    }
+
+    printf("\n/1k: flushed every %d bytes, as sent in coredump chunk frames\n", DEVICE_SEGMENT);
+    return ok ? 0 : 1;
+}
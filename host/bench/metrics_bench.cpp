@@ -0,0 +1,254 @@
+// Cost of recording into the metrics registry, alone and with every core
+// hammering the same histogram, and the size of the encoded report. The
+// report is decoded again with a reference reader and checked against what
+// was recorded; any mismatch fails the run.
+//
+// usage: metrics_bench
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+
+#define RECORDS (20 * 1000 * 1000)
+#define THREADS 4
+// mirror metrics_report.h
+#define METRICS_REPORT_MAX 3072
+#define REPORT_TASKS 24
+
+typedef struct decoded_t {
+    uint32_t uptime_s = 0;
+    std::vector<uint32_t> counters;
+    std::vector<uint32_t> gauges;
+    std::vector<std::vector<uint32_t>> histograms;  // count, sum, max, buckets...
+    std::vector<std::pair<std::string, uint32_t>> tasks;
+} decoded_t;
+
+// Reference reader for the subset of the wire format telemetry.proto uses
+struct reader_t {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok = true;
+
+    uint64_t varint() {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p >= end) {
+                ok = false;
+                return 0;
+            }
+            uint8_t b = *p++;
+            v |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) {
+                return v;
+            }
+        }
+        ok = false;
+        return 0;
+    }
+
+    reader_t sub() {
+        uint64_t len = varint();
+        if (!ok || len > (uint64_t)(end - p)) {
+            ok = false;
+            return { p, p, false };
+        }
+        reader_t r = { p, p + len };
+        p += len;
+        return r;
+    }
+
+    std::vector<uint32_t> packed() {
+        reader_t r = sub();
+        std::vector<uint32_t> v;
+        while (r.ok && r.p < r.end) {
+            v.push_back(r.varint());
+        }
+        ok &= r.ok;
+        return v;
+    }
+};
+
+static bool decode(const uint8_t* data, size_t len, decoded_t* out) {
+    reader_t r = { data, data + len };
+    while (r.ok && r.p < r.end) {
+        uint64_t tag = r.varint();
+        switch (tag) {
+        case 1 << 3 | 0:
+            out->uptime_s = r.varint();
+            break;
+        case 2 << 3 | 2:
+            out->counters = r.packed();
+            break;
+        case 3 << 3 | 2:
+            out->gauges = r.packed();
+            break;
+        case 4 << 3 | 2: {
+            reader_t h = r.sub();
+            std::vector<uint32_t> v(3, 0);
+            while (h.ok && h.p < h.end) {
+                uint64_t t = h.varint();
+                if (t >> 3 >= 1 && t >> 3 <= 3 && (t & 7) == 0) {
+                    v[(t >> 3) - 1] = h.varint();
+                }
+                else if (t == (4 << 3 | 2)) {
+                    std::vector<uint32_t> buckets = h.packed();
+                    v.insert(v.end(), buckets.begin(), buckets.end());
+                }
+                else {
+                    h.ok = false;
+                }
+            }
+            r.ok &= h.ok;
+            out->histograms.push_back(v);
+            break;
+        }
+        case 5 << 3 | 2: {
+            reader_t t = r.sub();
+            std::string name;
+            uint32_t free_min = 0;
+            while (t.ok && t.p < t.end) {
+                uint64_t f = t.varint();
+                if (f == (1 << 3 | 2)) {
+                    reader_t s = t.sub();
+                    name.assign((const char*)s.p, s.end - s.p);
+                }
+                else if (f == (2 << 3 | 0)) {
+                    free_min = t.varint();
+                }
+                else {
+                    t.ok = false;
+                }
+            }
+            r.ok &= t.ok;
+            out->tasks.push_back({ name, free_min });
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return r.ok;
+}
+
+static double bench_records(int threads) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([] {
+            for (uint32_t i = 0; i < RECORDS; i++) {
+                metrics_record(METRIC_LED_FRAME_US, i & 0xfff);
+            }
+        });
+    }
+    for (std::thread& w : workers) {
+        w.join();
+    }
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return s * 1e9 / RECORDS;
+}
+
+int main() {
+    bool ok = true;
+
+    double alone_ns = bench_records(1);
+    double contended_ns = bench_records(THREADS);
+    printf("metrics_record: %.1f ns alone, %.1f ns with %d threads on one histogram\n", alone_ns, contended_ns, THREADS);
+
+    uint32_t expected = (uint32_t)RECORDS * (1 + THREADS);
+    uint32_t count = metrics_histograms[METRIC_LED_FRAME_US].count.load();
+    if (count != expected) {
+        printf("lost records: %u of %u\n", expected - count, expected);
+        ok = false;
+    }
+
+    // a known pattern through the rest of the registry
+    std::mt19937 rng(7);
+    std::vector<uint32_t> wire;
+    for (int i = 0; i < 1000; i++) {
+        uint32_t v = rng() % 5000;
+        wire.push_back(v);
+        metrics_record(METRIC_LED_WIRE_US, v);
+    }
+    metrics_record(METRIC_RX_HANDLE_US, 0);
+    metrics_record(METRIC_RX_HANDLE_US, 1u << 30);
+    metrics_count(METRIC_WS_CONNECTS, 3);
+    metrics_count(METRIC_RX_QUEUE_DROPS);
+    metrics_gauge_set(METRIC_HEAP_FREE, 123456);
+    metrics_gauge_max(METRIC_RX_QUEUE_DEPTH_MAX, 4);
+    metrics_gauge_max(METRIC_RX_QUEUE_DEPTH_MAX, 2);
+
+    std::vector<metric_task_t> tasks = {
+        { "led_task", 1800 }, { "sockets", 2100 }, { "touch", 900 }, { "IDLE0", 600 }, { "IDLE1", 600 },
+        { "esp_timer", 2400 }, { "tiT", 1300 }, { "wifi", 2900 }, { "sys_evt", 1000 }, { "websocket_task", 3100 },
+        { "ipc0", 500 }, { "ipc1", 500 }, { "Tmr Svc", 1200 }, { "btController", 2200 }, { "coredump_upload", 2000 },
+    };
+
+    uint8_t report[METRICS_REPORT_MAX];
+    size_t len = metrics_encode(report, sizeof(report), 86400, tasks.data(), tasks.size());
+    printf("report: %zu bytes with %zu tasks\n", len, tasks.size());
+    if (len == 0 || metrics_encode(report, len - 1, 86400, tasks.data(), tasks.size()) != 0) {
+        printf("encode did not respect its buffer size\n");
+        ok = false;
+    }
+
+    decoded_t d;
+    if (!decode(report, len, &d)) {
+        printf("report does not decode\n");
+        return 1;
+    }
+
+    std::vector<uint32_t> wire_buckets(METRIC_HISTOGRAM_BUCKETS, 0);
+    uint32_t wire_sum = 0, wire_max = 0;
+    for (uint32_t v : wire) {
+        wire_buckets[metrics_bucket(v)]++;
+        wire_sum += v;
+        wire_max = std::max(wire_max, v);
+    }
+    std::vector<uint32_t> wire_expected = { (uint32_t)wire.size(), wire_sum, wire_max };
+    wire_expected.insert(wire_expected.end(), wire_buckets.begin(), wire_buckets.end());
+
+    ok &= d.uptime_s == 86400;
+    ok &= d.counters.size() == METRIC_COUNTERS && d.counters[METRIC_WS_CONNECTS] == 3 && d.counters[METRIC_RX_QUEUE_DROPS] == 1;
+    ok &= d.gauges.size() == METRIC_GAUGES && d.gauges[METRIC_HEAP_FREE] == 123456 && d.gauges[METRIC_RX_QUEUE_DEPTH_MAX] == 4;
+    ok &= d.histograms.size() == METRIC_HISTOGRAMS;
+    ok &= d.histograms.size() > METRIC_LED_WIRE_US && d.histograms[METRIC_LED_WIRE_US] == wire_expected;
+    ok &= d.histograms.size() > METRIC_RX_HANDLE_US && d.histograms[METRIC_RX_HANDLE_US][0] == 2
+        && d.histograms[METRIC_RX_HANDLE_US][3 + 0] == 1 && d.histograms[METRIC_RX_HANDLE_US][3 + METRIC_HISTOGRAM_BUCKETS - 1] == 1;
+    ok &= d.tasks.size() == tasks.size();
+    for (size_t i = 0; ok && i < tasks.size(); i++) {
+        ok &= d.tasks[i].first == tasks[i].name && d.tasks[i].second == tasks[i].stack_free_min;
+    }
+
+    // the largest a report can get: every varint at five bytes
+    for (std::atomic<uint32_t>& c : metrics_counters) {
+        c = UINT32_MAX;
+    }
+    for (std::atomic<uint32_t>& g : metrics_gauges) {
+        g = UINT32_MAX;
+    }
+    for (metric_histogram_t& h : metrics_histograms) {
+        for (std::atomic<uint32_t>& b : h.buckets) {
+            b = UINT32_MAX;
+        }
+        h.count = h.sum = h.max = UINT32_MAX;
+    }
+    // task names are at most configMAX_TASK_NAME_LEN - 1 = 15 characters
+    std::vector<metric_task_t> worst_tasks(REPORT_TASKS, { "fifteen_chars__", UINT32_MAX });
+    size_t worst = metrics_encode(report, sizeof(report), UINT32_MAX, worst_tasks.data(), worst_tasks.size());
+    printf("largest report: %zu bytes with %d tasks, room for %d\n", worst, REPORT_TASKS, METRICS_REPORT_MAX);
+    if (worst == 0) {
+        printf("METRICS_REPORT_MAX is too small for the registry\n");
+        ok = false;
+    }
+
+    printf("%s\n", ok ? "report decodes to what was recorded" : "MISMATCH");
+    return ok ? 0 : 1;
+}
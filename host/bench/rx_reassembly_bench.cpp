@@ -0,0 +1,276 @@
+// Inbound message reassembly: feeds websocket messages to rx_reassembly the
+// way the websocket client delivers them, split into frames and each frame
+// into chunks, against a stand-in for rx_pool with the Kconfig default slot
+// sizes. Checks that every message comes out intact in a buffer that fits,
+// including fragmented ones whose first frame fits a small slot, that what
+// cannot fit is dropped, and that no buffer leaks; and that only pixel stream
+// frames that arrive whole skip reassembly. Reports the cost per message.
+// Exits non-zero if any case fails.
+//
+// usage: rx_reassembly_bench [messages]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "rx_reassembly.h"
+#include "ext_frame.h"
+
+// mirror the Kconfig defaults
+#define SMALL_SLOTS 8
+#define SMALL_SIZE 256
+#define LARGE_SLOTS 2
+#define LARGE_SIZE 4096
+
+static uint8_t small_data[SMALL_SLOTS][SMALL_SIZE];
+static uint8_t large_data[LARGE_SLOTS][LARGE_SIZE];
+static rx_buf_t bufs[RX_POOL_CLASSES][std::max(SMALL_SLOTS, LARGE_SLOTS)];
+static uint32_t free_mask[RX_POOL_CLASSES];
+static uint32_t pool_drops;
+static volatile uint32_t bench_sink;
+
+static void pool_reset() {
+    for (int i = 0; i < SMALL_SLOTS; i++) {
+        bufs[RX_POOL_SMALL][i] = { small_data[i], SMALL_SIZE, 0, RX_POOL_SMALL, (uint8_t)i };
+    }
+    for (int i = 0; i < LARGE_SLOTS; i++) {
+        bufs[RX_POOL_LARGE][i] = { large_data[i], LARGE_SIZE, 0, RX_POOL_LARGE, (uint8_t)i };
+    }
+    free_mask[RX_POOL_SMALL] = (1u << SMALL_SLOTS) - 1;
+    free_mask[RX_POOL_LARGE] = (1u << LARGE_SLOTS) - 1;
+    pool_drops = 0;
+}
+
+static bool pool_all_free() {
+    return free_mask[RX_POOL_SMALL] == (1u << SMALL_SLOTS) - 1 && free_mask[RX_POOL_LARGE] == (1u << LARGE_SLOTS) - 1;
+}
+
+static rx_buf_t* pool_take(rx_pool_class_t pool) {
+    if (free_mask[pool] == 0) {
+        return NULL;
+    }
+    uint8_t index = __builtin_ctz(free_mask[pool]);
+    free_mask[pool] &= ~(1u << index);
+    return &bufs[pool][index];
+}
+
+// rx_pool.h, same slot choice as the firmware's
+rx_buf_t* rx_pool_acquire(size_t len) {
+    rx_buf_t* buf = NULL;
+    if (len <= SMALL_SIZE) {
+        buf = pool_take(RX_POOL_SMALL);
+    }
+    if (buf == NULL && len <= LARGE_SIZE) {
+        buf = pool_take(RX_POOL_LARGE);
+    }
+    if (buf == NULL) {
+        pool_drops++;
+        return NULL;
+    }
+    buf->len = 0;
+    return buf;
+}
+
+void rx_pool_release(rx_buf_t* buf) {
+    if (buf != NULL) {
+        free_mask[buf->pool] |= 1u << buf->index;
+    }
+}
+
+void rx_pool_drop(rx_buf_t* buf) {
+    pool_drops++;
+    rx_pool_release(buf);
+}
+
+typedef struct reassembly_case_t {
+    const char* name;
+    std::vector<size_t> frames;     // payload length of each frame
+    size_t chunk;                   // the client hands frames over in chunks of this much
+    bool delivered;
+    rx_pool_class_t pool;           // where a delivered message must end up
+} reassembly_case_t;
+
+static uint8_t pattern(size_t i) {
+    return (uint8_t)(i * 31 + (i >> 8));
+}
+
+// Feeds the case's message; returns what came out, or NULL
+static rx_buf_t* feed_message(rx_reassembly_t* r, const reassembly_case_t& c, const std::vector<uint8_t>& message) {
+    rx_buf_t* out = NULL;
+    size_t at = 0;
+    for (size_t f = 0; f < c.frames.size(); f++) {
+        size_t frame_len = c.frames[f];
+        bool fin = f + 1 == c.frames.size();
+        size_t offset = 0;
+        do {
+            size_t n = std::min(c.chunk, frame_len - offset);
+            rx_buf_t* done = rx_reassembly_feed(r, f > 0, fin, frame_len, offset, message.data() + at + offset, n);
+            if (done) {
+                out = done;
+            }
+            offset += n;
+        } while (offset < frame_len);
+        at += frame_len;
+    }
+    return out;
+}
+
+static bool run_case(const reassembly_case_t& c) {
+    pool_reset();
+    rx_reassembly_t r;
+    rx_reassembly_init(&r);
+
+    size_t total = 0;
+    for (size_t len : c.frames) {
+        total += len;
+    }
+    std::vector<uint8_t> message(total);
+    for (size_t i = 0; i < total; i++) {
+        message[i] = pattern(i);
+    }
+
+    rx_buf_t* out = feed_message(&r, c, message);
+    bool ok;
+    if (c.delivered) {
+        ok = out != NULL && out->len == total && memcmp(out->data, message.data(), total) == 0
+            && out->pool == c.pool && pool_drops == 0 && r.rx == NULL;
+    }
+    else {
+        ok = out == NULL && pool_drops == 1;
+    }
+    rx_pool_release(out);
+    ok &= r.rx == NULL && pool_all_free();
+
+    printf("%-26s %6zu %6zu %6zu %-6s %s\n", c.name, total, c.frames.size(), c.chunk,
+        out ? (out->pool == RX_POOL_SMALL ? "small" : "large") : "-", ok ? "ok" : "FAIL");
+    return ok;
+}
+
+// A message cut short by a new one is dropped, the new one still comes through
+static bool run_interrupted() {
+    pool_reset();
+    rx_reassembly_t r;
+    rx_reassembly_init(&r);
+
+    uint8_t data[200];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = pattern(i);
+    }
+    bool ok = rx_reassembly_feed(&r, false, false, 100, 0, data, 100) == NULL;
+    rx_buf_t* out = rx_reassembly_feed(&r, false, true, 200, 0, data, 200);
+    ok &= out != NULL && out->len == 200 && memcmp(out->data, data, 200) == 0 && pool_drops == 1;
+    rx_pool_release(out);
+    ok &= pool_all_free();
+
+    printf("%-26s %6u %6u %6u %-6s %s\n", "interrupted", 200, 1, 200, out ? "small" : "-", ok ? "ok" : "FAIL");
+    return ok;
+}
+
+// A pixel stream frame as the websocket client delivers it, whole, chunked or
+// fragmented. Only the whole one may be played from the transport buffer;
+// the others have to come out of reassembly intact, for dispatch to play.
+static bool run_stream_frame(const char* name, const std::vector<size_t>& frames, size_t chunk) {
+    pool_reset();
+    rx_reassembly_t r;
+    rx_reassembly_init(&r);
+
+    size_t total = 0;
+    for (size_t len : frames) {
+        total += len;
+    }
+    std::vector<uint8_t> message(total);
+    for (size_t i = 0; i < total; i++) {
+        message[i] = pattern(i);
+    }
+    message[0] = EXT_FRAME_MARKER;
+    message[1] = EXT_FRAME_PIXEL_STREAM;
+
+    bool whole = frames.size() == 1 && chunk >= total;
+    bool ok = true;
+    rx_buf_t* out = NULL;
+    size_t at = 0;
+    for (size_t f = 0; f < frames.size(); f++) {
+        bool fin = f + 1 == frames.size();
+        for (size_t offset = 0; offset < frames[f]; offset += chunk) {
+            size_t n = std::min(chunk, frames[f] - offset);
+            const uint8_t* data = message.data() + at + offset;
+            // the websocket event only asks for frames that are not continuations
+            bool shortcut = f == 0 && rx_reassembly_is_whole_stream_frame(fin, frames[f], offset, data, n);
+            ok &= shortcut == whole;
+            if (shortcut) {
+                continue;
+            }
+            rx_buf_t* done = rx_reassembly_feed(&r, f > 0, fin, frames[f], offset, data, n);
+            if (done) {
+                out = done;
+            }
+        }
+        at += frames[f];
+    }
+
+    if (!whole) {
+        ok &= out != NULL && out->len == total && memcmp(out->data, message.data(), total) == 0;
+    }
+    rx_pool_release(out);
+    ok &= r.rx == NULL && pool_all_free();
+
+    printf("%-26s %6zu %6zu %6zu %-6s %s\n", name, total, frames.size(), chunk,
+        whole ? "direct" : out ? (out->pool == RX_POOL_SMALL ? "small" : "large") : "-", ok ? "ok" : "FAIL");
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    uint32_t messages = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    if (messages == 0) {
+        fprintf(stderr, "usage: %s [messages]\n", argv[0]);
+        return 2;
+    }
+
+    const reassembly_case_t cases[] = {
+        { "single frame", { 120 }, 1460, true, RX_POOL_SMALL },
+        { "fragments fit small", { 80, 80, 80 }, 1460, true, RX_POOL_SMALL },
+        { "small first fragment", { 200, 200, 200, 200 }, 1460, true, RX_POOL_LARGE },
+        { "chunked fragments", { 100, 900, 2500 }, 64, true, RX_POOL_LARGE },
+        { "large first fragment", { 1000, 3000 }, 512, true, RX_POOL_LARGE },
+        { "exactly large", { 96, 4000 }, 1460, true, RX_POOL_LARGE },
+        { "outgrows large", { 200, 3000, 1000 }, 1460, false, RX_POOL_LARGE },
+        { "oversize", { 5000 }, 1460, false, RX_POOL_LARGE },
+    };
+
+    printf("%-26s %6s %6s %6s %-6s\n", "case", "bytes", "frames", "chunk", "buffer");
+    int failures = 0;
+    for (const reassembly_case_t& c : cases) {
+        failures += !run_case(c);
+    }
+    failures += !run_interrupted();
+    // pts and 10 pixels, the firmware's LED_COUNT
+    failures += !run_stream_frame("stream frame", { 36 }, 1460);
+    failures += !run_stream_frame("chunked stream frame", { 36 }, 16);
+    failures += !run_stream_frame("fragmented stream frame", { 20, 16 }, 1460);
+
+    // a fragmented message that moves from a small buffer to a large one
+    const reassembly_case_t& timed = cases[3];
+    size_t total = 0;
+    for (size_t len : timed.frames) {
+        total += len;
+    }
+    std::vector<uint8_t> message(total, 0x5a);
+    pool_reset();
+    rx_reassembly_t r;
+    rx_reassembly_init(&r);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < messages; n++) {
+        rx_buf_t* out = feed_message(&r, timed, message);
+        bench_sink += out ? out->data[n % total] : 0;
+        rx_pool_release(out);
+    }
+    auto end = std::chrono::steady_clock::now();
+    printf("\n%s: %.1f ns/message\n", timed.name, std::chrono::duration<double, std::nano>(end - start).count() / messages);
+
+    return failures ? 1 : 0;
+}
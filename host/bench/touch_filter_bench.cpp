@@ -0,0 +1,168 @@
+// Runs the touch filter over simulated touches and checks the gestures it
+// reports, including under baseline drift, noise spikes and a stuck reading.
+// Samples are taken the way the touch task takes them: every
+// TOUCH_ACTIVE_PERIOD_MS during a gesture, every TOUCH_IDLE_PERIOD_MS
+// otherwise, and immediately when a press or release would raise the
+// threshold interrupt.
+//
+// Given a trace instead, replays it and prints the gestures. Traces are the
+// "trace <ms> <raw>" lines logged with CONFIG_LANTERN_TOUCH_TRACE; other log
+// lines are skipped, so a saved monitor log works as is.
+//
+// usage: touch_filter_bench [trace]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "touch_filter.h"
+
+// mirrors touch.h, which needs FreeRTOS
+#define TOUCH_ACTIVE_PERIOD_MS 10
+#define TOUCH_IDLE_PERIOD_MS 200
+
+#define BASE_RAW 30000
+#define TOUCH_GAIN 0.15     // a finger raises the reading by this much
+#define NOISE 0.005
+
+typedef struct press_t {
+    uint32_t at_ms;
+    uint32_t duration_ms;
+} press_t;
+
+typedef struct scenario_t {
+    const char* name;
+    std::vector<press_t> presses;
+    std::vector<touch_gesture_t> expected;
+    // untouched reading at a time, for drift
+    std::function<double(uint32_t)> baseline;
+    uint32_t length_ms;
+} scenario_t;
+
+typedef struct reported_t {
+    touch_gesture_t gesture;
+    uint32_t at_ms;
+    uint32_t latency_ms;    // from the first press of the gesture
+} reported_t;
+
+static bool touched(const scenario_t& s, uint32_t t) {
+    for (const press_t& p : s.presses) {
+        if (t >= p.at_ms && t < p.at_ms + p.duration_ms) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::vector<reported_t> simulate(const scenario_t& s, touch_filter_t* filter) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> noise(-NOISE, NOISE);
+    std::vector<reported_t> reported;
+
+    uint32_t next_ms = 0;
+    bool was_touched = false;
+    for (uint32_t t = 0; t < s.length_ms; t++) {
+        bool now_touched = touched(s, t);
+        // the interrupt fires on the edge
+        if (t < next_ms && now_touched == was_touched) {
+            continue;
+        }
+        was_touched = now_touched;
+
+        double raw = s.baseline(t) * (1 + noise(rng) + (now_touched ? TOUCH_GAIN : 0));
+        touch_gesture_t g = touch_filter_update(filter, t, (uint32_t)raw);
+        if (g != TOUCH_GESTURE_NONE) {
+            reported.push_back({ g, t, t - filter->gesture_ms });
+        }
+        next_ms = t + (touch_filter_busy(filter) ? TOUCH_ACTIVE_PERIOD_MS : TOUCH_IDLE_PERIOD_MS);
+    }
+    return reported;
+}
+
+static int replay(const char* path, touch_filter_t* filter) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "can't read %s\n", path);
+        return 2;
+    }
+
+    char line[256];
+    uint32_t samples = 0;
+    while (fgets(line, sizeof(line), f)) {
+        const char* p = strstr(line, "trace ");
+        unsigned long t, raw;
+        if (p == NULL || sscanf(p, "trace %lu %lu", &t, &raw) != 2) {
+            continue;
+        }
+        samples++;
+        touch_gesture_t g = touch_filter_update(filter, t, raw);
+        if (g != TOUCH_GESTURE_NONE) {
+            printf("%8lu ms  %-10s  %4lu ms after the first press  baseline %lu\n", t, touch_gesture_name(g),
+                t - filter->gesture_ms, (unsigned long)touch_filter_baseline(filter));
+        }
+    }
+    fclose(f);
+
+    printf("%u samples, %u short presses rejected, %u recalibrations\n", samples, filter->rejected, filter->recalibrations);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    touch_filter_settings_t settings = TOUCH_FILTER_SETTINGS_DEFAULT;
+    touch_filter_t filter;
+
+    if (argc > 1) {
+        touch_filter_init(&filter, &settings);
+        return replay(argv[1], &filter);
+    }
+
+    auto flat = [](uint32_t) { return (double)BASE_RAW; };
+    std::vector<scenario_t> scenarios = {
+        { "tap", { { 1000, 120 } }, { TOUCH_GESTURE_TAP }, flat, 3000 },
+        { "short tap", { { 1000, 40 } }, { TOUCH_GESTURE_TAP }, flat, 3000 },
+        { "double tap", { { 1000, 100 }, { 1250, 100 } }, { TOUCH_GESTURE_DOUBLE_TAP }, flat, 3000 },
+        { "two taps", { { 1000, 100 }, { 1800, 100 } }, { TOUCH_GESTURE_TAP, TOUCH_GESTURE_TAP }, flat, 3000 },
+        { "long press", { { 1000, 1500 } }, { TOUCH_GESTURE_LONG_PRESS }, flat, 4000 },
+        { "tap, long press", { { 1000, 100 }, { 1200, 1500 } }, { TOUCH_GESTURE_TAP, TOUCH_GESTURE_LONG_PRESS }, flat, 4000 },
+        { "spike", { { 1000, 3 } }, {}, flat, 3000 },
+        { "tap after spike", { { 1000, 3 }, { 1100, 100 } }, { TOUCH_GESTURE_TAP }, flat, 3000 },
+        // humidity: +25% over two minutes, more than the press threshold
+        { "drift up", { { 115000, 100 } }, { TOUCH_GESTURE_TAP },
+            [](uint32_t t) { return BASE_RAW * (1 + 0.25 * t / 120000); }, 120000 },
+        // the lantern is put into a different enclosure
+        { "step down", { { 5000, 100 } }, { TOUCH_GESTURE_TAP },
+            [](uint32_t t) { return BASE_RAW * (t < 2000 ? 1 : 0.85); }, 8000 },
+        // water on the pad looks like a press that never ends
+        { "stuck, then tap", { { 1000, 30000 }, { 32000, 100 } }, { TOUCH_GESTURE_LONG_PRESS, TOUCH_GESTURE_TAP },
+            [](uint32_t t) { return BASE_RAW * (t < 1000 ? 1 : 1.15); }, 34000 },
+    };
+
+    bool ok = true;
+    printf("%-18s %-28s %-28s %s\n", "scenario", "expected", "reported", "latency (ms)");
+    for (const scenario_t& s : scenarios) {
+        touch_filter_init(&filter, &settings);
+        std::vector<reported_t> reported = simulate(s, &filter);
+
+        std::string expected_names, reported_names, latencies;
+        for (touch_gesture_t g : s.expected) {
+            expected_names += std::string(expected_names.empty() ? "" : ",") + touch_gesture_name(g);
+        }
+        bool match = reported.size() == s.expected.size();
+        for (size_t i = 0; i < reported.size(); i++) {
+            reported_names += std::string(i ? "," : "") + touch_gesture_name(reported[i].gesture);
+            latencies += (i ? "," : "") + std::to_string(reported[i].latency_ms);
+            match &= i < s.expected.size() && reported[i].gesture == s.expected[i];
+        }
+
+        printf("%-18s %-28s %-28s %s%s\n", s.name, expected_names.empty() ? "-" : expected_names.c_str(),
+            reported_names.empty() ? "-" : reported_names.c_str(), latencies.empty() ? "-" : latencies.c_str(),
+            match ? "" : "  MISMATCH");
+        ok &= match;
+    }
+
+    return ok ? 0 : 1;
+}
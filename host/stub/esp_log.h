@@ -0,0 +1,10 @@
+#pragma once
+
+// Host stand-in for ESP-IDF logging: compiled out, so benchmarks time the
+// code and not the console
+#define ESP_LOG_HOST(tag, format, ...) do { (void)(tag); } while (0)
+#define ESP_LOGE(tag, format, ...) ESP_LOG_HOST(tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_HOST(tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_HOST(tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_HOST(tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_HOST(tag, format, ##__VA_ARGS__)
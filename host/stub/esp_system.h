@@ -0,0 +1,4 @@
+#pragma once
+
+// Host stand-in; the benchmark defines it
+void esp_restart(void);
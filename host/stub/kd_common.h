@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stddef.h>
+
+// Host stand-in for the parts of the kd_common component the dispatch code
+// uses; the benchmark defines them
+void kd_common_get_claim_token(char* buffer, size_t* len);
@@ -1,180 +1,487 @@
 #include "led.h"
 
 #include <string.h>
+#include <atomic>
+#include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "driver/rmt_tx.h"
 #include "led_strip_encoder.h"
+#include "led_render.h"
+#include "led_output.h"
+#include "led_transition.h"
+#include "led_program.h"
+#include "led_stream.h"
+#include "metrics.h"
 
 #include <esp_wifi.h>
 #include "wifi_provisioning/manager.h"
 #include "protocomm_ble.h"
 #include "kd_common.h"
 #include "pinout.h"
+#include "static_alloc.h"
 
 static const char* TAG = "led";
 
-LEDEffect_t current_effect = LED_OFF;
-static uint8_t led_speed = 10;
-static uint8_t led_brightness = 255;
-static uint8_t led_color[3] = { 0, 0, 0 };
-static bool fading_out = false;
-static uint32_t blink_changed_at = 0;
-static bool blink_state = false;
-static bool fading_in = false;
+// Program slots. A new program is parsed into led_program_scratch and copied
+// into a slot that neither the published state nor the LED task references,
+// so what is playing (or crossfading out) is never written and a rejected
+// program touches nothing. The LED task pins the slots it renders from in
+// led_program_pins, one bit per slot. Three slots cover the current program,
+// the one fading out and the one being loaded.
+#define LED_PROGRAM_SLOTS 3
+// how long led_play_program() waits for the LED task to release a slot
+#define LED_PROGRAM_SLOT_WAIT_MS 100
+
+static led_program_t led_programs[LED_PROGRAM_SLOTS];
+static led_program_t led_program_scratch;
+static std::atomic<uint32_t> led_program_pins(0);
+
+// Realtime frames from the server, see led_play_stream_frame()
+static led_stream_t led_stream;
+static portMUX_TYPE led_stream_push_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Fades run over the same time the old 5-per-frame ramp took at 30 FPS
+#define LED_FADE_MS 1700
+
+static led_render_ctx_t render_ctx;
+static led_transition_t led_transition;
+static led_pixel_t led_transition_scratch[LED_COUNT];
+static led_pixel_t led_frame[LED_COUNT];
+static led_output_t led_output;
+static uint8_t led_dither_residual[LED_COUNT * 3];
+
+// Frame N+1 renders into one buffer while the RMT driver is still reading
+// frame N out of another. Buffers come back through the on_trans_done callback.
+#define LED_FRAME_BUFFERS 2
+
+static uint8_t led_buffers[LED_FRAME_BUFFERS][LED_COUNT * LED_OUTPUT_BYTES_PER_PIXEL] = { 0 };
+static QueueHandle_t led_free_buffers = NULL;
+static queue_storage_t<uint8_t, LED_FRAME_BUFFERS> led_free_buffers_storage;
+static volatile uint8_t led_inflight[LED_FRAME_BUFFERS];
+static volatile uint8_t led_inflight_head = 0;
+static uint8_t led_inflight_tail = 0;
+static int64_t led_inflight_us[LED_FRAME_BUFFERS];
+static uint8_t led_last_frame[LED_COUNT * LED_OUTPUT_BYTES_PER_PIXEL] = { 0 };
+
+// Latency trace: the state version being waited for (0 for none), then the
+// in-flight slot carrying its first frame until the transmit is done
+static std::atomic<uint32_t> led_trace_wanted(0);
+static led_trace_done_t led_trace_done = NULL;
+static int64_t led_trace_render_us;
+static volatile int64_t led_trace_wire_us;
+static volatile int8_t led_trace_slot = -1;
+
+static rmt_channel_handle_t led_chan = NULL;
+static rmt_encoder_handle_t led_encoder = NULL;
+
+#define LED_NOTIFY_FRAME (1 << 0)
+#define LED_NOTIFY_STATE (1 << 1)
+#define LED_NOTIFY_TRACE (1 << 2)
+
+static TaskHandle_t led_task_handle = NULL;
+static task_storage_t<CONFIG_LANTERN_LED_TASK_STACK> led_task_storage;
+static esp_timer_handle_t led_frame_timer = NULL;
+static const uint32_t led_frame_period_us = 1000000 / CONFIG_LANTERN_LED_FPS;
+static bool led_deadline_reset = false;
+static bool led_idle = false;
+
+// Touch feedback pulse over whatever is playing, see led_pulse(). Guarded by
+// led_state_lock; it is not part of the state so it never starts a crossfade.
+static uint32_t led_pulse_start_ms = 0;
+static uint16_t led_pulse_ms = 0;
+
+// Published LED state (seqlock). Writers serialise on led_state_lock and hold
+// the sequence odd while they write; the render task copies the struct without
+// locking and retries if the sequence moved underneath it. The sequence also
+// serves as the state version: the task goes idle only while it is unchanged.
+static led_state_t led_state = { LED_OFF, { 0, 0, 0 }, 10, 255, CONFIG_LANTERN_LED_TRANSITION_MS, LED_EASE_IN_OUT, NULL, NULL };
+static std::atomic<uint32_t> led_state_seq(0);
+static portMUX_TYPE led_state_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void led_state_write_begin() {
+    taskENTER_CRITICAL(&led_state_lock);
+    led_state_seq.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
 
-static uint8_t led_buffer[LED_COUNT * 4] = { 0 };
+static void led_state_write_end() {
+    led_state_seq.fetch_add(1, std::memory_order_release);
+    taskEXIT_CRITICAL(&led_state_lock);
+
+    if (led_task_handle) {
+        xTaskNotify(led_task_handle, LED_NOTIFY_STATE, eSetBits);
+    }
+}
+
+static uint32_t led_state_read(led_state_t* state) {
+    uint32_t seq;
+    while (1) {
+        seq = led_state_seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+        *state = led_state;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (led_state_seq.load(std::memory_order_relaxed) == seq) {
+            return seq;
+        }
+    }
+}
+
+void led_state_init(led_state_t* state) {
+    led_render_default_state(state, CONFIG_LANTERN_LED_TRANSITION_MS);
+}
+
+void led_apply_state(const led_state_t* state) {
+    led_state_write_begin();
+    led_state = *state;
+    led_state_write_end();
+}
+
+uint32_t led_state_version() {
+    // a write in progress ends newer than this
+    return led_state_seq.load(std::memory_order_acquire) & ~1u;
+}
+
+void led_trace_version(uint32_t version, led_trace_done_t done) {
+    led_trace_done = done;
+    led_trace_wanted.store(version, std::memory_order_release);
+}
+
+void led_get_state(led_state_t* state) {
+    led_state_read(state);
+}
+
+void led_show(LEDEffect_t effect, uint8_t r, uint8_t g, uint8_t b, uint8_t brightness) {
+    led_state_write_begin();
+    led_state.effect = effect;
+    led_state.color[0] = r;
+    led_state.color[1] = g;
+    led_state.color[2] = b;
+    led_state.brightness = brightness;
+    led_state.transition_ms = CONFIG_LANTERN_LED_TRANSITION_MS;
+    led_state.ease = LED_EASE_IN_OUT;
+    led_state_write_end();
+}
+
+static uint32_t led_program_pin(const led_program_t* program) {
+    for (int i = 0; i < LED_PROGRAM_SLOTS; i++) {
+        if (program == &led_programs[i]) {
+            return 1u << i;
+        }
+    }
+    return 0;
+}
+
+// A slot neither state nor the LED task uses, or NULL while all are busy
+static led_program_t* led_program_free_slot(const led_state_t* state) {
+    // pairs with the pin-then-recheck in led_loop(): a program the task picks
+    // up from an older state is pinned before this sees the newer one
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint32_t busy = led_program_pins.load() | led_program_pin(state->program);
+    for (int i = 0; i < LED_PROGRAM_SLOTS; i++) {
+        if (!(busy & (1u << i))) {
+            return &led_programs[i];
+        }
+    }
+    return NULL;
+}
+
+bool led_play_program(const uint8_t* data, size_t len) {
+    led_program_err_t err = led_program_parse(data, len, LED_COUNT, &led_program_scratch);
+    if (err != LED_PROGRAM_OK) {
+        ESP_LOGE(TAG, "rejected animation program (%d bytes): error %d", (int)len, err);
+        return false;
+    }
+
+    // all three are only busy while the LED task has yet to render the
+    // current state, which it does within a frame
+    led_state_t state;
+    led_get_state(&state);
+    led_program_t* program = led_program_free_slot(&state);
+    for (int waited = 0; program == NULL && waited < LED_PROGRAM_SLOT_WAIT_MS; waited += 10) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        led_get_state(&state);
+        program = led_program_free_slot(&state);
+    }
+    if (program == NULL) {
+        ESP_LOGE(TAG, "no free animation program slot, dropping program");
+        return false;
+    }
+    *program = led_program_scratch;
+
+    // only the fields a program owns, like led_play_stream_frame()
+    led_state_write_begin();
+    led_state.effect = LED_PROGRAM;
+    led_state.program = program;
+    led_state.transition_ms = CONFIG_LANTERN_LED_TRANSITION_MS;
+    led_state.ease = LED_EASE_IN_OUT;
+    led_state_write_end();
+    return true;
+}
+
+bool led_play_stream_frame(const uint8_t* data, size_t len) {
+    if (len < 4 || (len - 4) % sizeof(led_pixel_t) != 0) {
+        return false;
+    }
+
+    uint32_t pts_ms = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+    // whole frames come from the websocket task, reassembled ones from the
+    // sockets task; the jitter buffer takes one producer at a time
+    taskENTER_CRITICAL(&led_stream_push_lock);
+    uint32_t arrival_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    bool queued = led_stream_push(&led_stream, arrival_ms, pts_ms, data + 4, (len - 4) / sizeof(led_pixel_t));
+    taskEXIT_CRITICAL(&led_stream_push_lock);
+
+    // The first frame of a stream takes over from whatever is playing. This
+    // can run on the websocket task while the sockets task sets state, so it
+    // checks and writes only the fields it owns under the lock instead of
+    // writing back a whole snapshot, which could undo a concurrent setter.
+    led_state_t state;
+    led_get_state(&state);
+    if (state.effect == LED_STREAM && state.stream == &led_stream) {
+        // a stream that ran dry leaves the LED task idle until this frame
+        if (queued && led_task_handle) {
+            xTaskNotify(led_task_handle, LED_NOTIFY_STATE, eSetBits);
+        }
+        return queued;
+    }
+
+    led_state_write_begin();
+    led_state.effect = LED_STREAM;
+    led_state.stream = &led_stream;
+    led_state.transition_ms = CONFIG_LANTERN_LED_TRANSITION_MS;
+    led_state.ease = LED_EASE_IN_OUT;
+    led_state_write_end();
+    return queued;
+}
+
+void led_get_stream_stats(led_stream_stats_t* stats) {
+    *stats = led_stream.stats;
+}
 
 void led_set_effect(LEDEffect_t effect) {
-    current_effect = effect;
+    led_state_write_begin();
+    led_state.effect = effect;
+    led_state.transition_ms = CONFIG_LANTERN_LED_TRANSITION_MS;
+    led_state_write_end();
 }
 
 void led_set_color(uint8_t r, uint8_t g, uint8_t b) {
-    led_color[0] = r;
-    led_color[1] = g;
-    led_color[2] = b;
+    led_state_write_begin();
+    led_state.color[0] = r;
+    led_state.color[1] = g;
+    led_state.color[2] = b;
+    led_state.transition_ms = CONFIG_LANTERN_LED_TRANSITION_MS;
+    led_state_write_end();
 }
 
 void led_set_speed(uint8_t speed) {
-    led_speed = speed;
+    led_state_write_begin();
+    led_state.speed = speed;
+    led_state_write_end();
 }
 
 void led_set_brightness(uint8_t brightness) {
-    led_brightness = brightness;
+    led_state_write_begin();
+    led_state.brightness = brightness;
+    led_state.transition_ms = CONFIG_LANTERN_LED_TRANSITION_MS;
+    led_state_write_end();
 }
 
 void led_fade_out() {
-    fading_out = true;
-    fading_in = false;
+    led_state_write_begin();
+    led_state.brightness = 0;
+    led_state.transition_ms = LED_FADE_MS;
+    led_state_write_end();
 }
 
 void led_fade_in() {
-    fading_in = true;
-    fading_out = false;
+    led_state_write_begin();
+    led_state.brightness = 255;
+    led_state.transition_ms = LED_FADE_MS;
+    led_state_write_end();
 }
 
-void handle_fading() {
-    if (fading_out) {
-        led_brightness -= 5;
-        if (led_brightness <= 0) {
-            led_brightness = 0;
-            fading_out = false;
-        }
-    }
-    else if (fading_in) {
-        led_brightness += 5;
-        if (led_brightness >= 255) {
-            led_brightness = 255;
-            fading_in = false;
-        }
+void led_pulse(uint16_t duration_ms) {
+    taskENTER_CRITICAL(&led_state_lock);
+    led_pulse_start_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    led_pulse_ms = duration_ms;
+    taskEXIT_CRITICAL(&led_state_lock);
+
+    if (led_task_handle) {
+        xTaskNotify(led_task_handle, LED_NOTIFY_STATE, eSetBits);
     }
 }
 
-void tx_buf_fill_color(uint8_t r, uint8_t g, uint8_t b) {
-    for (int i = 0; i < LED_COUNT; i++) {
-        led_buffer[i * 4 + 0] = g;
-        led_buffer[i * 4 + 1] = r;
-        led_buffer[i * 4 + 2] = b;
-        led_buffer[i * 4 + 3] = 0;
+// Overlays the pulse, if one is running
+static bool led_pulse_render(uint32_t now_ms, led_pixel_t* frame) {
+    taskENTER_CRITICAL(&led_state_lock);
+    uint32_t start_ms = led_pulse_start_ms;
+    uint16_t duration_ms = led_pulse_ms;
+    taskEXIT_CRITICAL(&led_state_lock);
+    if (duration_ms == 0) {
+        return false;
     }
-}
 
-void tx_buf_set_color_at(int index, uint8_t r, uint8_t g, uint8_t b) {
-    if (index < 0 || index >= LED_COUNT) {
-        ESP_LOGE(TAG, "Index out of bounds");
-        return;
+    // frames render on their deadline, which can be just before the touch
+    int32_t elapsed_ms = (int32_t)(now_ms - start_ms);
+    if (led_render_pulse(frame, LED_COUNT, elapsed_ms > 0 ? elapsed_ms : 0, duration_ms)) {
+        return true;
     }
-    led_buffer[index * 4 + 0] = g;
-    led_buffer[index * 4 + 1] = r;
-    led_buffer[index * 4 + 2] = b;
-    led_buffer[index * 4 + 3] = 0;
-}
-
-void led_blink() {
-    uint32_t changeInterval = 1000 / led_speed;
-    if (xTaskGetTickCount() - blink_changed_at > pdMS_TO_TICKS(changeInterval)) {
-        blink_state = !blink_state;
-        if (blink_state) {
-            tx_buf_fill_color(led_color[0], led_color[1], led_color[2]);
-        }
-        else {
-            tx_buf_fill_color(0, 0, 0);
-        }
-        blink_changed_at = xTaskGetTickCount();
+
+    taskENTER_CRITICAL(&led_state_lock);
+    if (led_pulse_start_ms == start_ms) {
+        led_pulse_ms = 0;
     }
+    taskEXIT_CRITICAL(&led_state_lock);
+    return false;
 }
 
-void led_breathe() {
-    static uint8_t brightness = 0;
-    static bool increasing = true;
+// Whether going from a to b changes what is on the lantern enough to crossfade
+static bool led_state_visible_change(const led_state_t* a, const led_state_t* b) {
+    return a->effect != b->effect || a->brightness != b->brightness || a->program != b->program || a->stream != b->stream
+        || a->color[0] != b->color[0] || a->color[1] != b->color[1] || a->color[2] != b->color[2];
+}
 
-    if (increasing) {
-        brightness += 5;
-        if (brightness >= 255) {
-            brightness = 255;
-            increasing = false;
+// Renders one frame from the latest state snapshot. Returns true when the frame
+// is static: it will not change until the state does. *version receives the
+// state version it was rendered from.
+bool led_loop(uint32_t now_ms, uint8_t* buffer, uint32_t* version) {
+    static led_state_t shown;
+    static uint32_t shown_version = 0;
+    static uint8_t shown_brightness = 0;
+    static bool started = false;
+
+    // Pin the state's program before rendering it, then check the state did
+    // not move on meanwhile: a writer that has already replaced it may not
+    // have seen the pin and could be reusing the slot
+    led_state_t state;
+    uint32_t pins = led_program_pins.load(std::memory_order_relaxed);
+    do {
+        *version = led_state_read(&state);
+        led_program_pins.store(pins | led_program_pin(state.program));
+    } while (led_state_seq.load() != *version);
+
+    if (!started || *version != shown_version) {
+        if (started && led_state_visible_change(&shown, &state)) {
+            led_transition_start(&led_transition, &shown, &render_ctx, led_frame, shown_brightness,
+                now_ms, state.transition_ms, (led_ease_t)state.ease);
         }
+        shown = state;
+        shown_version = *version;
+        started = true;
+    }
+
+    uint8_t brightness = led_transition_render(&led_transition, &render_ctx, &state, now_ms, led_frame);
+    shown_brightness = brightness;
+
+    // release what is no longer rendered
+    pins = led_program_pin(state.program);
+    if (led_transition.active && !led_transition.frozen) {
+        pins |= led_program_pin(led_transition.from.program);
+    }
+    led_program_pins.store(pins, std::memory_order_release);
+
+    bool pulsing = led_pulse_render(now_ms, led_frame);
+
+    // The LUT is built for the brighter end of a fade and only rebuilt when
+    // that changes; the frames in between scale its output
+    uint8_t peak = state.brightness;
+    if (led_transition.active && led_transition.from_brightness > peak) {
+        peak = led_transition.from_brightness;
+    }
+    led_output_set_brightness(&led_output, peak);
+    led_output_set_fade(&led_output, brightness);
+
+    bool is_static = !pulsing && !led_transition.active && !led_render_is_animated(&state);
+    if (is_static) {
+        led_output_write_rounded(&led_output, led_frame, buffer);
     }
     else {
-        brightness -= 5;
-        if (brightness <= 0) {
-            brightness = 0;
-            increasing = true;
-        }
+        led_output_write(&led_output, led_frame, buffer);
+    }
+    return is_static;
+}
+
+// Transactions complete in submission order, so the oldest in-flight buffer is the one done
+static bool IRAM_ATTR led_trans_done_cb(rmt_channel_handle_t channel, const rmt_tx_done_event_data_t* edata, void* user_ctx) {
+    BaseType_t woken = pdFALSE;
+    uint8_t index = led_inflight[led_inflight_head];
+    int64_t now = esp_timer_get_time();
+    metrics_record(METRIC_LED_WIRE_US, (uint32_t)(now - led_inflight_us[led_inflight_head]));
+    if (led_trace_slot == led_inflight_head) {
+        led_trace_slot = -1;
+        led_trace_wire_us = now;
+        xTaskNotifyFromISR(led_task_handle, LED_NOTIFY_TRACE, eSetBits, &woken);
     }
+    led_inflight_head = (led_inflight_head + 1) % LED_FRAME_BUFFERS;
+    xQueueSendFromISR(led_free_buffers, &index, &woken);
+    return woken == pdTRUE;
+}
 
-    tx_buf_fill_color(led_color[0] * brightness / 255, led_color[1] * brightness / 255, led_color[2] * brightness / 255);
+static void led_frame_timer_cb(void* arg) {
+    xTaskNotify(led_task_handle, LED_NOTIFY_FRAME, eSetBits);
 }
 
-//LEDs are arranged in a circle, loading spinner effect
-void led_cyclic() {
-    static uint8_t offset = 0;
-    static uint32_t last_update = 0;
-    static int trail_size = 5;
+// Lateness of the frame start against its absolute deadline. Deadlines that
+// passed entirely while the previous frame was still running count as overruns.
+static void track_deadline(int64_t now, int64_t* deadline) {
+    while (now - *deadline >= led_frame_period_us) {
+        *deadline += led_frame_period_us;
+        metrics_count(METRIC_LED_OVERRUNS);
+    }
 
-    uint32_t changeInterval = 1000 / led_speed;
-    if (xTaskGetTickCount() - last_update > pdMS_TO_TICKS(changeInterval)) {
-        offset = (offset + 1) % LED_COUNT;
-        for (int i = 0; i < LED_COUNT; i++) {
-            if (i < trail_size) {
-                tx_buf_set_color_at((i + offset) % LED_COUNT, led_color[0], led_color[1], led_color[2]);
-            }
-            else {
-                tx_buf_set_color_at((i + offset) % LED_COUNT, 0, 0, 0);
-            }
-        }
-        last_update = xTaskGetTickCount();
+    uint32_t lateness = now > *deadline ? (uint32_t)(now - *deadline) : 0;
+    metrics_record(METRIC_LED_JITTER_US, lateness);
+}
+
+// A traced frame has its transmit-done time taken by led_trans_done_cb
+static bool led_submit(uint8_t index, bool traced = false) {
+    rmt_transmit_config_t tx_config = {
+        .loop_count = 0, // no transfer loop
+    };
+
+    led_inflight[led_inflight_tail] = index;
+    led_inflight_us[led_inflight_tail] = esp_timer_get_time();
+    if (traced) {
+        led_trace_slot = led_inflight_tail;
     }
+    led_inflight_tail = (led_inflight_tail + 1) % LED_FRAME_BUFFERS;
+    if (rmt_transmit(led_chan, led_encoder, led_buffers[index], sizeof(led_buffers[index]), &tx_config) != ESP_OK) {
+        ESP_LOGE(TAG, "rmt_transmit failed");
+        led_inflight_tail = (led_inflight_tail + LED_FRAME_BUFFERS - 1) % LED_FRAME_BUFFERS;
+        led_trace_slot = -1;
+        xQueueSend(led_free_buffers, &index, 0);
+        return false;
+    }
+
+    memcpy(led_last_frame, led_buffers[index], sizeof(led_last_frame));
+    metrics_count(METRIC_LED_FRAMES_SENT);
+    return true;
 }
 
-void led_loop() {
-    handle_fading();
-
-    switch (current_effect) {
-    case LED_OFF:
-        tx_buf_fill_color(0, 0, 0);
-        break;
-    case LED_SOLID:
-        tx_buf_fill_color(led_color[0] * led_brightness / 255, led_color[1] * led_brightness / 255, led_color[2] * led_brightness / 255);
-        break;
-    case LED_BLINK:
-        led_blink();
-        break;
-    case LED_BREATHE:
-        led_breathe();
-        break;
-    case LED_CYCLIC:
-        led_cyclic();
-        break;
-    case LED_RAINBOW:
-        // Implement rainbow effect here
-        break;
+static void led_trace_finish(int64_t wire_us) {
+    if (led_trace_done) {
+        led_trace_done(led_trace_render_us, wire_us);
     }
 }
 
+// Resend the last frame as-is, for strips that lose their latch over time
+static void led_refresh() {
+    uint8_t index;
+    xQueueReceive(led_free_buffers, &index, portMAX_DELAY);
+    memcpy(led_buffers[index], led_last_frame, sizeof(led_last_frame));
+    led_submit(index);
+}
+
 void led_task(void* pvParameter) {
-    rmt_channel_handle_t led_chan = NULL;
+    led_task_handle = xTaskGetCurrentTaskHandle();
+
     rmt_tx_channel_config_t tx_chan_config = {
         .gpio_num = (gpio_num_t)LED_PIN,
         .clk_src = RMT_CLK_SRC_DEFAULT, // select source clock
@@ -185,37 +492,147 @@ void led_task(void* pvParameter) {
 
     rmt_new_tx_channel(&tx_chan_config, &led_chan);
 
-    rmt_encoder_handle_t led_encoder = NULL;
+    led_free_buffers = queue_create(&led_free_buffers_storage);
+    for (uint8_t i = 0; i < LED_FRAME_BUFFERS; i++) {
+        xQueueSend(led_free_buffers, &i, 0);
+    }
+
+    rmt_tx_event_callbacks_t tx_callbacks = {
+        .on_trans_done = led_trans_done_cb,
+    };
+    rmt_tx_register_event_callbacks(led_chan, &tx_callbacks, NULL);
+
     led_strip_encoder_config_t encoder_config = {
         .resolution = 10000000,
     };
     rmt_new_led_strip_encoder(&encoder_config, &led_encoder);
     rmt_enable(led_chan);
 
-    rmt_transmit_config_t tx_config = {
-        .loop_count = 0, // no transfer loop
+    led_render_init(&render_ctx);
+    led_transition_init(&led_transition, led_transition_scratch, LED_COUNT);
+    led_output_init(&led_output, led_dither_residual, LED_COUNT);
+#ifdef CONFIG_LANTERN_LED_DITHER
+    led_output_set_dither(&led_output, true);
+#endif
+
+    esp_timer_create_args_t timer_args = {
+        .callback = led_frame_timer_cb,
+        .name = "led_frame",
     };
+    esp_timer_create(&timer_args, &led_frame_timer);
+    esp_timer_start_periodic(led_frame_timer, led_frame_period_us);
 
+    int64_t deadline = esp_timer_get_time();
     while (1) {
-        led_loop();
+        uint32_t notified = 0;
+        if (led_idle) {
+#if CONFIG_LANTERN_LED_IDLE_REFRESH_MS > 0
+            TickType_t refresh = pdMS_TO_TICKS(CONFIG_LANTERN_LED_IDLE_REFRESH_MS);
+#else
+            TickType_t refresh = portMAX_DELAY;
+#endif
+            if (xTaskNotifyWait(0, UINT32_MAX, &notified, refresh) != pdTRUE) {
+                led_refresh();
+                continue;
+            }
+            if (notified & LED_NOTIFY_TRACE) {
+                led_trace_finish(led_trace_wire_us);
+            }
+            if (!(notified & LED_NOTIFY_STATE)) {
+                continue;
+            }
 
-        rmt_transmit(led_chan, led_encoder, led_buffer, sizeof(led_buffer), &tx_config);
-        rmt_tx_wait_all_done(led_chan, portMAX_DELAY);
-        vTaskDelay(pdMS_TO_TICKS(1000 / 30)); // 30 FPS
+            // render the change right away and restart the frame clock from here
+            led_idle = false;
+            esp_timer_start_periodic(led_frame_timer, led_frame_period_us);
+            led_deadline_reset = true;
+        }
+        else {
+            xTaskNotifyWait(0, UINT32_MAX, &notified, portMAX_DELAY);
+            if (notified & LED_NOTIFY_TRACE) {
+                led_trace_finish(led_trace_wire_us);
+            }
+            if (!(notified & LED_NOTIFY_FRAME)) {
+                continue;
+            }
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (led_deadline_reset) {
+            // timer was (re)started, start a fresh deadline grid
+            led_deadline_reset = false;
+            deadline = now;
+        }
+        else {
+            deadline += led_frame_period_us;
+        }
+        track_deadline(now, &deadline);
+
+        // only blocks if every buffer is still queued on the wire
+        uint8_t index;
+        xQueueReceive(led_free_buffers, &index, portMAX_DELAY);
+
+        // effects run on the deadline, not the wakeup time, so late frames don't stutter
+        uint32_t version;
+        bool is_static = led_loop((uint32_t)(deadline / 1000), led_buffers[index], &version);
+
+        // a traced change is seen with its first frame that differs, or
+        // once it settles without changing anything visible
+        uint32_t wanted = led_trace_wanted.load(std::memory_order_acquire);
+        bool changed = memcmp(led_buffers[index], led_last_frame, sizeof(led_last_frame)) != 0;
+        bool traced = wanted && (int32_t)(version - wanted) >= 0 && (changed || is_static);
+        if (traced) {
+            led_trace_wanted.store(0, std::memory_order_relaxed);
+            led_trace_render_us = esp_timer_get_time();
+        }
+
+        if (!changed) {
+            xQueueSend(led_free_buffers, &index, 0);
+            if (traced) {
+                led_trace_finish(led_trace_render_us);
+            }
+        }
+        else if (!led_submit(index, traced) && traced) {
+            led_trace_finish(0);
+        }
+
+        uint32_t frame_time = (uint32_t)(esp_timer_get_time() - now);
+        metrics_record(METRIC_LED_FRAME_US, frame_time);
+
+        // nothing will change until a setter runs, stop the frame clock
+        if (is_static && version == led_state_seq.load(std::memory_order_acquire)) {
+            esp_timer_stop(led_frame_timer);
+            led_idle = true;
+        }
     }
 }
 
-TaskHandle_t prov_led_task_handle = NULL;
-void prov_led_task(void* pvParameter) {
+// Shows the proof-of-possession token as a sequence of colors while a phone
+// is connected over BLE. One persistent task, started and stopped by
+// notification; the latest request wins.
+#define PROV_LED_START 1
+#define PROV_LED_STOP 2
+
+static TaskHandle_t prov_led_task_handle = NULL;
+static task_storage_t<CONFIG_LANTERN_PROV_LED_TASK_STACK> prov_led_task_storage;
+
+// Sleeps unless a new request comes in first; returns it, or 0
+static uint32_t prov_led_sleep(uint32_t ms) {
+    return ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms));
+}
+
+// Runs until the display is stopped or restarted; returns that request
+static uint32_t prov_led_show() {
     char* popToken = kd_common_provisioning_get_pop_token();
     uint8_t currentChar = 0;
+    uint32_t request = 0;
     while (1) {
         if (popToken[currentChar] == '\0') {
             currentChar = 0;
-            led_set_effect(LED_OFF);
-            led_set_color(0, 0, 0);
-            led_set_brightness(0);
-            vTaskDelay(pdMS_TO_TICKS(3000));
+            led_show(LED_OFF, 0, 0, 0, 0);
+            if ((request = prov_led_sleep(3000))) {
+                return request;
+            }
         }
         switch (popToken[currentChar]) {
         case '1':
@@ -239,36 +656,44 @@ void prov_led_task(void* pvParameter) {
         default:
             led_set_color(255, 255, 255);
         }
-        led_set_effect(LED_SOLID);
         led_set_brightness(255);
-        vTaskDelay(pdMS_TO_TICKS(1500));
+        led_set_effect(LED_SOLID);
+        if ((request = prov_led_sleep(1500))) {
+            return request;
+        }
         led_set_effect(LED_OFF);
-        vTaskDelay(pdMS_TO_TICKS(750));
+        if ((request = prov_led_sleep(750))) {
+            return request;
+        }
 
         currentChar++;
     }
 }
 
-void wifi_prov_connected(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
-    if (prov_led_task_handle) {
-        vTaskDelete(prov_led_task_handle);
-        prov_led_task_handle = NULL;
+static void prov_led_task(void* pvParameter) {
+    uint32_t request = 0;
+    while (1) {
+        if (request != PROV_LED_START) {
+            request = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        request = prov_led_show();
+        if (request == PROV_LED_STOP) {
+            led_set_effect(LED_OFF);
+        }
     }
-    xTaskCreate(prov_led_task, "prov_led_task", 4096, NULL, 5, &prov_led_task_handle);
+}
+
+void wifi_prov_connected(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+    xTaskNotify(prov_led_task_handle, PROV_LED_START, eSetValueWithOverwrite);
 }
 
 void wifi_prov_disconnected(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
-    if (prov_led_task_handle) {
-        vTaskDelete(prov_led_task_handle);
-        prov_led_task_handle = NULL;
-    }
-    led_set_effect(LED_OFF);
+    xTaskNotify(prov_led_task_handle, PROV_LED_STOP, eSetValueWithOverwrite);
 }
 
 void wifi_prov_started(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
-    led_set_effect(LED_CYCLIC);
-    led_set_color(255, 127, 0);
-    led_set_brightness(255);
+    led_show(LED_CYCLIC, 255, 127, 0, 255);
 }
 
 void provisioning_event_handler2(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
@@ -280,9 +705,7 @@ void provisioning_event_handler2(void* arg, esp_event_base_t event_base, int32_t
             esp_wifi_get_config(WIFI_IF_STA, &wifi_cfg);
 
             if (strlen((const char*)wifi_cfg.sta.ssid) != 0) {
-                led_set_effect(LED_CYCLIC);
-                led_set_color(0, 0, 255);
-                led_set_brightness(255);
+                led_show(LED_CYCLIC, 0, 0, 255, 255);
                 break;
             }
             break;
@@ -299,7 +722,15 @@ void provisioning_event_handler2(void* arg, esp_event_base_t event_base, int32_t
 
 void led_init(void)
 {
-    xTaskCreate(led_task, "led_task", 4096, NULL, 5, NULL);
+#ifdef CONFIG_LANTERN_STREAM_UNDERRUN_BLANK
+    led_stream_init(&led_stream, CONFIG_LANTERN_STREAM_DELAY_MS, LED_STREAM_BLANK);
+#else
+    led_stream_init(&led_stream, CONFIG_LANTERN_STREAM_DELAY_MS, LED_STREAM_HOLD);
+#endif
+
+    // frame timing must not be disturbed by sockets/TLS work, which is pinned to core 1
+    led_task_handle = task_create(&led_task_storage, led_task, "led_task", NULL, CONFIG_LANTERN_LED_TASK_PRIORITY, CONFIG_LANTERN_LED_TASK_CORE);
+    prov_led_task_handle = task_create(&prov_led_task_storage, prov_led_task, "prov_led_task", NULL, 5);
 
     //Display QR code once connected to endpoint device
     esp_event_handler_register(PROTOCOMM_TRANSPORT_BLE_EVENT, PROTOCOMM_TRANSPORT_BLE_CONNECTED, &wifi_prov_connected, NULL);
@@ -310,8 +741,15 @@ void led_init(void)
 
     vTaskDelay(pdMS_TO_TICKS(150));
 
-    led_set_effect(LED_SOLID);
-    led_set_color(255, 255, 255);
-    led_set_brightness(255);
+    // boot flash: snap to white, hold for a few frames, then fade out
+    led_state_t state;
+    led_state_init(&state);
+    state.effect = LED_SOLID;
+    state.color[0] = 255;
+    state.color[1] = 255;
+    state.color[2] = 255;
+    state.transition_ms = 0;
+    led_apply_state(&state);
+    vTaskDelay(pdMS_TO_TICKS(100));
     led_fade_out();
 }
\ No newline at end of file
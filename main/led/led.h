@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 
 typedef enum LEDEffect_t {
     LED_OFF = 0,
@@ -9,12 +10,75 @@ typedef enum LEDEffect_t {
     LED_BREATHE,
     LED_CYCLIC,
     LED_RAINBOW,
+    LED_COLOR_WHEEL,
+    LED_PROGRAM,
+    LED_STREAM,
 } LEDEffect_t;
 
+struct led_program_t;
+struct led_stream_t;
+
+// Everything the renderer needs for a frame, published to the LED task as one unit
+typedef struct led_state_t {
+    LEDEffect_t effect;
+    uint8_t color[3];
+    uint8_t speed;
+    uint8_t brightness;
+    uint16_t transition_ms; // crossfade into this state; 0 snaps
+    uint8_t ease;           // led_ease_t curve for the crossfade
+    const struct led_program_t* program; // played by LED_PROGRAM
+    struct led_stream_t* stream;         // played by LED_STREAM
+} led_state_t;
+
+#define LED_MAX_FPS 120
+
+typedef struct led_stream_stats_t {
+    uint32_t received;
+    uint32_t shown;
+    uint32_t late;              // arrived after their deadline, dropped
+    uint32_t overflow;          // jitter buffer full, dropped
+    uint32_t skipped;           // superseded by a newer due frame, or stale, before being shown
+    uint32_t underruns;         // times the next frame was missing when due
+    uint32_t held;              // renders spent in an underrun, repeating the last frame or dark
+    uint32_t present_err_avg_ms; // how late frames were shown vs their deadline
+    uint32_t present_err_max_ms;
+    uint32_t depth_max;
+} led_stream_stats_t;
+
+// Fills in defaults, including the default crossfade
+void led_state_init(led_state_t* state);
+// Commits every field at once; the LED task never sees a partial update
+void led_apply_state(const led_state_t* state);
+void led_get_state(led_state_t* state);
+// Effect, color and brightness in one update
+void led_show(LEDEffect_t effect, uint8_t r, uint8_t g, uint8_t b, uint8_t brightness);
+
+// Validates an animation program (see led_program.h) and starts playing it
+// at the current speed and brightness. Returns false if it was rejected.
+bool led_play_program(const uint8_t* data, size_t len);
+
+// Queues one realtime frame, pts_ms u32 (server clock, little endian) followed
+// by r g b per pixel, and switches to LED_STREAM if needed. Called straight from
+// the websocket event, or from dispatch for a frame that had to be
+// reassembled; data is only read for the duration of the call.
+bool led_play_stream_frame(const uint8_t* data, size_t len);
+void led_get_stream_stats(led_stream_stats_t* stats);
+
+// Flashes a short pulse over whatever is playing, without touching the state
+void led_pulse(uint16_t duration_ms);
+
 void led_set_effect(LEDEffect_t effect);
 void led_set_color(uint8_t r, uint8_t g, uint8_t b);
 void led_set_speed(uint8_t speed);
 void led_set_brightness(uint8_t brightness);
 void led_fade_out();
 void led_fade_in();
+
+// Latency tracing, see latency_trace.h. The state version moves on every
+// published change; done is called from the LED task once the first frame
+// rendered from that version or a later one has gone out on the wire, with
+// the esp_timer times it was rendered and transmitted. One at a time.
+typedef void (*led_trace_done_t)(int64_t render_us, int64_t wire_us);
+uint32_t led_state_version();
+void led_trace_version(uint32_t version, led_trace_done_t done);
 void led_init();
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+// Fixed-point helpers shared by the effects. Phases are Q16.16: the integer
+// part counts steps (toggles, pixels, cycles), the fraction is progress
+// through the current step.
+
+// Q16 steps per millisecond per unit of speed, scaled by 256.
+// steps_per_sec is the rate at speed 1.
+#define LED_RATE(steps_per_sec) ((uint32_t)((steps_per_sec) * 65536.0 * 256.0 / 1000.0 + 0.5))
+
+typedef struct led_phase_t {
+    uint32_t phase;     // Q16.16
+    uint8_t remainder;  // carried sub-LSB so the result is independent of frame rate
+} led_phase_t;
+
+typedef enum led_ease_t {
+    LED_EASE_LINEAR = 0,
+    LED_EASE_IN,        // quadratic
+    LED_EASE_OUT,       // quadratic
+    LED_EASE_IN_OUT,    // raised cosine
+} led_ease_t;
+
+// Advances by elapsed time; speed 0 holds the phase
+void led_phase_advance(led_phase_t* p, uint32_t dt_ms, uint8_t speed, uint32_t rate);
+
+// Raised cosine: 0 at 0, 255 at 128, back to 0 at 256
+uint8_t led_wave8(uint8_t theta);
+// Maps progress 0..255 through an easing curve, 0 -> 0 and 255 -> 255
+uint8_t led_ease8(uint8_t t, led_ease_t curve);
+
+// v * s / 255 without the divide, exact at both ends of the range
+static inline uint8_t led_scale8(uint8_t v, uint8_t s) {
+    return (v * (s + (s >> 7))) >> 8;
+}
@@ -0,0 +1,156 @@
+#include "led_output.h"
+
+#include <math.h>
+#include <string.h>
+
+// pow(v / 255, gamma) in 8.8 fixed point, computed once
+static uint16_t gamma_table[256];
+static bool gamma_table_built = false;
+
+static void build_gamma_table() {
+    if (gamma_table_built) {
+        return;
+    }
+
+    for (int i = 0; i < 256; i++) {
+        gamma_table[i] = (uint16_t)lroundf(powf(i / 255.0f, LED_OUTPUT_GAMMA) * 255.0f * 256.0f);
+    }
+    gamma_table_built = true;
+}
+
+static void rebuild_lut(led_output_t* out) {
+    // maps 0..255 onto 0..256 so full brightness is exact and zero is black
+    uint32_t scale = out->brightness + (out->brightness >> 7);
+    for (int i = 0; i < 256; i++) {
+        out->lut[i] = (uint16_t)((gamma_table[i] * scale) >> 8);
+    }
+}
+
+void led_output_init(led_output_t* out, uint8_t* residual, size_t count) {
+    build_gamma_table();
+
+    out->brightness = 255;
+    out->fade = LED_OUTPUT_FADE_NONE;
+    out->dither = false;
+    out->residual = residual;
+    out->count = count;
+    memset(residual, 0, count * 3);
+    rebuild_lut(out);
+}
+
+void led_output_set_brightness(led_output_t* out, uint8_t brightness) {
+    out->fade = LED_OUTPUT_FADE_NONE;
+    if (brightness == out->brightness) {
+        return;
+    }
+
+    out->brightness = brightness;
+    rebuild_lut(out);
+}
+
+void led_output_set_fade(led_output_t* out, uint8_t level) {
+    if (level >= out->brightness) {
+        out->fade = LED_OUTPUT_FADE_NONE;
+        return;
+    }
+
+    out->fade = (uint16_t)(((uint32_t)level << 8) / out->brightness);
+}
+
+void led_output_set_dither(led_output_t* out, bool dither) {
+    out->dither = dither;
+    memset(out->residual, 0, out->count * 3);
+}
+
+static inline uint8_t dither_channel(const uint16_t* lut, uint8_t value, uint8_t* residual) {
+    uint32_t acc = lut[value] + *residual;
+    *residual = acc & 0xFF;
+    return acc >> 8;
+}
+
+static inline uint8_t round_channel(const uint16_t* lut, uint8_t value) {
+    return (lut[value] + 0x80) >> 8;
+}
+
+static inline uint8_t dither_channel_faded(const uint16_t* lut, uint32_t fade, uint8_t value, uint8_t* residual) {
+    uint32_t acc = ((lut[value] * fade) >> 8) + *residual;
+    *residual = acc & 0xFF;
+    return acc >> 8;
+}
+
+static inline uint8_t round_channel_faded(const uint16_t* lut, uint32_t fade, uint8_t value) {
+    return (((lut[value] * fade) >> 8) + 0x80) >> 8;
+}
+
+static void write_dithered_faded(led_output_t* out, const led_pixel_t* frame, uint8_t* wire) {
+    const uint16_t* lut = out->lut;
+    uint32_t fade = out->fade;
+    uint8_t* residual = out->residual;
+
+    for (size_t i = 0; i < out->count; i++) {
+        wire[0] = dither_channel_faded(lut, fade, frame[i].g, &residual[1]);
+        wire[1] = dither_channel_faded(lut, fade, frame[i].r, &residual[0]);
+        wire[2] = dither_channel_faded(lut, fade, frame[i].b, &residual[2]);
+        wire[3] = 0;
+        wire += LED_OUTPUT_BYTES_PER_PIXEL;
+        residual += 3;
+    }
+}
+
+static void write_rounded_faded(led_output_t* out, const led_pixel_t* frame, uint8_t* wire) {
+    const uint16_t* lut = out->lut;
+    uint32_t fade = out->fade;
+
+    for (size_t i = 0; i < out->count; i++) {
+        wire[0] = round_channel_faded(lut, fade, frame[i].g);
+        wire[1] = round_channel_faded(lut, fade, frame[i].r);
+        wire[2] = round_channel_faded(lut, fade, frame[i].b);
+        wire[3] = 0;
+        wire += LED_OUTPUT_BYTES_PER_PIXEL;
+    }
+}
+
+static void write_dithered(led_output_t* out, const led_pixel_t* frame, uint8_t* wire) {
+    if (out->fade != LED_OUTPUT_FADE_NONE) {
+        write_dithered_faded(out, frame, wire);
+        return;
+    }
+
+    const uint16_t* lut = out->lut;
+    uint8_t* residual = out->residual;
+
+    for (size_t i = 0; i < out->count; i++) {
+        wire[0] = dither_channel(lut, frame[i].g, &residual[1]);
+        wire[1] = dither_channel(lut, frame[i].r, &residual[0]);
+        wire[2] = dither_channel(lut, frame[i].b, &residual[2]);
+        wire[3] = 0;
+        wire += LED_OUTPUT_BYTES_PER_PIXEL;
+        residual += 3;
+    }
+}
+
+void led_output_write_rounded(led_output_t* out, const led_pixel_t* frame, uint8_t* wire) {
+    if (out->fade != LED_OUTPUT_FADE_NONE) {
+        write_rounded_faded(out, frame, wire);
+        return;
+    }
+
+    const uint16_t* lut = out->lut;
+
+    for (size_t i = 0; i < out->count; i++) {
+        wire[0] = round_channel(lut, frame[i].g);
+        wire[1] = round_channel(lut, frame[i].r);
+        wire[2] = round_channel(lut, frame[i].b);
+        wire[3] = 0;
+        wire += LED_OUTPUT_BYTES_PER_PIXEL;
+    }
+}
+
+void led_output_write(led_output_t* out, const led_pixel_t* frame, uint8_t* wire) {
+    if (out->dither) {
+        write_dithered(out, frame, wire);
+    }
+    else {
+        led_output_write_rounded(out, frame, wire);
+    }
+}
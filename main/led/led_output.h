@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "led_render.h"
+
+// Color output stage: turns a rendered frame into wire bytes, applying gamma
+// and brightness through a lookup table and optional temporal dithering.
+// The per-pixel path is table lookups and shifts only, plus one multiply per
+// channel while a fade scales the output below the table's brightness.
+
+#define LED_OUTPUT_GAMMA 2.2f
+#define LED_OUTPUT_BYTES_PER_PIXEL 4
+#define LED_OUTPUT_FADE_NONE 256
+
+typedef struct led_output_t {
+    uint8_t brightness;
+    uint16_t fade;      // Q8 scale on top of the LUT, LED_OUTPUT_FADE_NONE when unused
+    bool dither;
+    uint16_t lut[256];  // gamma x brightness, 8.8 fixed point
+    uint8_t* residual;  // 3 bytes per pixel of dither error, carried between frames
+    size_t count;
+} led_output_t;
+
+// residual must hold count * 3 bytes and is owned by the caller
+void led_output_init(led_output_t* out, uint8_t* residual, size_t count);
+// Rebuilds the LUT for brightness, only if it changed, and clears any fade
+void led_output_set_brightness(led_output_t* out, uint8_t brightness);
+// Shows level, at most the LUT's brightness, by scaling the LUT's output.
+// For fades, which would otherwise rebuild the LUT on every frame.
+void led_output_set_fade(led_output_t* out, uint8_t level);
+void led_output_set_dither(led_output_t* out, bool dither);
+
+// Writes count pixels as GRB plus an unused fourth byte
+void led_output_write(led_output_t* out, const led_pixel_t* frame, uint8_t* wire);
+// Same without dithering, for frames that are held static and should not shimmer
+void led_output_write_rounded(led_output_t* out, const led_pixel_t* frame, uint8_t* wire);
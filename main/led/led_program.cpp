@@ -0,0 +1,147 @@
+#include "led_program.h"
+
+#include <string.h>
+
+static uint32_t next_program_id = 1;
+
+static inline uint16_t read_u16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+led_program_err_t led_program_parse(const uint8_t* data, size_t len, size_t pixel_count, led_program_t* program) {
+    if (len < LED_PROGRAM_HEADER_SIZE || len > LED_PROGRAM_MAX_BYTES) {
+        return LED_PROGRAM_ERR_SIZE;
+    }
+    if (data[0] != 'L' || data[1] != 'P' || data[2] != LED_PROGRAM_VERSION) {
+        return LED_PROGRAM_ERR_HEADER;
+    }
+
+    memset(program, 0, sizeof(led_program_t));
+    program->track_count = data[3];
+    program->duration_ms = read_u16(&data[4]);
+    program->loops = data[6];
+    if (program->duration_ms == 0) {
+        return LED_PROGRAM_ERR_HEADER;
+    }
+    if (program->track_count == 0 || program->track_count > LED_PROGRAM_MAX_TRACKS) {
+        return LED_PROGRAM_ERR_TRACKS;
+    }
+
+    size_t offset = LED_PROGRAM_HEADER_SIZE;
+    size_t coverage = 0;
+    for (uint8_t t = 0; t < program->track_count; t++) {
+        if (offset + LED_PROGRAM_TRACK_SIZE > len) {
+            return LED_PROGRAM_ERR_SIZE;
+        }
+
+        led_program_track_t* track = &program->tracks[t];
+        const uint8_t* p = &data[offset];
+        track->first_pixel = p[0];
+        track->pixel_count = p[1];
+        int32_t pixel_offset = (int16_t)read_u16(&p[2]);
+        track->key_count = p[4];
+        offset += LED_PROGRAM_TRACK_SIZE;
+
+        if (track->pixel_count == 0 || track->first_pixel + track->pixel_count > pixel_count) {
+            return LED_PROGRAM_ERR_PIXELS;
+        }
+        coverage += track->pixel_count;
+
+        // negative offsets run the chase the other way; keep it in [0, duration)
+        pixel_offset %= program->duration_ms;
+        if (pixel_offset < 0) {
+            pixel_offset += program->duration_ms;
+        }
+        track->pixel_step_ms = pixel_offset;
+
+        if (track->key_count == 0 || track->key_count > LED_PROGRAM_MAX_KEYS) {
+            return LED_PROGRAM_ERR_KEYS;
+        }
+        if (offset + track->key_count * LED_PROGRAM_KEY_SIZE > len) {
+            return LED_PROGRAM_ERR_SIZE;
+        }
+
+        for (uint8_t k = 0; k < track->key_count; k++) {
+            led_program_key_t* key = &track->keys[k];
+            p = &data[offset];
+            key->time_ms = read_u16(&p[0]);
+            key->color[0] = p[2];
+            key->color[1] = p[3];
+            key->color[2] = p[4];
+            key->ease = p[5];
+            offset += LED_PROGRAM_KEY_SIZE;
+
+            if (key->time_ms > program->duration_ms || key->ease > LED_EASE_IN_OUT) {
+                return LED_PROGRAM_ERR_KEYS;
+            }
+            if (k > 0) {
+                led_program_key_t* prev = &track->keys[k - 1];
+                if (key->time_ms <= prev->time_ms) {
+                    return LED_PROGRAM_ERR_KEYS;
+                }
+                prev->rate = (255u << 16) / (key->time_ms - prev->time_ms);
+            }
+        }
+    }
+
+    if (offset != len) {
+        return LED_PROGRAM_ERR_SIZE;
+    }
+    if (coverage > pixel_count * LED_PROGRAM_MAX_COVERAGE) {
+        return LED_PROGRAM_ERR_COVERAGE;
+    }
+
+    program->id = next_program_id++;
+    return LED_PROGRAM_OK;
+}
+
+static void sample_track(const led_program_track_t* track, uint32_t t_ms, led_pixel_t* px) {
+    const led_program_key_t* keys = track->keys;
+
+    if (t_ms <= keys[0].time_ms) {
+        px->r = keys[0].color[0];
+        px->g = keys[0].color[1];
+        px->b = keys[0].color[2];
+        return;
+    }
+
+    uint8_t k = 0;
+    while (k + 1 < track->key_count && keys[k + 1].time_ms <= t_ms) {
+        k++;
+    }
+    if (k + 1 == track->key_count) {
+        px->r = keys[k].color[0];
+        px->g = keys[k].color[1];
+        px->b = keys[k].color[2];
+        return;
+    }
+
+    const led_program_key_t* a = &keys[k];
+    const led_program_key_t* b = &keys[k + 1];
+    uint8_t progress = led_ease8(((t_ms - a->time_ms) * a->rate) >> 16, (led_ease_t)a->ease);
+    int32_t weight = progress + (progress >> 7);
+    px->r = a->color[0] + (((b->color[0] - a->color[0]) * weight) >> 8);
+    px->g = a->color[1] + (((b->color[1] - a->color[1]) * weight) >> 8);
+    px->b = a->color[2] + (((b->color[2] - a->color[2]) * weight) >> 8);
+}
+
+void led_program_render(const led_program_t* program, uint32_t t_ms, led_pixel_t* frame, size_t count) {
+    memset(frame, 0, count * sizeof(led_pixel_t));
+
+    uint32_t duration = program->duration_ms;
+    uint32_t pass = t_ms / duration;
+    uint32_t local = t_ms - pass * duration;
+    bool holding = program->loops != 0 && pass >= program->loops;
+
+    for (uint8_t t = 0; t < program->track_count; t++) {
+        const led_program_track_t* track = &program->tracks[t];
+        uint32_t pixel_t = local;
+        for (uint16_t i = 0; i < track->pixel_count; i++) {
+            sample_track(track, holding ? duration : pixel_t, &frame[track->first_pixel + i]);
+            pixel_t += track->pixel_step_ms;
+            if (pixel_t >= duration) {
+                pixel_t -= duration;
+            }
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "led_render.h"
+
+// Compact keyframe animation programs, sent once by the server and played
+// locally. Wire format, little endian:
+//
+//   header   'L' 'P' | version u8 | track_count u8 | duration_ms u16 | loops u8 | reserved u8
+//   track    first_pixel u8 | pixel_count u8 | pixel_offset_ms i16 | key_count u8 | reserved u8
+//   key      time_ms u16 | r u8 | g u8 | b u8 | ease u8
+//
+// Each track animates a run of pixels through its keyframes; every pixel in
+// the run is shifted in time by pixel_offset_ms more than the previous one,
+// which gives chases and gradients. Time wraps at duration_ms. loops is the
+// number of passes before holding the last frame, 0 plays forever. Pixels
+// outside every track are black; later tracks overwrite earlier ones.
+//
+// Programs are validated once on load and bounded in size, track/keyframe
+// count and per-frame pixel work, so a program can never cost more than a
+// few effects' worth of render time.
+
+#define LED_PROGRAM_VERSION 1
+#define LED_PROGRAM_MAX_BYTES 1024
+#define LED_PROGRAM_MAX_TRACKS 8
+#define LED_PROGRAM_MAX_KEYS 16
+// total pixels written per frame, as a multiple of the ring size
+#define LED_PROGRAM_MAX_COVERAGE 4
+
+#define LED_PROGRAM_HEADER_SIZE 8
+#define LED_PROGRAM_TRACK_SIZE 6
+#define LED_PROGRAM_KEY_SIZE 6
+
+typedef struct led_program_key_t {
+    uint16_t time_ms;
+    uint8_t color[3];
+    uint8_t ease;
+    uint32_t rate;          // progress per ms into the next key, 255 over the segment, Q16
+} led_program_key_t;
+
+typedef struct led_program_track_t {
+    uint16_t first_pixel;
+    uint16_t pixel_count;
+    uint16_t pixel_step_ms; // per-pixel offset normalised into [0, duration)
+    uint8_t key_count;
+    led_program_key_t keys[LED_PROGRAM_MAX_KEYS];
+} led_program_track_t;
+
+typedef struct led_program_t {
+    uint32_t id;            // changes on every load, restarts playback
+    uint16_t duration_ms;
+    uint8_t loops;
+    uint8_t track_count;
+    led_program_track_t tracks[LED_PROGRAM_MAX_TRACKS];
+} led_program_t;
+
+typedef enum led_program_err_t {
+    LED_PROGRAM_OK = 0,
+    LED_PROGRAM_ERR_SIZE,
+    LED_PROGRAM_ERR_HEADER,
+    LED_PROGRAM_ERR_TRACKS,
+    LED_PROGRAM_ERR_PIXELS,
+    LED_PROGRAM_ERR_KEYS,
+    LED_PROGRAM_ERR_COVERAGE,
+} led_program_err_t;
+
+// Validates data against a ring of pixel_count pixels and decodes it into
+// program. program is left partly written on error, so it must not be one
+// that is being rendered.
+led_program_err_t led_program_parse(const uint8_t* data, size_t len, size_t pixel_count, led_program_t* program);
+
+// Renders the program at play time t_ms (already scaled by speed)
+void led_program_render(const led_program_t* program, uint32_t t_ms, led_pixel_t* frame, size_t count);
@@ -0,0 +1,264 @@
+#include "led_render.h"
+
+#include <string.h>
+
+#include "led_math.h"
+#include "led_program.h"
+#include "led_stream.h"
+
+// Rates at speed 1. Speed 10 (the default) gives 10 blink toggles or spinner
+// steps per second and a 3.4 s breathe cycle.
+#define BLINK_RATE LED_RATE(1.0)
+#define BREATHE_RATE LED_RATE(1.0 / 34)
+#define CYCLIC_RATE LED_RATE(1.0)
+// full trips around the hue wheel, 5 s per trip at speed 10
+#define HUE_RATE LED_RATE(1.0 / 50)
+// program play time in ms, real time at speed 10
+#define PROGRAM_RATE LED_RATE(100.0)
+
+// Longer gaps (e.g. coming back from idle) advance as if this much time passed
+#define MAX_FRAME_DT_MS 1000
+
+// How far a touch pulse lifts the frame toward white at its peak
+#define LED_PULSE_PEAK 160
+
+typedef struct hue_table_t {
+    led_pixel_t px[256];
+} hue_table_t;
+
+static constexpr hue_table_t build_hue_table() {
+    hue_table_t table = {};
+    for (int h = 0; h < 256; h++) {
+        // six 43-step regions; h * 6 splits into region (high byte) and
+        // position (low byte)
+        int scaled = h * 6;
+        int region = scaled >> 8;
+        uint8_t up = scaled & 0xFF;
+        uint8_t down = 255 - up;
+        led_pixel_t& px = table.px[h];
+        switch (region) {
+        case 0: px.r = 255; px.g = up; px.b = 0; break;
+        case 1: px.r = down; px.g = 255; px.b = 0; break;
+        case 2: px.r = 0; px.g = 255; px.b = up; break;
+        case 3: px.r = 0; px.g = down; px.b = 255; break;
+        case 4: px.r = up; px.g = 0; px.b = 255; break;
+        default: px.r = 255; px.g = 0; px.b = down; break;
+        }
+    }
+    return table;
+}
+
+// fully saturated color for every hue, so the per-pixel cost is one lookup
+static constexpr hue_table_t hue_table = build_hue_table();
+
+static void fill_color(led_pixel_t* frame, size_t count, uint8_t r, uint8_t g, uint8_t b) {
+    for (size_t i = 0; i < count; i++) {
+        frame[i].r = r;
+        frame[i].g = g;
+        frame[i].b = b;
+    }
+}
+
+static void render_blink(led_render_ctx_t* ctx, const led_state_t* state, uint32_t dt_ms, led_pixel_t* frame, size_t count) {
+    led_phase_advance(&ctx->phase, dt_ms, state->speed, BLINK_RATE);
+
+    if (((ctx->phase.phase >> 16) & 1) == 0) {
+        fill_color(frame, count, state->color[0], state->color[1], state->color[2]);
+    }
+    else {
+        fill_color(frame, count, 0, 0, 0);
+    }
+}
+
+static void render_breathe(led_render_ctx_t* ctx, const led_state_t* state, uint32_t dt_ms, led_pixel_t* frame, size_t count) {
+    led_phase_advance(&ctx->phase, dt_ms, state->speed, BREATHE_RATE);
+
+    uint8_t level = led_wave8(ctx->phase.phase >> 8);
+    fill_color(frame, count, led_scale8(state->color[0], level), led_scale8(state->color[1], level), led_scale8(state->color[2], level));
+}
+
+//LEDs are arranged in a circle, loading spinner effect
+static void render_cyclic(led_render_ctx_t* ctx, const led_state_t* state, uint32_t dt_ms, led_pixel_t* frame, size_t count) {
+    static const size_t trail_size = 5;
+
+    led_phase_advance(&ctx->phase, dt_ms, state->speed, CYCLIC_RATE);
+
+    // apply whole steps since the last frame, wrapping without a modulo
+    uint32_t step = ctx->phase.phase >> 16;
+    uint32_t steps = step - ctx->cyclic_step;
+    ctx->cyclic_step = step;
+    while (steps--) {
+        if (++ctx->cyclic_offset >= count) {
+            ctx->cyclic_offset = 0;
+        }
+    }
+
+    size_t index = ctx->cyclic_offset;
+    for (size_t i = 0; i < count; i++) {
+        led_pixel_t* px = &frame[index];
+        if (++index == count) {
+            index = 0;
+        }
+
+        if (i < trail_size) {
+            px->r = state->color[0];
+            px->g = state->color[1];
+            px->b = state->color[2];
+        }
+        else {
+            px->r = 0;
+            px->g = 0;
+            px->b = 0;
+        }
+    }
+}
+
+// Hue spread once around the ring, rotating with speed
+static void render_rainbow(led_render_ctx_t* ctx, const led_state_t* state, uint32_t dt_ms, led_pixel_t* frame, size_t count) {
+    led_phase_advance(&ctx->phase, dt_ms, state->speed, HUE_RATE);
+
+    // hue in Q8.8 so the per-pixel offset stays exact for any ring size
+    uint32_t hue = ctx->phase.phase;
+    uint32_t step = 65536 / count;
+    for (size_t i = 0; i < count; i++) {
+        frame[i] = hue_table.px[(hue >> 8) & 0xFF];
+        hue += step;
+    }
+}
+
+// Whole lantern walks through the hue wheel together
+static void render_color_wheel(led_render_ctx_t* ctx, const led_state_t* state, uint32_t dt_ms, led_pixel_t* frame, size_t count) {
+    led_phase_advance(&ctx->phase, dt_ms, state->speed, HUE_RATE);
+
+    const led_pixel_t& px = hue_table.px[(ctx->phase.phase >> 8) & 0xFF];
+    fill_color(frame, count, px.r, px.g, px.b);
+}
+
+static void render_program(led_render_ctx_t* ctx, const led_state_t* state, uint32_t dt_ms, led_pixel_t* frame, size_t count) {
+    const led_program_t* program = state->program;
+    if (program == NULL) {
+        fill_color(frame, count, 0, 0, 0);
+        return;
+    }
+
+    if (ctx->program_id != program->id) {
+        ctx->program_id = program->id;
+        ctx->program_step = ctx->program_phase.phase >> 16;
+        ctx->program_ms = 0;
+    }
+
+    led_phase_advance(&ctx->program_phase, dt_ms, state->speed, PROGRAM_RATE);
+    uint16_t step = ctx->program_phase.phase >> 16;
+    ctx->program_ms += (uint16_t)(step - ctx->program_step);
+    ctx->program_step = step;
+
+    // looping forever: keep play time inside one pass so it never wraps
+    if (program->loops == 0) {
+        while (ctx->program_ms >= program->duration_ms) {
+            ctx->program_ms -= program->duration_ms;
+        }
+    }
+
+    led_program_render(program, ctx->program_ms, frame, count);
+}
+
+// Frames come from the server; speed does not apply
+static void render_stream(const led_state_t* state, uint32_t now_ms, led_pixel_t* frame, size_t count) {
+    if (state->stream == NULL) {
+        fill_color(frame, count, 0, 0, 0);
+        return;
+    }
+
+    led_stream_render(state->stream, now_ms, frame, count);
+}
+
+void led_render_init(led_render_ctx_t* ctx) {
+    memset(ctx, 0, sizeof(led_render_ctx_t));
+}
+
+void led_render_default_state(led_state_t* state, uint16_t transition_ms) {
+    state->effect = LED_OFF;
+    state->color[0] = 0;
+    state->color[1] = 0;
+    state->color[2] = 0;
+    state->speed = 10;
+    state->brightness = 255;
+    state->transition_ms = transition_ms;
+    state->ease = LED_EASE_IN_OUT;
+    state->program = NULL;
+    state->stream = NULL;
+}
+
+bool led_render_is_animated(const led_state_t* state) {
+    if (state->effect == LED_STREAM) {
+        // a stream that ran dry holds its last frame until the next one arrives
+        return state->stream != NULL && !led_stream_is_idle(state->stream);
+    }
+    // every other effect is driven by a phase that speed 0 holds still
+    return state->effect != LED_OFF && state->effect != LED_SOLID && state->speed != 0;
+}
+
+void led_render_frame(led_render_ctx_t* ctx, const led_state_t* state, uint32_t now_ms, led_pixel_t* frame, size_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    uint32_t dt_ms = ctx->started ? now_ms - ctx->last_ms : 0;
+    if (dt_ms > MAX_FRAME_DT_MS) {
+        dt_ms = MAX_FRAME_DT_MS;
+    }
+    ctx->last_ms = now_ms;
+    ctx->started = true;
+
+    switch (state->effect) {
+    case LED_OFF:
+        fill_color(frame, count, 0, 0, 0);
+        break;
+    case LED_SOLID:
+        fill_color(frame, count, state->color[0], state->color[1], state->color[2]);
+        break;
+    case LED_BLINK:
+        render_blink(ctx, state, dt_ms, frame, count);
+        break;
+    case LED_BREATHE:
+        render_breathe(ctx, state, dt_ms, frame, count);
+        break;
+    case LED_CYCLIC:
+        render_cyclic(ctx, state, dt_ms, frame, count);
+        break;
+    case LED_RAINBOW:
+        render_rainbow(ctx, state, dt_ms, frame, count);
+        break;
+    case LED_COLOR_WHEEL:
+        render_color_wheel(ctx, state, dt_ms, frame, count);
+        break;
+    case LED_PROGRAM:
+        render_program(ctx, state, dt_ms, frame, count);
+        break;
+    case LED_STREAM:
+        render_stream(state, now_ms, frame, count);
+        break;
+    default:
+        fill_color(frame, count, 0, 0, 0);
+        break;
+    }
+}
+
+bool led_render_pulse(led_pixel_t* frame, size_t count, uint32_t elapsed_ms, uint16_t duration_ms) {
+    if (elapsed_ms >= duration_ms) {
+        return false;
+    }
+
+    uint32_t rise_ms = duration_ms / 5;
+    uint8_t t = elapsed_ms < rise_ms
+        ? elapsed_ms * 255 / rise_ms
+        : 255 - (elapsed_ms - rise_ms) * 255 / (duration_ms - rise_ms);
+    uint8_t amount = led_scale8(led_ease8(t, LED_EASE_IN_OUT), LED_PULSE_PEAK);
+
+    for (size_t i = 0; i < count; i++) {
+        frame[i].r += led_scale8(255 - frame[i].r, amount);
+        frame[i].g += led_scale8(255 - frame[i].g, amount);
+        frame[i].b += led_scale8(255 - frame[i].b, amount);
+    }
+    return true;
+}
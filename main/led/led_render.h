@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "led.h"
+#include "led_math.h"
+
+// Pure effect renderer. No FreeRTOS or driver dependencies so it can be
+// built and profiled on the host (see host/). Frames are full scale;
+// brightness and gamma are applied afterwards by led_output.
+
+typedef struct led_pixel_t {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+} led_pixel_t;
+
+// Effect memory carried from one frame to the next. Effects advance with
+// elapsed time scaled by speed, so they look the same at any frame rate.
+typedef struct led_render_ctx_t {
+    uint32_t last_ms;
+    bool started;
+    led_phase_t phase;
+    uint32_t cyclic_step;
+    uint32_t cyclic_offset;
+    uint32_t program_id;
+    led_phase_t program_phase;
+    uint16_t program_step;
+    uint32_t program_ms;
+} led_render_ctx_t;
+
+void led_render_init(led_render_ctx_t* ctx);
+// The state led_state_init() starts from, with the crossfade passed in since
+// its default is a Kconfig option
+void led_render_default_state(led_state_t* state, uint16_t transition_ms);
+// False for effects whose output only changes when the state does, and for
+// a stream until its next frame arrives
+bool led_render_is_animated(const led_state_t* state);
+void led_render_frame(led_render_ctx_t* ctx, const led_state_t* state, uint32_t now_ms, led_pixel_t* frame, size_t count);
+
+// Touch feedback overlay: lifts the frame toward white, rising over the first
+// fifth of duration_ms and fading out over the rest. Returns false once the
+// pulse is over and the frame is left untouched.
+bool led_render_pulse(led_pixel_t* frame, size_t count, uint32_t elapsed_ms, uint16_t duration_ms);
@@ -0,0 +1,179 @@
+#include "led_stream.h"
+
+#include <string.h>
+
+// The clock offset creeps up 1 ms every this many frames unless a faster
+// frame pulls it back down
+#define LED_STREAM_DRIFT_FRAMES 64
+// Frames this far past their deadline are left over from an earlier stream, and
+// a gap this long between arrivals starts a new one with a fresh clock offset
+#define LED_STREAM_STALE_MS 1000
+
+static_assert(sizeof(led_pixel_t) == 3, "stream frames are copied as packed rgb");
+
+static inline int32_t since(uint32_t now_ms, uint32_t then_ms) {
+    return (int32_t)(now_ms - then_ms);
+}
+
+void led_stream_init(led_stream_t* stream, uint16_t delay_ms, led_stream_underrun_t underrun) {
+    stream->head.store(0, std::memory_order_relaxed);
+    stream->tail.store(0, std::memory_order_relaxed);
+    stream->synced = false;
+    stream->clock_offset = 0;
+    stream->drift_count = 0;
+    stream->last_arrival_ms = 0;
+    stream->delay_ms = delay_ms;
+    stream->underrun = underrun;
+    stream->rendered = false;
+    stream->shown_any = false;
+    stream->starved = false;
+    stream->render_ms = 0;
+    stream->last_present_ms = 0;
+    stream->interval_ms = 0;
+    stream->present_err_q4 = 0;
+    memset(stream->last, 0, sizeof(stream->last));
+    memset(&stream->stats, 0, sizeof(stream->stats));
+}
+
+bool led_stream_push(led_stream_t* stream, uint32_t arrival_ms, uint32_t pts_ms, const uint8_t* rgb, size_t count) {
+    if (count > LED_STREAM_MAX_PIXELS) {
+        return false;
+    }
+    stream->stats.received++;
+
+    if (since(arrival_ms, stream->last_arrival_ms) > LED_STREAM_STALE_MS) {
+        stream->synced = false;
+    }
+    stream->last_arrival_ms = arrival_ms;
+
+    int32_t sample = since(arrival_ms, pts_ms);
+    if (!stream->synced || sample - stream->clock_offset < 0) {
+        stream->clock_offset = sample;
+        stream->drift_count = 0;
+        stream->synced = true;
+    }
+    else if (++stream->drift_count >= LED_STREAM_DRIFT_FRAMES) {
+        stream->drift_count = 0;
+        stream->clock_offset++;
+    }
+
+    uint32_t present_ms = pts_ms + stream->clock_offset + stream->delay_ms;
+    if (since(arrival_ms, present_ms) > 0) {
+        stream->stats.late++;
+        return false;
+    }
+
+    uint32_t head = stream->head.load(std::memory_order_relaxed);
+    uint32_t tail = stream->tail.load(std::memory_order_acquire);
+    if (head - tail >= LED_STREAM_SLOTS) {
+        stream->stats.overflow++;
+        return false;
+    }
+
+    led_stream_slot_t* slot = &stream->slots[head % LED_STREAM_SLOTS];
+    slot->present_ms = present_ms;
+    slot->count = count;
+    memcpy(slot->px, rgb, count * sizeof(led_pixel_t));
+    stream->head.store(head + 1, std::memory_order_release);
+
+    uint32_t depth = head + 1 - tail;
+    if (depth > stream->stats.depth_max) {
+        stream->stats.depth_max = depth;
+    }
+    return true;
+}
+
+static void show_slot(led_stream_t* stream, const led_stream_slot_t* slot, uint32_t now_ms) {
+    memcpy(stream->last, slot->px, slot->count * sizeof(led_pixel_t));
+    memset(stream->last + slot->count, 0, (LED_STREAM_MAX_PIXELS - slot->count) * sizeof(led_pixel_t));
+
+    if (stream->shown_any) {
+        uint32_t spacing = slot->present_ms - stream->last_present_ms;
+        stream->interval_ms = stream->interval_ms ? (stream->interval_ms * 3 + spacing) >> 2 : spacing;
+    }
+    stream->last_present_ms = slot->present_ms;
+    stream->shown_any = true;
+    stream->starved = false;
+
+    int32_t err = since(now_ms, slot->present_ms);
+    if ((uint32_t)err > stream->stats.present_err_max_ms) {
+        stream->stats.present_err_max_ms = err;
+    }
+    // exponential moving average, 1/16 weight
+    stream->present_err_q4 += ((err << 4) - stream->present_err_q4) >> 4;
+    stream->stats.present_err_avg_ms = stream->present_err_q4 >> 4;
+    stream->stats.shown++;
+}
+
+static void render_next(led_stream_t* stream, uint32_t now_ms) {
+    uint32_t tail = stream->tail.load(std::memory_order_relaxed);
+    uint32_t head = stream->head.load(std::memory_order_acquire);
+
+    // newest due frame wins; the ones it supersedes are never shown
+    const led_stream_slot_t* due = NULL;
+    while (tail != head) {
+        const led_stream_slot_t* slot = &stream->slots[tail % LED_STREAM_SLOTS];
+        int32_t late = since(now_ms, slot->present_ms);
+        if (late < 0) {
+            break;
+        }
+        if (due) {
+            stream->stats.skipped++;
+        }
+        due = slot;
+        tail++;
+
+        if (late > LED_STREAM_STALE_MS) {
+            stream->stats.skipped++;
+            due = NULL;
+        }
+    }
+
+    if (due) {
+        // copy out before handing the slot back to the producer
+        show_slot(stream, due, now_ms);
+        stream->tail.store(tail, std::memory_order_release);
+        return;
+    }
+    stream->tail.store(tail, std::memory_order_release);
+
+    // half a frame of slack past the next expected deadline before calling it
+    // an underrun; a stream that stopped after one frame has no spacing yet
+    if (!stream->shown_any || tail != head) {
+        return;
+    }
+    int32_t deadline = stream->interval_ms ? stream->interval_ms + (stream->interval_ms >> 1) : LED_STREAM_STALE_MS;
+    if (since(now_ms, stream->last_present_ms) <= deadline) {
+        return;
+    }
+
+    if (!stream->starved) {
+        stream->starved = true;
+        stream->stats.underruns++;
+        if (stream->underrun == LED_STREAM_BLANK) {
+            memset(stream->last, 0, sizeof(stream->last));
+        }
+    }
+    stream->stats.held++;
+}
+
+void led_stream_render(led_stream_t* stream, uint32_t now_ms, led_pixel_t* frame, size_t count) {
+    if (!stream->rendered || now_ms != stream->render_ms) {
+        stream->rendered = true;
+        stream->render_ms = now_ms;
+        render_next(stream, now_ms);
+    }
+
+    if (count > LED_STREAM_MAX_PIXELS) {
+        memset(frame + LED_STREAM_MAX_PIXELS, 0, (count - LED_STREAM_MAX_PIXELS) * sizeof(led_pixel_t));
+        count = LED_STREAM_MAX_PIXELS;
+    }
+    memcpy(frame, stream->last, count * sizeof(led_pixel_t));
+}
+
+bool led_stream_is_idle(const led_stream_t* stream) {
+    if (stream->head.load(std::memory_order_acquire) != stream->tail.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    return stream->starved || !stream->shown_any;
+}
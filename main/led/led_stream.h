@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include "led_render.h"
+#include "pinout.h"
+
+// Jitter buffer for realtime pixel streams. The server stamps every frame
+// with a presentation timestamp on its own clock; frames wait here and are
+// shown on their deadline instead of when they arrive.
+//
+// The server-to-local clock offset is the smallest (arrival - pts) seen, i.e.
+// the fastest trip through the network, relaxed slowly so it follows clock
+// drift and route changes. A frame is due at pts + offset + delay_ms, so
+// delay_ms is how much network jitter is absorbed. Frames that arrive after
+// their deadline or find the buffer full are dropped; when the next frame is
+// missing at its deadline the last one is held (or the ring goes dark).
+//
+// Single producer, single consumer (LED task), lock-free. Frames come from
+// the websocket task and, when they were fragmented, the sockets task, so
+// led.cpp serialises led_stream_push().
+// No FreeRTOS dependencies, builds on the host like the renderer.
+
+#define LED_STREAM_SLOTS 8
+#define LED_STREAM_MAX_PIXELS LED_COUNT
+
+typedef enum led_stream_underrun_t {
+    LED_STREAM_HOLD = 0,    // duplicate the last frame
+    LED_STREAM_BLANK,       // go dark until frames arrive again
+} led_stream_underrun_t;
+
+typedef struct led_stream_slot_t {
+    uint32_t present_ms;
+    uint16_t count;
+    led_pixel_t px[LED_STREAM_MAX_PIXELS];
+} led_stream_slot_t;
+
+typedef struct led_stream_t {
+    led_stream_slot_t slots[LED_STREAM_SLOTS];
+    std::atomic<uint32_t> head;     // advanced by the producer
+    std::atomic<uint32_t> tail;     // advanced by the consumer
+
+    // producer side
+    bool synced;
+    int32_t clock_offset;
+    uint8_t drift_count;
+    uint32_t last_arrival_ms;
+    uint16_t delay_ms;
+
+    // consumer side
+    led_stream_underrun_t underrun;
+    bool rendered;
+    bool shown_any;
+    bool starved;
+    uint32_t render_ms;
+    uint32_t last_present_ms;
+    uint32_t interval_ms;           // average spacing of shown frames
+    int32_t present_err_q4;         // average lateness, 1/16 ms
+    led_pixel_t last[LED_STREAM_MAX_PIXELS];
+
+    led_stream_stats_t stats;
+} led_stream_t;
+
+void led_stream_init(led_stream_t* stream, uint16_t delay_ms, led_stream_underrun_t underrun);
+
+// Producer. rgb is copied straight into a buffer slot, the only copy between
+// the network and the rendered frame. Returns false if the frame was dropped.
+bool led_stream_push(led_stream_t* stream, uint32_t arrival_ms, uint32_t pts_ms, const uint8_t* rgb, size_t count);
+
+// Consumer. Renders the newest frame due at now_ms; rendering twice at the
+// same now_ms (a crossfade within the stream) returns the same frame.
+void led_stream_render(led_stream_t* stream, uint32_t now_ms, led_pixel_t* frame, size_t count);
+
+// Consumer. True when rendering cannot show anything new until the next
+// frame is pushed: nothing is queued and the stream has run past its
+// underrun deadline, or never showed a frame. The producer must wake the
+// consumer after every push.
+bool led_stream_is_idle(const led_stream_t* stream);
@@ -0,0 +1,69 @@
+#include "led_transition.h"
+
+#include <string.h>
+
+// a + (b - a) * t / 255, exact at t = 0 and t = 255
+static inline uint8_t lerp8(uint8_t a, uint8_t b, uint8_t t) {
+    int32_t weight = t + (t >> 7);
+    return a + (((b - a) * weight) >> 8);
+}
+
+void led_transition_init(led_transition_t* tr, led_pixel_t* scratch, size_t count) {
+    memset(tr, 0, sizeof(led_transition_t));
+    tr->scratch = scratch;
+    tr->count = count;
+}
+
+void led_transition_start(led_transition_t* tr, const led_state_t* from, const led_render_ctx_t* from_ctx,
+    const led_pixel_t* shown, uint8_t shown_brightness, uint32_t now_ms, uint16_t duration_ms, led_ease_t ease) {
+    if (duration_ms == 0) {
+        tr->active = false;
+        return;
+    }
+
+    if (tr->active) {
+        memcpy(tr->scratch, shown, tr->count * sizeof(led_pixel_t));
+        tr->from_brightness = shown_brightness;
+        tr->frozen = true;
+    }
+    else {
+        tr->from = *from;
+        tr->from_ctx = *from_ctx;
+        tr->from_brightness = from->brightness;
+        tr->frozen = false;
+    }
+
+    tr->active = true;
+    tr->start_ms = now_ms;
+    tr->duration_ms = duration_ms;
+    tr->rate = (255u << 16) / duration_ms;
+    tr->ease = ease;
+}
+
+uint8_t led_transition_render(led_transition_t* tr, led_render_ctx_t* ctx, const led_state_t* to, uint32_t now_ms, led_pixel_t* frame) {
+    led_render_frame(ctx, to, now_ms, frame, tr->count);
+    if (!tr->active) {
+        return to->brightness;
+    }
+
+    uint32_t elapsed = now_ms - tr->start_ms;
+    if (elapsed >= tr->duration_ms) {
+        tr->active = false;
+        return to->brightness;
+    }
+    uint32_t progress = (elapsed * tr->rate) >> 16;
+
+    if (!tr->frozen) {
+        led_render_frame(&tr->from_ctx, &tr->from, now_ms, tr->scratch, tr->count);
+    }
+
+    uint8_t t = led_ease8(progress, tr->ease);
+    const led_pixel_t* from = tr->scratch;
+    for (size_t i = 0; i < tr->count; i++) {
+        frame[i].r = lerp8(from[i].r, frame[i].r, t);
+        frame[i].g = lerp8(from[i].g, frame[i].g, t);
+        frame[i].b = lerp8(from[i].b, frame[i].b, t);
+    }
+
+    return lerp8(tr->from_brightness, to->brightness, t);
+}
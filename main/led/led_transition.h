@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "led_render.h"
+
+// Crossfade between two LED states. The outgoing effect keeps animating on a
+// copy of its render context while the incoming one takes over; pixels are
+// blended before the output stage's gamma LUT, i.e. in perceptual space, and
+// brightness is interpolated alongside. All fixed point, no allocation: the
+// caller provides one scratch frame.
+
+typedef struct led_transition_t {
+    bool active;
+    bool frozen;                // scratch holds a captured frame instead of a live effect
+    led_state_t from;
+    led_render_ctx_t from_ctx;
+    uint8_t from_brightness;
+    uint32_t start_ms;
+    uint16_t duration_ms;
+    uint32_t rate;              // progress per ms, 255 over the duration, Q16
+    led_ease_t ease;
+    led_pixel_t* scratch;
+    size_t count;
+} led_transition_t;
+
+void led_transition_init(led_transition_t* tr, led_pixel_t* scratch, size_t count);
+
+// Starts blending away from `from`. If a transition is already running, the
+// frame currently shown (`shown` at `shown_brightness`) is frozen and becomes
+// the starting point instead, so retargeting never jumps.
+void led_transition_start(led_transition_t* tr, const led_state_t* from, const led_render_ctx_t* from_ctx,
+    const led_pixel_t* shown, uint8_t shown_brightness, uint32_t now_ms, uint16_t duration_ms, led_ease_t ease);
+
+// Renders `to` into frame, blended with the outgoing state while a transition
+// runs. Returns the brightness to apply to the frame.
+uint8_t led_transition_render(led_transition_t* tr, led_render_ctx_t* ctx, const led_state_t* to, uint32_t now_ms, led_pixel_t* frame);
@@ -0,0 +1,139 @@
+#include "metrics.h"
+
+#include <string.h>
+
+std::atomic<uint32_t> metrics_counters[METRIC_COUNTERS];
+std::atomic<uint32_t> metrics_gauges[METRIC_GAUGES];
+metric_histogram_t metrics_histograms[METRIC_HISTOGRAMS];
+
+// Just enough of the protobuf wire format for telemetry.proto: varints and
+// length-delimited fields. Lengths are computed before writing, no buffering.
+#define WIRE_VARINT 0
+#define WIRE_LEN 2
+
+typedef struct pb_writer_t {
+    uint8_t* p;
+    uint8_t* end;
+    bool overflow;
+} pb_writer_t;
+
+static size_t varint_size(uint32_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static void put_varint(pb_writer_t* w, uint32_t v) {
+    if (w->end - w->p < (ptrdiff_t)varint_size(v)) {
+        w->overflow = true;
+        return;
+    }
+    while (v >= 0x80) {
+        *w->p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *w->p++ = (uint8_t)v;
+}
+
+static void put_tag(pb_writer_t* w, uint32_t field, uint32_t wire) {
+    put_varint(w, field << 3 | wire);
+}
+
+// proto3 leaves zero scalars out
+static void put_uint(pb_writer_t* w, uint32_t field, uint32_t v) {
+    if (v) {
+        put_tag(w, field, WIRE_VARINT);
+        put_varint(w, v);
+    }
+}
+
+static size_t uint_size(uint32_t field, uint32_t v) {
+    return v ? varint_size(field << 3) + varint_size(v) : 0;
+}
+
+static size_t packed_payload_size(const uint32_t* v, size_t n) {
+    size_t size = 0;
+    for (size_t i = 0; i < n; i++) {
+        size += varint_size(v[i]);
+    }
+    return size;
+}
+
+static void put_packed(pb_writer_t* w, uint32_t field, const uint32_t* v, size_t n) {
+    put_tag(w, field, WIRE_LEN);
+    put_varint(w, packed_payload_size(v, n));
+    for (size_t i = 0; i < n; i++) {
+        put_varint(w, v[i]);
+    }
+}
+
+static size_t packed_size(uint32_t field, const uint32_t* v, size_t n) {
+    size_t payload = packed_payload_size(v, n);
+    return varint_size(field << 3) + varint_size(payload) + payload;
+}
+
+static void put_bytes(pb_writer_t* w, uint32_t field, const void* data, size_t len) {
+    put_tag(w, field, WIRE_LEN);
+    put_varint(w, len);
+    if (w->end - w->p < (ptrdiff_t)len) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->p, data, len);
+    w->p += len;
+}
+
+static void load_all(const std::atomic<uint32_t>* from, uint32_t* to, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        to[i] = from[i].load(std::memory_order_relaxed);
+    }
+}
+
+// Histogram { count = 1; sum = 2; max = 3; repeated buckets = 4; }
+static void put_histogram(pb_writer_t* w, uint32_t field, const metric_histogram_t* h) {
+    uint32_t count = h->count.load(std::memory_order_relaxed);
+    uint32_t sum = h->sum.load(std::memory_order_relaxed);
+    uint32_t max = h->max.load(std::memory_order_relaxed);
+    uint32_t buckets[METRIC_HISTOGRAM_BUCKETS];
+    load_all(h->buckets, buckets, METRIC_HISTOGRAM_BUCKETS);
+
+    put_tag(w, field, WIRE_LEN);
+    put_varint(w, uint_size(1, count) + uint_size(2, sum) + uint_size(3, max) + packed_size(4, buckets, METRIC_HISTOGRAM_BUCKETS));
+    put_uint(w, 1, count);
+    put_uint(w, 2, sum);
+    put_uint(w, 3, max);
+    put_packed(w, 4, buckets, METRIC_HISTOGRAM_BUCKETS);
+}
+
+// TaskStack { name = 1; stack_free_min = 2; }
+static void put_task(pb_writer_t* w, uint32_t field, const metric_task_t* task) {
+    size_t name_len = strlen(task->name);
+    put_tag(w, field, WIRE_LEN);
+    put_varint(w, varint_size(1 << 3) + varint_size(name_len) + name_len + uint_size(2, task->stack_free_min));
+    put_bytes(w, 1, task->name, name_len);
+    put_uint(w, 2, task->stack_free_min);
+}
+
+size_t metrics_encode(uint8_t* out, size_t cap, uint32_t uptime_s, const metric_task_t* tasks, size_t task_count) {
+    pb_writer_t w = { out, out + cap, false };
+
+    uint32_t counters[METRIC_COUNTERS];
+    uint32_t gauges[METRIC_GAUGES];
+    load_all(metrics_counters, counters, METRIC_COUNTERS);
+    load_all(metrics_gauges, gauges, METRIC_GAUGES);
+
+    put_uint(&w, 1, uptime_s);
+    put_packed(&w, 2, counters, METRIC_COUNTERS);
+    put_packed(&w, 3, gauges, METRIC_GAUGES);
+    for (size_t i = 0; i < METRIC_HISTOGRAMS; i++) {
+        put_histogram(&w, 4, &metrics_histograms[i]);
+    }
+    for (size_t i = 0; i < task_count; i++) {
+        put_task(&w, 5, &tasks[i]);
+    }
+
+    return w.overflow ? 0 : w.p - out;
+}
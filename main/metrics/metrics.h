@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Runtime performance counters. Hot paths record into fixed arrays of
+// relaxed atomics, so recording never takes a lock or allocates and is safe
+// from ISRs. The record functions are forced inline, so they run from
+// wherever their caller does, IRAM included.
+// A snapshot is encoded as the Telemetry protobuf in telemetry.proto and sent
+// as EXT_FRAME_TELEMETRY, see metrics_report.h.
+//
+// Counters and histograms are totals since boot; the server takes deltas
+// between reports and detects reboots by uptime going backwards. Ids are
+// their position in the report, so only ever append to these enums.
+// No FreeRTOS dependencies, builds on the host.
+
+typedef enum metric_counter_t {
+    METRIC_WS_CONNECTS = 0,
+    METRIC_WS_DISCONNECTS,
+    METRIC_RX_MESSAGES,         // inbound messages handed to the sockets task
+    METRIC_RX_QUEUE_DROPS,      // xSocketsQueue full, message dropped
+    METRIC_WS_ATTEMPTS,         // connection attempts, each a TLS and websocket handshake
+    METRIC_WS_REJECTS,          // handshakes the server answered with an HTTP error
+    METRIC_WS_RETRY_HINTS,      // closes that carried a retry-after
+    METRIC_TLS_RESUME_OFFERS,   // TLS handshakes that offered a cached session
+    METRIC_TLS_RESUMED,         // ... and the server took it
+    METRIC_LED_FRAMES_SENT,     // frames that differed from the last one sent, plus idle refreshes
+    METRIC_LED_OVERRUNS,        // frame deadlines skipped because a frame ran long
+    METRIC_RX_SMALL_EXHAUSTED,  // every small receive buffer busy, a large one was tried
+    METRIC_RX_LARGE_EXHAUSTED,
+    METRIC_RX_DROPS,            // no receive buffer, or the message outgrew its buffer
+    METRIC_RX_OVERSIZE,         // ... of them larger than a large buffer
+    METRIC_TX_INTERACTIVE_COALESCED, // replaced by a newer message with the same key, per tx_class_t
+    METRIC_TX_CONTROL_COALESCED,
+    METRIC_TX_BULK_COALESCED,
+    METRIC_TX_INTERACTIVE_DROPS, // outbound queue full, or the send failed
+    METRIC_TX_CONTROL_DROPS,
+    METRIC_TX_BULK_DROPS,
+    METRIC_TX_SENDS,            // websocket sends
+    METRIC_TX_BATCHES,          // ... that carried more than one message
+    METRIC_SOCKETS_WAKEUPS,     // the sockets task only wakes for work; take deltas over uptime for wakeups/s
+    METRIC_SOCKETS_RX_WAKEUPS,  // ... with inbound messages to handle
+    METRIC_SOCKETS_TX_WAKEUPS,  // ... with outbound messages queued from another task
+    METRIC_TOUCH_INTERRUPTS,
+    METRIC_TOUCH_PRESSES,
+    METRIC_TOUCH_REJECTED,      // presses shorter than the minimum
+    METRIC_TOUCH_RECALIBRATIONS, // stuck readings taken as the baseline
+    METRIC_TOUCH_TAPS,
+    METRIC_TOUCH_DOUBLE_TAPS,
+    METRIC_TOUCH_LONG_PRESSES,
+    METRIC_TOUCH_PREDICTIONS,   // touches shown locally before the server answered
+    METRIC_TOUCH_HITS,          // ... that the server confirmed
+    METRIC_TOUCH_MISSES,        // ... that it answered differently
+    METRIC_TOUCH_TIMEOUTS,      // ... with no answer in time, rolled back
+    METRIC_TOUCH_CANCELLED,     // ... where the press was noise, rolled back before sending
+    METRIC_COUNTERS,
+} metric_counter_t;
+
+// Sampled when a report is built, except the _MAX ones which are raised in place
+typedef enum metric_gauge_t {
+    METRIC_RX_QUEUE_DEPTH = 0,
+    METRIC_RX_QUEUE_DEPTH_MAX,
+    METRIC_HEAP_FREE,           // internal RAM, bytes
+    METRIC_HEAP_MIN_FREE,
+    METRIC_HEAP_LARGEST_BLOCK,
+    METRIC_PSRAM_FREE,
+    METRIC_PSRAM_MIN_FREE,
+    METRIC_PSRAM_LARGEST_BLOCK,
+    METRIC_CPU0_LOAD,           // permille busy since the last report
+    METRIC_CPU1_LOAD,
+    METRIC_WS_BACKOFF_MS,       // the last reconnect delay
+    METRIC_RX_SMALL_PEAK,       // most receive buffers in use at once
+    METRIC_RX_LARGE_PEAK,
+    METRIC_PB_ARENA_PEAK,       // most of the protobuf arena one message used, bytes
+    METRIC_PB_ARENA_DEMAND_PEAK, // most one message needed, arena plus heap
+    METRIC_PB_ARENA_FALLBACKS,  // allocations that went to the heap, since boot
+    METRIC_PB_ARENA_FALLBACK_FAILURES, // ... and failed
+    METRIC_TX_INTERACTIVE_DEPTH_MAX, // most messages queued at once, per tx_class_t
+    METRIC_TX_CONTROL_DEPTH_MAX,
+    METRIC_TX_BULK_DEPTH_MAX,
+    METRIC_TOUCH_BASELINE,      // raw touch reading without a finger
+    METRIC_TOUCH_THRESHOLD,     // rise above the baseline that counts as a press
+    METRIC_GAUGES,
+} metric_gauge_t;
+
+typedef enum metric_histogram_id_t {
+    METRIC_LED_FRAME_US = 0,    // render + queue for transmit
+    METRIC_LED_WIRE_US,         // RMT transmit submitted to done
+    METRIC_RX_HANDLE_US,        // one inbound message through process_inbound
+    METRIC_TLS_FULL_MS,         // DNS, TCP connect and a full TLS handshake, in ms
+    METRIC_TLS_RESUMED_MS,      // the same with a resumed session
+    METRIC_LED_JITTER_US,       // LED frame start after its deadline
+    METRIC_TX_INTERACTIVE_US,   // outbound message queued to handed to the websocket client, per tx_class_t
+    METRIC_TX_CONTROL_US,
+    METRIC_TX_BULK_US,
+    METRIC_TOUCH_DETECT_US,     // touch threshold interrupt to press seen by the filter
+    METRIC_TOUCH_GESTURE_MS,    // first press to the gesture being sent, in ms
+    METRIC_TOUCH_CONFIRM_MS,    // predicted touch sent to the server's answer, in ms
+    METRIC_HISTOGRAMS,
+} metric_histogram_id_t;
+
+// Bucket 0 counts zeros, bucket i values in [2^(i-1), 2^i), the last one
+// everything from 2^(METRIC_HISTOGRAM_BUCKETS-2) up
+#define METRIC_HISTOGRAM_BUCKETS 16
+
+typedef struct metric_histogram_t {
+    std::atomic<uint32_t> buckets[METRIC_HISTOGRAM_BUCKETS];
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> sum;      // wraps; take deltas
+    std::atomic<uint32_t> max;
+} metric_histogram_t;
+
+#define METRICS_INLINE static inline __attribute__((always_inline))
+
+extern std::atomic<uint32_t> metrics_counters[METRIC_COUNTERS];
+extern std::atomic<uint32_t> metrics_gauges[METRIC_GAUGES];
+extern metric_histogram_t metrics_histograms[METRIC_HISTOGRAMS];
+
+METRICS_INLINE void metrics_count(metric_counter_t id, uint32_t n = 1) {
+    metrics_counters[id].fetch_add(n, std::memory_order_relaxed);
+}
+
+METRICS_INLINE void metrics_gauge_set(metric_gauge_t id, uint32_t value) {
+    metrics_gauges[id].store(value, std::memory_order_relaxed);
+}
+
+METRICS_INLINE void metrics_raise(std::atomic<uint32_t>* slot, uint32_t value) {
+    uint32_t seen = slot->load(std::memory_order_relaxed);
+    while (value > seen && !slot->compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+}
+
+METRICS_INLINE void metrics_gauge_max(metric_gauge_t id, uint32_t value) {
+    metrics_raise(&metrics_gauges[id], value);
+}
+
+METRICS_INLINE uint32_t metrics_bucket(uint32_t value) {
+    uint32_t bucket = value ? 32 - __builtin_clz(value) : 0;
+    return bucket < METRIC_HISTOGRAM_BUCKETS ? bucket : METRIC_HISTOGRAM_BUCKETS - 1;
+}
+
+METRICS_INLINE void metrics_record(metric_histogram_id_t id, uint32_t value) {
+    metric_histogram_t* h = &metrics_histograms[id];
+    h->buckets[metrics_bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    h->count.fetch_add(1, std::memory_order_relaxed);
+    h->sum.fetch_add(value, std::memory_order_relaxed);
+    metrics_raise(&h->max, value);
+}
+
+// Per-task part of a report, filled in by the platform
+typedef struct metric_task_t {
+    const char* name;
+    uint32_t stack_free_min;    // high-water mark, bytes never used
+} metric_task_t;
+
+// Encodes a Telemetry message; returns its length, or 0 if it does not fit
+size_t metrics_encode(uint8_t* out, size_t cap, uint32_t uptime_s, const metric_task_t* tasks, size_t task_count);
@@ -0,0 +1,123 @@
+#include "metrics_report.h"
+
+#include <stdlib.h>
+#include <atomic>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char* TAG = "metrics";
+
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+// The run time counters are 32 bits and, counting esp_timer microseconds,
+// wrap every 71 minutes, sooner than the longest report interval. They are
+// folded into 64-bit totals every CPU_SAMPLE_S, well inside one wrap, where
+// the unsigned difference since the last fold is exact, and again for each
+// report, which takes the load from the totals.
+#define CPU_SAMPLE_S 600
+
+static uint32_t last_total = 0;
+static uint32_t last_idle[portNUM_PROCESSORS] = { 0 };
+static uint64_t run_total = 0;
+static uint64_t run_idle[portNUM_PROCESSORS] = { 0 };
+static uint64_t reported_total = 0;
+static uint64_t reported_idle[portNUM_PROCESSORS] = { 0 };
+// held while folding; the sample timer skips a fold the report is doing
+static std::atomic<bool> cpu_sampling(false);
+static esp_timer_handle_t cpu_sample_timer = NULL;
+
+static void fold_cpu_counters() {
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        TaskStatus_t idle;
+        vTaskGetInfo(xTaskGetIdleTaskHandleForCore(core), &idle, pdFALSE, eReady);
+        run_idle[core] += (uint32_t)(idle.ulRunTimeCounter - last_idle[core]);
+        last_idle[core] = idle.ulRunTimeCounter;
+    }
+    uint32_t total = portGET_RUN_TIME_COUNTER_VALUE();
+    run_total += (uint32_t)(total - last_total);
+    last_total = total;
+}
+
+static void cpu_sample_timer_cb(void* arg) {
+    if (cpu_sampling.exchange(true, std::memory_order_acquire)) {
+        return;
+    }
+    fold_cpu_counters();
+    cpu_sampling.store(false, std::memory_order_release);
+}
+
+static void sample_cpu_load() {
+    while (cpu_sampling.exchange(true, std::memory_order_acquire)) {
+        vTaskDelay(1);
+    }
+    fold_cpu_counters();
+
+    uint64_t elapsed = run_total - reported_total;
+    reported_total = run_total;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        uint64_t idle = run_idle[core] - reported_idle[core];
+        reported_idle[core] = run_idle[core];
+        uint32_t load = elapsed && idle < elapsed ? 1000 - (uint32_t)(idle * 1000 / elapsed) : 0;
+        metrics_gauge_set((metric_gauge_t)(METRIC_CPU0_LOAD + core), load);
+    }
+    cpu_sampling.store(false, std::memory_order_release);
+}
+#endif
+
+void metrics_report_init() {
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    esp_timer_create_args_t timer_args = {
+        .callback = cpu_sample_timer_cb,
+        .name = "cpu_sample",
+    };
+    esp_timer_create(&timer_args, &cpu_sample_timer);
+    esp_timer_start_periodic(cpu_sample_timer, CPU_SAMPLE_S * 1000000ULL);
+#endif
+}
+
+static void sample_heap() {
+    metrics_gauge_set(METRIC_HEAP_FREE, heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    metrics_gauge_set(METRIC_HEAP_MIN_FREE, heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+    metrics_gauge_set(METRIC_HEAP_LARGEST_BLOCK, heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+    metrics_gauge_set(METRIC_PSRAM_FREE, heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    metrics_gauge_set(METRIC_PSRAM_MIN_FREE, heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+    metrics_gauge_set(METRIC_PSRAM_LARGEST_BLOCK, heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM));
+}
+
+size_t metrics_report(uint8_t* out, size_t cap) {
+    sample_heap();
+
+    // a little slack for tasks created between the two calls
+    UBaseType_t capacity = uxTaskGetNumberOfTasks() + 2;
+    TaskStatus_t* status = (TaskStatus_t*)heap_caps_malloc(capacity * sizeof(TaskStatus_t), MALLOC_CAP_SPIRAM);
+    metric_task_t* tasks = (metric_task_t*)heap_caps_malloc(capacity * sizeof(metric_task_t), MALLOC_CAP_SPIRAM);
+    if (status == NULL || tasks == NULL) {
+        ESP_LOGE(TAG, "failed to allocate task snapshot");
+        free(status);
+        free(tasks);
+        return 0;
+    }
+
+    UBaseType_t count = uxTaskGetSystemState(status, capacity, NULL);
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    sample_cpu_load();
+#endif
+
+    // stack depths are in bytes on ESP-IDF
+    for (UBaseType_t i = 0; i < count; i++) {
+        tasks[i].name = status[i].pcTaskName;
+        tasks[i].stack_free_min = status[i].usStackHighWaterMark;
+    }
+
+    size_t len = metrics_encode(out, cap, esp_timer_get_time() / 1000000, tasks, count);
+    if (len == 0) {
+        ESP_LOGW(TAG, "report does not fit %d bytes", (int)cap);
+    }
+
+    free(status);
+    free(tasks);
+    return len;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "metrics.h"
+
+// Builds a Telemetry report on the device: samples the heap and CPU load
+// gauges and every task's stack high-water mark, then encodes the registry.
+// CPU load is the share of time the idle tasks did not run since the
+// previous report and needs CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS.
+
+// Room for the registry with every value at its widest and a couple dozen
+// tasks; metrics_bench checks that it still fits
+#define METRICS_REPORT_MAX 3072
+
+// Starts sampling the CPU run time counters, which wrap between reports
+void metrics_report_init();
+// Returns the encoded length, or 0 on failure
+size_t metrics_report(uint8_t* out, size_t cap);
@@ -0,0 +1,76 @@
+#include "backoff.h"
+
+static uint32_t backoff_random(backoff_t* b) {
+    uint32_t x = b->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    b->rng = x;
+    return x;
+}
+
+// Uniform in [lo, hi]
+static uint32_t backoff_uniform(backoff_t* b, uint32_t lo, uint32_t hi) {
+    if (hi <= lo) {
+        return lo;
+    }
+    return lo + (uint32_t)(((uint64_t)backoff_random(b) * ((uint64_t)hi - lo + 1)) >> 32);
+}
+
+void backoff_init(backoff_t* b, uint32_t base_ms, uint32_t cap_ms, uint32_t seed) {
+    b->base_ms = base_ms;
+    b->cap_ms = cap_ms > base_ms ? cap_ms : base_ms;
+    b->rng = seed ? seed : 0x9e3779b9;
+    backoff_reset(b);
+}
+
+void backoff_reset(backoff_t* b) {
+    b->delay_ms = 0;
+    b->failures = 0;
+}
+
+uint32_t backoff_first(backoff_t* b) {
+    if (b->failures == 0) {
+        return backoff_uniform(b, 0, b->base_ms);
+    }
+    return backoff_next(b, 0);
+}
+
+uint32_t backoff_next(backoff_t* b, uint32_t hint_ms) {
+    uint64_t hi = (uint64_t)(b->delay_ms ? b->delay_ms : b->base_ms) * 3;
+    uint32_t delay = backoff_uniform(b, b->base_ms, hi < b->cap_ms ? (uint32_t)hi : b->cap_ms);
+
+    if (hint_ms) {
+        if (hint_ms > BACKOFF_HINT_MAX_MS) {
+            hint_ms = BACKOFF_HINT_MAX_MS;
+        }
+        uint32_t hinted = backoff_uniform(b, hint_ms, hint_ms + hint_ms / 2);
+        if (hinted > delay) {
+            delay = hinted;
+        }
+    }
+
+    b->delay_ms = delay;
+    b->failures++;
+    return delay;
+}
+
+uint32_t backoff_parse_close(const uint8_t* payload, size_t len) {
+    if (len < 2) {
+        return 0;
+    }
+    uint16_t code = (payload[0] << 8) | payload[1];
+    if (code != BACKOFF_CLOSE_SERVICE_RESTART && code != BACKOFF_CLOSE_TRY_AGAIN_LATER) {
+        return 0;
+    }
+
+    uint32_t seconds = 0;
+    size_t i = 2;
+    for (; i < len && payload[i] >= '0' && payload[i] <= '9'; i++) {
+        seconds = seconds * 10 + (payload[i] - '0');
+        if (seconds > BACKOFF_HINT_MAX_MS / 1000) {
+            return BACKOFF_HINT_MAX_MS;
+        }
+    }
+    return seconds * 1000;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Reconnect delays with decorrelated jitter: each delay is drawn uniformly
+// from [base, 3 * the previous delay] and capped. Lanterns that lost the
+// server at the same moment spread out instead of coming back in lockstep,
+// and the spread widens for as long as the server stays away.
+//
+// The server can ask for a minimum delay when it closes the connection (see
+// backoff_parse_close). The next delay is then drawn from [hint, 1.5 * hint],
+// so a fleet told the same thing does not all return when the hint runs out.
+//
+// No FreeRTOS dependencies, builds on the host.
+
+// hints are trusted up to this
+#define BACKOFF_HINT_MAX_MS (60 * 60 * 1000)
+
+// RFC 6455 close codes a server sheds load with. The reason text, if it
+// starts with a number, is the retry-after in seconds.
+#define BACKOFF_CLOSE_SERVICE_RESTART 1012
+#define BACKOFF_CLOSE_TRY_AGAIN_LATER 1013
+
+typedef struct backoff_t {
+    uint32_t base_ms;
+    uint32_t cap_ms;
+    uint32_t delay_ms;      // the last delay, 0 until the first failure
+    uint32_t failures;      // since the last reset
+    uint32_t rng;           // xorshift32 state
+} backoff_t;
+
+void backoff_init(backoff_t* b, uint32_t base_ms, uint32_t cap_ms, uint32_t seed);
+// The connection held up; the next failure starts over from base
+void backoff_reset(backoff_t* b);
+// Delay before the first attempt once the network is up: anywhere in
+// [0, base] if nothing has failed yet, else as backoff_next()
+uint32_t backoff_first(backoff_t* b);
+// Delay before retrying a failed or lost connection; hint_ms is the server's
+// retry-after, 0 for none
+uint32_t backoff_next(backoff_t* b, uint32_t hint_ms);
+
+// Retry-after in ms from a close frame payload (code u16 big endian | reason),
+// 0 if it carries none
+uint32_t backoff_parse_close(const uint8_t* payload, size_t len);
@@ -0,0 +1,377 @@
+#include "coredump_upload.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_app_desc.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "mbedtls/sha256.h"
+#if CONFIG_ESP_COREDUMP_ENABLE_TO_FLASH
+#include "esp_core_dump.h"
+#endif
+
+#include "sockets.h"
+#include "lz_compress.h"
+#include "static_alloc.h"
+
+static const char* TAG = "coredump";
+
+#define COREDUMP_NVS_NAMESPACE "coredump"
+#define COREDUMP_CHUNK_HEADER 13
+#define COREDUMP_HASH_STEP 256
+// a server that keeps rejecting the digest is not going to change its mind
+#define COREDUMP_MAX_REJECTS 2
+
+#define COREDUMP_NOTIFY_ACK (1 << 0)
+#define COREDUMP_NOTIFY_RECONNECT (1 << 1)
+
+typedef struct coredump_upload_t {
+    const esp_partition_t* partition;
+    uint32_t id;
+    uint32_t size;
+    uint32_t wire_bytes;    // chunk data sent, for the compression ratio
+    uint32_t lz_next;       // image offset the encoder window continues at
+    lz_encoder_t lz;
+    uint8_t raw[COREDUMP_CHUNK_SIZE];
+} coredump_upload_t;
+
+static TaskHandle_t coredump_task = NULL;
+static task_storage_t<CONFIG_LANTERN_COREDUMP_TASK_STACK> coredump_task_storage;
+#ifdef CONFIG_LANTERN_STATIC_ALLOC
+static EXT_RAM_BSS_ATTR coredump_upload_t coredump_state;
+#endif
+
+// latest ack, written by the sockets task before it notifies the upload task
+static volatile uint32_t coredump_ack_id;
+static volatile uint32_t coredump_ack_offset;
+static volatile uint8_t coredump_ack_status;
+
+static inline void put_u32(uint8_t* p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static inline uint32_t get_u32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static const esp_partition_t* coredump_partition() {
+    return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, "coredump");
+}
+
+// Length of the stored image, 0 if there is none. Only the header is read.
+static uint32_t coredump_image_size(const esp_partition_t* partition) {
+#if CONFIG_ESP_COREDUMP_ENABLE_TO_FLASH
+    size_t address;
+    size_t size;
+    if (esp_core_dump_image_get(&address, &size) != ESP_OK) {
+        return 0;
+    }
+    return size <= partition->size ? size : 0;
+#else
+    // This build does not write core dumps, but an earlier firmware may have
+    // left one behind. The image header starts with its total length.
+    uint32_t size;
+    if (esp_partition_read(partition, 0, &size, sizeof(size)) != ESP_OK) {
+        return 0;
+    }
+    if (size == 0xFFFFFFFF || size == 0 || size > partition->size) {
+        return 0;
+    }
+    return size;
+#endif
+}
+
+// Identifies the image: its length and a CRC of its first chunk
+static bool coredump_image_id(const esp_partition_t* partition, uint32_t size, uint32_t* id) {
+    uint8_t buffer[COREDUMP_HASH_STEP];
+    uint32_t crc = size;
+    for (uint32_t offset = 0; offset < size && offset < COREDUMP_CHUNK_SIZE; offset += sizeof(buffer)) {
+        size_t n = size - offset < sizeof(buffer) ? size - offset : sizeof(buffer);
+        if (esp_partition_read(partition, offset, buffer, n) != ESP_OK) {
+            return false;
+        }
+        crc = esp_rom_crc32_le(crc, buffer, n);
+    }
+    *id = crc;
+    return true;
+}
+
+static bool coredump_image_digest(const esp_partition_t* partition, uint32_t size, uint8_t digest[32]) {
+    uint8_t buffer[COREDUMP_HASH_STEP];
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+
+    bool ok = true;
+    for (uint32_t offset = 0; offset < size && ok; offset += sizeof(buffer)) {
+        size_t n = size - offset < sizeof(buffer) ? size - offset : sizeof(buffer);
+        ok = esp_partition_read(partition, offset, buffer, n) == ESP_OK;
+        if (ok) {
+            mbedtls_sha256_update(&sha, buffer, n);
+        }
+    }
+
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    return ok;
+}
+
+// Offset the server last acknowledged for this image, 0 for a new image
+static uint32_t coredump_resume_offset(uint32_t id) {
+    nvs_handle_t nvs;
+    if (nvs_open(COREDUMP_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return 0;
+    }
+
+    uint32_t stored_id = 0;
+    uint32_t offset = 0;
+    if (nvs_get_u32(nvs, "id", &stored_id) != ESP_OK || stored_id != id || nvs_get_u32(nvs, "offset", &offset) != ESP_OK) {
+        offset = 0;
+    }
+    nvs_close(nvs);
+    return offset;
+}
+
+static void coredump_save_offset(uint32_t id, uint32_t offset) {
+    nvs_handle_t nvs;
+    if (nvs_open(COREDUMP_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    nvs_set_u32(nvs, "id", id);
+    nvs_set_u32(nvs, "offset", offset);
+    nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+static void coredump_clear_offset() {
+    nvs_handle_t nvs;
+    if (nvs_open(COREDUMP_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    nvs_erase_all(nvs);
+    nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+// Compresses one chunk into its frame, continuing the encoder window when the
+// chunk follows the previous one
+static bool send_chunk(coredump_upload_t* up, uint32_t offset, size_t* sent) {
+    size_t n = up->size - offset < COREDUMP_CHUNK_SIZE ? up->size - offset : COREDUMP_CHUNK_SIZE;
+    if (esp_partition_read(up->partition, offset, up->raw, n) != ESP_OK) {
+        ESP_LOGE(TAG, "failed to read core dump at %u", (unsigned)offset);
+        return false;
+    }
+
+    uint8_t* frame = ext_frame_alloc(EXT_FRAME_COREDUMP_CHUNK, COREDUMP_CHUNK_HEADER + LZ_COMPRESS_BOUND(n));
+    if (frame == NULL) {
+        return false;
+    }
+
+    uint8_t flags = COREDUMP_CHUNK_LZ;
+    if (offset != up->lz_next) {
+        lz_encoder_reset(&up->lz);
+        flags |= COREDUMP_CHUNK_LZ_RESET;
+    }
+
+    uint8_t* p = frame + EXT_FRAME_HEADER_SIZE;
+    size_t len = lz_compress(&up->lz, up->raw, n, true, p + COREDUMP_CHUNK_HEADER);
+    up->lz_next = offset + n;
+    if (len >= n) {
+        memcpy(p + COREDUMP_CHUNK_HEADER, up->raw, n);
+        len = n;
+        flags &= ~COREDUMP_CHUNK_LZ;
+    }
+
+    put_u32(p, up->id);
+    put_u32(p + 4, offset);
+    put_u32(p + 8, up->size);
+    p[12] = flags;
+
+    *sent = n;
+    up->wire_bytes += len;
+    return send_ext_frame_buffer(frame, EXT_FRAME_HEADER_SIZE + COREDUMP_CHUNK_HEADER + len, TX_BULK);
+}
+
+static bool send_done(uint32_t id, uint32_t size, const uint8_t digest[32]) {
+    const esp_app_desc_t* app_desc = esp_app_get_description();
+    size_t project_len = strlen(app_desc->project_name) + 1;
+    size_t version_len = strlen(app_desc->version) + 1;
+    size_t variant_len = strlen(FIRMWARE_VARIANT) + 1;
+    size_t len = 8 + 32 + project_len + version_len + variant_len;
+
+    uint8_t* frame = ext_frame_alloc(EXT_FRAME_COREDUMP_DONE, len);
+    if (frame == NULL) {
+        return false;
+    }
+
+    uint8_t* p = frame + EXT_FRAME_HEADER_SIZE;
+    put_u32(p, id);
+    put_u32(p + 4, size);
+    memcpy(p + 8, digest, 32);
+    p += 40;
+    memcpy(p, app_desc->project_name, project_len);
+    p += project_len;
+    memcpy(p, app_desc->version, version_len);
+    p += version_len;
+    memcpy(p, FIRMWARE_VARIANT, variant_len);
+
+    return send_ext_frame_buffer(frame, EXT_FRAME_HEADER_SIZE + len, TX_BULK);
+}
+
+// Sends the image until the server stores it, rejects it too often or stops
+// answering
+static void coredump_upload(coredump_upload_t* up) {
+    uint8_t digest[32];
+    if (!coredump_image_id(up->partition, up->size, &up->id) || !coredump_image_digest(up->partition, up->size, digest)) {
+        ESP_LOGE(TAG, "failed to read core dump");
+        return;
+    }
+
+    uint32_t acked = coredump_resume_offset(up->id);
+    uint32_t sent = acked;
+    bool done_sent = false;
+    int rejects = 0;
+    up->lz_next = UINT32_MAX;
+    ESP_LOGI(TAG, "uploading core dump %08x, %u bytes from %u", (unsigned)up->id, (unsigned)up->size, (unsigned)acked);
+
+    while (1) {
+        while (sent < up->size && sent - acked < COREDUMP_WINDOW * COREDUMP_CHUNK_SIZE) {
+            size_t n = 0;
+            if (!send_chunk(up, sent, &n)) {
+                break;
+            }
+            sent += n;
+        }
+        if (sent >= up->size && !done_sent) {
+            done_sent = send_done(up->id, up->size, digest);
+        }
+
+        uint32_t notified = 0;
+        if (xTaskNotifyWait(0, UINT32_MAX, &notified, pdMS_TO_TICKS(COREDUMP_ACK_TIMEOUT_MS)) != pdTRUE) {
+            ESP_LOGW(TAG, "no ack, resuming from %u on the next connection", (unsigned)acked);
+            return;
+        }
+
+        if (notified & COREDUMP_NOTIFY_RECONNECT) {
+            // anything in flight was lost with the old connection
+            sent = acked;
+            done_sent = false;
+            continue;
+        }
+        if (coredump_ack_id != up->id) {
+            continue;
+        }
+
+        uint32_t offset = coredump_ack_offset < up->size ? coredump_ack_offset : up->size;
+        switch (coredump_ack_status) {
+        case COREDUMP_ACK_PROGRESS:
+            if (offset > acked) {
+                acked = offset;
+                coredump_save_offset(up->id, acked);
+            }
+            break;
+        case COREDUMP_ACK_RESUME:
+            acked = offset;
+            sent = offset;
+            done_sent = false;
+            coredump_save_offset(up->id, acked);
+            break;
+        case COREDUMP_ACK_REJECTED:
+            ESP_LOGW(TAG, "server rejected the core dump digest");
+            if (++rejects > COREDUMP_MAX_REJECTS) {
+                return;
+            }
+            acked = 0;
+            sent = 0;
+            done_sent = false;
+            coredump_save_offset(up->id, 0);
+            break;
+        case COREDUMP_ACK_STORED: {
+            ESP_LOGI(TAG, "core dump stored by server (%u bytes sent), erasing", (unsigned)up->wire_bytes);
+            size_t erase_size = up->partition->erase_size;
+            if (esp_partition_erase_range(up->partition, 0, (up->size + erase_size - 1) / erase_size * erase_size) != ESP_OK) {
+                ESP_LOGE(TAG, "failed to erase core dump partition");
+            }
+            coredump_clear_offset();
+            return;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+static void coredump_check() {
+    const esp_partition_t* partition = coredump_partition();
+    uint32_t size = partition ? coredump_image_size(partition) : 0;
+    if (size == 0) {
+        ESP_LOGI(TAG, "no core dump");
+        return;
+    }
+
+    // the encoder is too big for the task stack
+#ifdef CONFIG_LANTERN_STATIC_ALLOC
+    coredump_upload_t* up = &coredump_state;
+    memset(up, 0, sizeof(*up));
+#else
+    coredump_upload_t* up = (coredump_upload_t*)calloc(1, sizeof(coredump_upload_t));
+    if (up == NULL) {
+        ESP_LOGE(TAG, "failed to allocate upload state");
+        return;
+    }
+#endif
+    up->partition = partition;
+    up->size = size;
+    coredump_upload(up);
+#ifndef CONFIG_LANTERN_STATIC_ALLOC
+    free(up);
+#endif
+}
+
+// Stays around once started: after each attempt it waits for the next
+// connection and looks at the partition again
+static void coredump_upload_task(void* pvParameter) {
+    while (1) {
+        coredump_check();
+
+        // acks that arrive late are dropped here
+        uint32_t notified = 0;
+        while (!(notified & COREDUMP_NOTIFY_RECONNECT)) {
+            xTaskNotifyWait(0, UINT32_MAX, &notified, portMAX_DELAY);
+        }
+    }
+}
+
+void coredump_upload_start() {
+    if (coredump_task) {
+        xTaskNotify(coredump_task, COREDUMP_NOTIFY_RECONNECT, eSetBits);
+        return;
+    }
+
+    coredump_task = task_create(&coredump_task_storage, coredump_upload_task, "coredump_upload", NULL, 5);
+}
+
+void coredump_upload_ack(const uint8_t* payload, size_t len) {
+    if (len < 9) {
+        ESP_LOGW(TAG, "short ack (%d bytes)", (int)len);
+        return;
+    }
+
+    coredump_ack_id = get_u32(payload);
+    coredump_ack_offset = get_u32(payload + 4);
+    coredump_ack_status = payload[8];
+
+    TaskHandle_t task = coredump_task;
+    if (task) {
+        xTaskNotify(task, COREDUMP_NOTIFY_ACK, eSetBits);
+    }
+}
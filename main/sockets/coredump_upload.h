@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Chunked, resumable coredump upload over extension frames. Only the image
+// itself is sent (its length comes from the coredump header), read from flash
+// a chunk at a time, with a few chunks in flight. All fields little endian:
+//
+//   CHUNK  device -> server   upload_id u32 | offset u32 | total u32 | flags u8 | data
+//   DONE   device -> server   upload_id u32 | total u32 | sha256[32] | project\0 version\0 variant\0
+//   ACK    server -> device   upload_id u32 | offset u32 | status u8
+//
+// Offsets and total count image bytes. Chunk data is compressed with
+// lz_compress (COREDUMP_CHUNK_LZ), one flushed segment per chunk, so it
+// decodes to the chunk's COREDUMP_CHUNK_SIZE image bytes (fewer for the last)
+// given the chunks before it. Chunks that do not shrink go out as they are
+// but still extend the window.
+// COREDUMP_CHUNK_LZ_RESET marks where the device started a new window, at the
+// start and after every resume, and the server resets its decoder there.
+//
+// upload_id identifies the image, so it is stable across reboots. The server
+// acks contiguous bytes received (COREDUMP_ACK_PROGRESS), answers an
+// unexpected offset with the one it wants (COREDUMP_ACK_RESUME), and after
+// DONE checks the digest: COREDUMP_ACK_STORED lets the device erase the
+// partition, COREDUMP_ACK_REJECTED restarts from zero. The last acked offset
+// is kept in NVS so an interrupted upload continues where it stopped.
+
+#define COREDUMP_CHUNK_SIZE 1024
+#define COREDUMP_WINDOW 4
+#define COREDUMP_ACK_TIMEOUT_MS 15000
+
+#define COREDUMP_CHUNK_LZ (1 << 0)
+#define COREDUMP_CHUNK_LZ_RESET (1 << 1)
+
+typedef enum coredump_ack_status_t {
+    COREDUMP_ACK_PROGRESS = 0,
+    COREDUMP_ACK_STORED,
+    COREDUMP_ACK_REJECTED,
+    COREDUMP_ACK_RESUME,
+} coredump_ack_status_t;
+
+// Starts the upload task on the first connection, and has it check for a
+// coredump again on every later one
+void coredump_upload_start();
+// Called by the sockets task with an ACK payload
+void coredump_upload_ack(const uint8_t* payload, size_t len);
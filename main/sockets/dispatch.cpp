@@ -0,0 +1,130 @@
+#include "dispatch.h"
+
+#include "esp_log.h"
+#include "esp_system.h"
+
+#include "kd_common.h"
+
+#include "kd_global.pb-c.h"
+#include "kd_lantern.pb-c.h"
+
+#include "sockets.h"
+#include "led.h"
+#include "touch_feedback.h"
+#include "coredump_upload.h"
+#include "latency_trace.h"
+
+static const char* TAG = "dispatch";
+
+static void handle_global_message(Kd__KDGlobalMessage* message, pb_arena_t* arena)
+{
+    switch (message->message_case) {
+    case KD__KDGLOBAL_MESSAGE__MESSAGE_JOIN_RESPONSE: {
+        bool needs_claimed = message->join_response->needs_claimed;
+        if (needs_claimed) {
+            ESP_LOGI(TAG, "device needs to be claimed");
+            char* claim_token = (char*)pb_arena_alloc(arena, 2048);
+            if (claim_token == NULL) {
+                ESP_LOGE(TAG, "failed to allocate claim token");
+                break;
+            }
+            size_t claim_token_len = 2048;
+            kd_common_get_claim_token(claim_token, &claim_token_len);
+
+            Kd__ClaimDevice claim_device = KD__CLAIM_DEVICE__INIT;
+            claim_device.claim_token = claim_token;
+
+            Kd__KDGlobalMessage claim_message = KD__KDGLOBAL_MESSAGE__INIT;
+            claim_message.message_case = KD__KDGLOBAL_MESSAGE__MESSAGE_CLAIM_DEVICE;
+            claim_message.claim_device = &claim_device;
+
+            Kd__DeviceAPIMessage device_api_message = KD__DEVICE_APIMESSAGE__INIT;
+            device_api_message.message_case = KD__DEVICE_APIMESSAGE__MESSAGE_KD_GLOBAL_MESSAGE;
+            device_api_message.kd_global_message = &claim_message;
+
+            send_device_api_message(&device_api_message);
+        }
+        else {
+            ESP_LOGI(TAG, "device is already claimed");
+        }
+        break;
+    }
+    case KD__KDGLOBAL_MESSAGE__MESSAGE_OK_RESPONSE:
+        ESP_LOGI(TAG, "ok response");
+        break;
+    case KD__KDGLOBAL_MESSAGE__MESSAGE_ERROR_RESPONSE:
+        ESP_LOGE(TAG, "error response: %s", message->error_response->error_message);
+        break;
+    case KD__KDGLOBAL_MESSAGE__MESSAGE_RESTART:
+        esp_restart();
+    default:
+        break;
+    }
+}
+
+static void handle_lantern_message(Kd__KDLanternMessage* message)
+{
+    latency_trace_stage(TRACE_HANDLING);
+    switch (message->message_case) {
+    case KD__KDLANTERN_MESSAGE__MESSAGE_SET_COLOR: {
+        led_state_t state;
+        led_state_init(&state);
+        state.effect = (LEDEffect_t)message->set_color->effect;
+        state.color[0] = message->set_color->red;
+        state.color[1] = message->set_color->green;
+        state.color[2] = message->set_color->blue;
+        state.speed = message->set_color->effect_speed;
+        state.brightness = message->set_color->effect_brightness;
+        touch_feedback_set_color(&state);
+        latency_trace_stage(TRACE_APPLIED);
+        break;
+    }
+    case KD__KDLANTERN_MESSAGE__MESSAGE_TOUCH_EVENT_RESPONSE:
+        ESP_LOGI(TAG, "touch event response: %i", message->touch_event_response->success);
+        touch_feedback_response(message->touch_event_response->success);
+        break;
+    default:
+        break;
+    }
+}
+
+void handle_ext_frame(const uint8_t* frame, size_t len)
+{
+    const uint8_t* payload = frame + EXT_FRAME_HEADER_SIZE;
+    size_t payload_len = len - EXT_FRAME_HEADER_SIZE;
+
+    latency_trace_stage(TRACE_HANDLING);
+    switch (frame[1]) {
+    case EXT_FRAME_ANIMATION_PROGRAM:
+        led_play_program(payload, payload_len);
+        latency_trace_stage(TRACE_APPLIED);
+        break;
+    case EXT_FRAME_PIXEL_STREAM:
+        // fragmented or chunked on the way; whole ones are played from the websocket event
+        led_play_stream_frame(payload, payload_len);
+        break;
+    case EXT_FRAME_TRACE:
+        latency_trace_arm(payload, payload_len);
+        break;
+    case EXT_FRAME_COREDUMP_ACK:
+        coredump_upload_ack(payload, payload_len);
+        break;
+    default:
+        ESP_LOGW(TAG, "unknown extension frame type %d", frame[1]);
+        break;
+    }
+}
+
+void handle_message(Kd__DeviceAPIMessage* message, pb_arena_t* arena)
+{
+    switch (message->message_case) {
+    case KD__DEVICE_APIMESSAGE__MESSAGE_KD_GLOBAL_MESSAGE:
+        handle_global_message(message->kd_global_message, arena);
+        break;
+    case KD__DEVICE_APIMESSAGE__MESSAGE_KD_LANTERN_MESSAGE:
+        handle_lantern_message(message->kd_lantern_message);
+        break;
+    default:
+        break;
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "device-api.pb-c.h"
+#include "pb_arena.h"
+
+// Inbound messages from the device API, once decoded, to the subsystems that
+// act on them. Kept apart from the websocket and task plumbing in sockets.cpp
+// so host/bench/dispatch_bench can replay captured traffic through it.
+//
+// All from the sockets task. Replies built while handling come out of the
+// arena the message was decoded into; the caller resets it afterwards.
+
+void handle_message(Kd__DeviceAPIMessage* message, pb_arena_t* arena);
+// frame includes its EXT_FRAME_HEADER_SIZE header
+void handle_ext_frame(const uint8_t* frame, size_t len);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+// Binary websocket messages normally carry one packed Kd__DeviceAPIMessage.
+// Protobuf field number 0 is reserved, so no valid message starts with a 0x00
+// byte; a leading 0x00 marks a lantern extension frame instead:
+//
+//   0x00 | ext_frame_type_t | payload
+//
+// Extension frames carry lantern payloads that have no message in the shared
+// kd-protobufs schema, or that are too hot to go through protobuf at all.
+
+#define EXT_FRAME_MARKER 0x00
+#define EXT_FRAME_HEADER_SIZE 2
+
+typedef enum ext_frame_type_t {
+    EXT_FRAME_ANIMATION_PROGRAM = 1,    // server -> device, led_program.h format
+    EXT_FRAME_PIXEL_STREAM = 2,         // server -> device, pts_ms u32 | r g b per pixel, see led_play_stream_frame()
+    EXT_FRAME_STREAM_STATS = 3,         // device -> server, led_stream_stats_t as u32 fields in order, once a second while streaming
+    EXT_FRAME_BATCH = 4,                // device -> server, (length u16 | message)* of whole messages, see tx_sched.h
+    EXT_FRAME_COREDUMP_CHUNK = 5,       // device -> server, see coredump_upload.h
+    EXT_FRAME_COREDUMP_DONE = 6,        // device -> server
+    EXT_FRAME_COREDUMP_ACK = 7,         // server -> device
+    EXT_FRAME_TOUCH_GESTURE = 8,        // device -> server, touch_gesture_t u8, follows the TouchEvent message
+    EXT_FRAME_TELEMETRY = 9,            // device -> server, Telemetry protobuf from main/metrics/telemetry.proto
+    EXT_FRAME_TRACE = 10,               // server -> device, arms a latency trace for the next message, see latency_trace.h
+    EXT_FRAME_TRACE_REPORT = 11,        // device -> server
+} ext_frame_type_t;
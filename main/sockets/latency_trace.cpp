@@ -0,0 +1,117 @@
+#include "latency_trace.h"
+
+#include <string.h>
+#include <atomic>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "led.h"
+#include "sockets.h"
+
+static const char* TAG = "latency_trace";
+
+typedef struct latency_trace_t {
+    uint32_t trace_id;
+    uint32_t server_ms;
+    int64_t rx_us;
+    int64_t stage_us[TRACE_STAGES];
+} latency_trace_t;
+
+static bool trace_armed = false;
+static uint32_t trace_armed_id;
+static uint32_t trace_armed_server_ms;
+
+// the message being handled by the sockets task
+static bool trace_active = false;
+static latency_trace_t trace;
+static uint32_t trace_led_version;
+
+// handed to the LED task until its frame is out; the LED task owns it while
+// trace_led_pending is set
+static latency_trace_t trace_led;
+static std::atomic<bool> trace_led_pending(false);
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void send_report(const latency_trace_t* t) {
+    uint8_t report[TRACE_REPORT_SIZE];
+    put_u32(report, t->trace_id);
+    put_u32(report + 4, t->server_ms);
+    put_u32(report + 8, (uint32_t)(t->rx_us / 1000));
+    put_u32(report + 12, (uint32_t)(esp_timer_get_time() / 1000));
+    for (int i = 0; i < TRACE_STAGES; i++) {
+        uint32_t us = t->stage_us[i] ? (uint32_t)(t->stage_us[i] - t->rx_us) : TRACE_NOT_REACHED;
+        put_u32(report + 16 + 4 * i, us);
+    }
+    send_ext_frame(EXT_FRAME_TRACE_REPORT, report, sizeof(report), TX_CONTROL);
+}
+
+void latency_trace_arm(const uint8_t* payload, size_t len) {
+    if (len < TRACE_ARM_SIZE) {
+        ESP_LOGW(TAG, "short trace frame");
+        return;
+    }
+    memcpy(&trace_armed_id, payload, 4);
+    memcpy(&trace_armed_server_ms, payload + 4, 4);
+    trace_armed = true;
+}
+
+bool latency_trace_begin(int64_t rx_us, int64_t dequeue_us) {
+    if (!trace_armed) {
+        return false;
+    }
+    trace_armed = false;
+
+    memset(&trace, 0, sizeof(trace));
+    trace.trace_id = trace_armed_id;
+    trace.server_ms = trace_armed_server_ms;
+    trace.rx_us = rx_us;
+    trace.stage_us[TRACE_DEQUEUED] = dequeue_us;
+    trace_led_version = led_state_version();
+    trace_active = true;
+    return true;
+}
+
+void latency_trace_stage(trace_stage_t stage) {
+    if (trace_active && trace.stage_us[stage] == 0) {
+        trace.stage_us[stage] = esp_timer_get_time();
+    }
+}
+
+// From the LED task
+static void led_done(int64_t render_us, int64_t wire_us) {
+    trace_led.stage_us[TRACE_RENDERED] = render_us;
+    trace_led.stage_us[TRACE_TRANSMITTED] = wire_us;
+    send_report(&trace_led);
+    trace_led_pending.store(false, std::memory_order_release);
+}
+
+void latency_trace_end() {
+    if (!trace_active) {
+        return;
+    }
+    trace_active = false;
+
+    uint32_t version = led_state_version();
+    if (version == trace_led_version) {
+        send_report(&trace);
+        return;
+    }
+
+    // handlers that publish state themselves mark it; this catches the rest
+    if (trace.stage_us[TRACE_APPLIED] == 0) {
+        trace.stage_us[TRACE_APPLIED] = esp_timer_get_time();
+    }
+    if (trace_led_pending.load(std::memory_order_acquire)) {
+        ESP_LOGW(TAG, "trace %lu dropped, the previous one is still waiting for its frame", (unsigned long)trace.trace_id);
+        return;
+    }
+    trace_led = trace;
+    trace_led_pending.store(true, std::memory_order_relaxed);
+    led_trace_version(version, led_done);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Command-to-photon latency tracing. The server arms a trace with an
+// EXT_FRAME_TRACE frame sent right before the command it wants timed:
+//
+//   trace_id u32 | server_ms u32
+//
+// The next inbound message, protobuf or extension frame, is followed through
+// the sockets task and the LED task, and answered with EXT_FRAME_TRACE_REPORT:
+//
+//   trace_id u32 | server_ms u32 | rx_ms u32 | report_ms u32 | stage_us u32 * TRACE_STAGES
+//
+// rx_ms is the lantern's monotonic clock when the command arrived
+// (WEBSOCKET_EVENT_DATA) and report_ms when the report was built. Together
+// with server_ms and the report's arrival time they give the server the round
+// trip and the clock offset the way NTP does. stage_us are microseconds from
+// arrival to each stage, TRACE_NOT_REACHED for stages the command never got
+// to, e.g. the LED stages of a command that leaves the LEDs alone. All
+// little endian.
+//
+// One trace is followed at a time; arming another before the report is out
+// drops the earlier one, except that a trace waiting on the LED task for its
+// frame is kept and a later one that changed the LEDs is dropped instead.
+// Untraced messages cost a branch.
+
+typedef enum trace_stage_t {
+    TRACE_DEQUEUED = 0,     // taken off xSocketsQueue by the sockets task
+    TRACE_HANDLING,         // decoded, handed to its handler
+    TRACE_APPLIED,          // new LED state published
+    TRACE_RENDERED,         // first frame from the new state rendered
+    TRACE_TRANSMITTED,      // that frame out on the wire (RMT transmit done)
+    TRACE_STAGES,
+} trace_stage_t;
+
+#define TRACE_NOT_REACHED 0xFFFFFFFF
+#define TRACE_ARM_SIZE 8
+#define TRACE_REPORT_SIZE (16 + 4 * TRACE_STAGES)
+
+// All from the sockets task
+void latency_trace_arm(const uint8_t* payload, size_t len);
+// Starts following a message if a trace is armed; returns whether it did
+bool latency_trace_begin(int64_t rx_us, int64_t dequeue_us);
+void latency_trace_stage(trace_stage_t stage);
+// The message is handled; reports now, or once its frame is out if it changed the LEDs
+void latency_trace_end();
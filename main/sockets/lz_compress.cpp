@@ -0,0 +1,136 @@
+#include "lz_compress.h"
+
+#include <string.h>
+
+static inline uint16_t lz_hash(const uint8_t* p) {
+    return ((uint32_t)(p[0] << 8 | p[1]) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline void put_bits(lz_encoder_t* enc, uint32_t value, uint8_t n, uint8_t* out, size_t* written) {
+    enc->bits = (enc->bits << n) | value;
+    enc->bit_count += n;
+    while (enc->bit_count >= 8) {
+        enc->bit_count -= 8;
+        out[(*written)++] = enc->bits >> enc->bit_count;
+    }
+    enc->bits &= (1u << enc->bit_count) - 1;
+}
+
+// Needs the byte after p, i.e. p + 1 < end
+static inline void insert(lz_encoder_t* enc, uint16_t p) {
+    uint16_t h = lz_hash(enc->buffer + p);
+    enc->prev[p] = enc->head[h];
+    enc->head[h] = p + 1;
+}
+
+static inline uint16_t rebase(uint16_t v) {
+    return v > LZ_WINDOW ? v - LZ_WINDOW : 0;
+}
+
+// Drops the oldest half of the buffer. Only history goes: pos is at least
+// end - LZ_LOOKAHEAD here, well past LZ_WINDOW.
+static void shift(lz_encoder_t* enc) {
+    memmove(enc->buffer, enc->buffer + LZ_WINDOW, LZ_WINDOW);
+    enc->pos -= LZ_WINDOW;
+    enc->end -= LZ_WINDOW;
+
+    for (size_t i = 0; i < (1 << LZ_HASH_BITS); i++) {
+        enc->head[i] = rebase(enc->head[i]);
+    }
+    for (size_t i = 0; i < LZ_WINDOW; i++) {
+        enc->prev[i] = rebase(enc->prev[i + LZ_WINDOW]);
+    }
+}
+
+// Longest match for the bytes at pos within the window, nearest first
+static size_t find_match(lz_encoder_t* enc, uint16_t* distance) {
+    size_t max = enc->end - enc->pos;
+    if (max > LZ_LOOKAHEAD) {
+        max = LZ_LOOKAHEAD;
+    }
+    if (max < LZ_MIN_MATCH) {
+        return 0;
+    }
+
+    const uint8_t* target = enc->buffer + enc->pos;
+    size_t best = 0;
+    uint16_t candidate = enc->head[lz_hash(target)];
+    for (int chain = 0; candidate && chain < LZ_MAX_CHAIN; chain++, candidate = enc->prev[candidate - 1]) {
+        uint16_t c = candidate - 1;
+        if (enc->pos - c > LZ_WINDOW) {
+            break;
+        }
+
+        const uint8_t* p = enc->buffer + c;
+        if (p[best] != target[best]) {
+            continue;
+        }
+        size_t n = 0;
+        while (n < max && p[n] == target[n]) {
+            n++;
+        }
+        if (n > best) {
+            best = n;
+            *distance = enc->pos - c;
+            if (n == max) {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+static void encode(lz_encoder_t* enc, bool flush, uint8_t* out, size_t* written) {
+    size_t keep = flush ? 1 : LZ_LOOKAHEAD;
+    while ((size_t)(enc->end - enc->pos) >= keep) {
+        uint16_t distance = 0;
+        size_t n = find_match(enc, &distance);
+        if (n >= LZ_MIN_MATCH) {
+            put_bits(enc, 0, 1, out, written);
+            put_bits(enc, ((distance - 1) << LZ_LOOKAHEAD_BITS) | (n - 1), LZ_WINDOW_BITS + LZ_LOOKAHEAD_BITS, out, written);
+        }
+        else {
+            n = 1;
+            put_bits(enc, 0x100 | enc->buffer[enc->pos], 9, out, written);
+        }
+
+        for (size_t i = 0; i < n; i++, enc->pos++) {
+            if (enc->pos + 1 < enc->end) {
+                insert(enc, enc->pos);
+            }
+        }
+    }
+}
+
+void lz_encoder_reset(lz_encoder_t* enc) {
+    memset(enc, 0, sizeof(*enc));
+}
+
+size_t lz_compress(lz_encoder_t* enc, const uint8_t* in, size_t len, bool flush, uint8_t* out) {
+    size_t written = 0;
+
+    while (len > 0) {
+        if (enc->end == sizeof(enc->buffer)) {
+            shift(enc);
+        }
+        size_t n = sizeof(enc->buffer) - enc->end;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(enc->buffer + enc->end, in, n);
+        enc->end += n;
+        in += n;
+        len -= n;
+        encode(enc, false, out, &written);
+    }
+
+    if (flush) {
+        encode(enc, true, out, &written);
+        if (enc->bit_count) {
+            out[written++] = enc->bits << (8 - enc->bit_count);
+            enc->bits = 0;
+            enc->bit_count = 0;
+        }
+    }
+    return written;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Streaming LZSS compressor for diagnostic uploads, in heatshrink's bitstream
+// format so any heatshrink decoder with the same parameters reads it. Bits
+// are written MSB first: a 1 bit followed by a literal byte, or a 0 bit
+// followed by (distance - 1) in LZ_WINDOW_BITS and (length - 1) in
+// LZ_LOOKAHEAD_BITS.
+//
+// Working memory is the encoder struct, about 7 KiB, independent of the
+// input size. Matches are found through hash chains capped at LZ_MAX_CHAIN
+// candidates, so time per byte is bounded too.
+//
+// lz_compress(..., flush = true) encodes everything buffered and pads to a
+// byte boundary, keeping the window: the output for each call then decodes
+// to exactly its input, given the previous calls' output was decoded first.
+// A padding of at most 7 bits never forms a whole token, so a decoder that
+// resets its bit reader at every segment boundary ignores it.
+// No FreeRTOS dependencies, builds on the host.
+
+#define LZ_WINDOW_BITS 10
+#define LZ_LOOKAHEAD_BITS 5
+#define LZ_WINDOW (1 << LZ_WINDOW_BITS)
+#define LZ_LOOKAHEAD (1 << LZ_LOOKAHEAD_BITS)
+#define LZ_MIN_MATCH 2          // a backref is 16 bits, two literals 18
+#define LZ_MAX_CHAIN 32
+#define LZ_HASH_BITS 9
+
+// Output capacity that always suffices for len bytes of input
+#define LZ_COMPRESS_BOUND(len) ((len) + LZ_LOOKAHEAD + ((len) + LZ_LOOKAHEAD) / 8 + 2)
+
+typedef struct lz_encoder_t {
+    // history in [0, pos), pending input in [pos, end)
+    uint8_t buffer[2 * LZ_WINDOW];
+    uint16_t pos;
+    uint16_t end;
+    // positions + 1 of the latest occurrence of each hash and the one before
+    // each position, 0 for none
+    uint16_t head[1 << LZ_HASH_BITS];
+    uint16_t prev[2 * LZ_WINDOW];
+    uint32_t bits;
+    uint8_t bit_count;
+} lz_encoder_t;
+
+void lz_encoder_reset(lz_encoder_t* enc);
+// Compresses len bytes of in to out, which must hold LZ_COMPRESS_BOUND(len)
+// bytes, and returns the bytes written. Without flush, up to LZ_LOOKAHEAD
+// bytes may stay buffered for the next call.
+size_t lz_compress(lz_encoder_t* enc, const uint8_t* in, size_t len, bool flush, uint8_t* out);
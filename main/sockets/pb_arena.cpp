@@ -0,0 +1,80 @@
+#include "pb_arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// protobuf-c structs hold 64-bit fields and doubles
+#define PB_ARENA_ALIGN 8
+
+typedef union pb_arena_block_t {
+    union pb_arena_block_t* next;
+    uint8_t align[PB_ARENA_ALIGN];
+} pb_arena_block_t;
+
+static void* pb_arena_protobuf_alloc(void* allocator_data, size_t size) {
+    return pb_arena_alloc((pb_arena_t*)allocator_data, size);
+}
+
+static void pb_arena_protobuf_free(void* allocator_data, void* pointer) {
+    // released all at once by pb_arena_reset()
+}
+
+void pb_arena_init(pb_arena_t* arena, uint8_t* buffer, size_t size) {
+    memset(arena, 0, sizeof(pb_arena_t));
+    arena->allocator.alloc = pb_arena_protobuf_alloc;
+    arena->allocator.free = pb_arena_protobuf_free;
+    arena->allocator.allocator_data = arena;
+
+    // keep every allocation aligned by aligning the start
+    uintptr_t start = ((uintptr_t)buffer + PB_ARENA_ALIGN - 1) & ~(uintptr_t)(PB_ARENA_ALIGN - 1);
+    size_t skipped = start - (uintptr_t)buffer;
+    arena->base = (uint8_t*)start;
+    arena->size = size > skipped ? size - skipped : 0;
+    arena->stats.size = arena->size;
+}
+
+void* pb_arena_alloc(pb_arena_t* arena, size_t size) {
+    size = (size + PB_ARENA_ALIGN - 1) & ~(size_t)(PB_ARENA_ALIGN - 1);
+    arena->stats.allocs++;
+
+    if (size <= arena->size - arena->used) {
+        void* pointer = arena->base + arena->used;
+        arena->used += size;
+        if (arena->used > arena->stats.peak) {
+            arena->stats.peak = arena->used;
+        }
+        if (arena->used + arena->fallback_bytes > arena->stats.demand_peak) {
+            arena->stats.demand_peak = arena->used + arena->fallback_bytes;
+        }
+        return pointer;
+    }
+
+    pb_arena_block_t* block = (pb_arena_block_t*)malloc(sizeof(pb_arena_block_t) + size);
+    if (block == NULL) {
+        arena->stats.fallback_failures++;
+        return NULL;
+    }
+
+    block->next = (pb_arena_block_t*)arena->fallback;
+    arena->fallback = block;
+    arena->fallback_bytes += size;
+    arena->stats.fallbacks++;
+    if (arena->used + arena->fallback_bytes > arena->stats.demand_peak) {
+        arena->stats.demand_peak = arena->used + arena->fallback_bytes;
+    }
+    return block + 1;
+}
+
+void pb_arena_reset(pb_arena_t* arena) {
+    pb_arena_block_t* block = (pb_arena_block_t*)arena->fallback;
+    while (block) {
+        pb_arena_block_t* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena->fallback = NULL;
+    arena->fallback_bytes = 0;
+    arena->used = 0;
+    arena->stats.resets++;
+}
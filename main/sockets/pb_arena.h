@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <protobuf-c/protobuf-c.h>
+
+// Bump allocator for protobuf-c. Everything a message decode (or a reply
+// being built) allocates comes out of one fixed buffer and is given back in
+// one step by pb_arena_reset(); free() is a no-op. If the buffer runs out,
+// allocations fall back to the heap and are released on the next reset, so a
+// message that outgrows the arena still decodes, just not allocation-free.
+//
+// Not thread safe: an arena belongs to the task that resets it.
+
+typedef struct pb_arena_stats_t {
+    size_t size;
+    size_t peak;            // most of the buffer used by one message
+    size_t demand_peak;     // most bytes one message needed, arena plus heap
+    uint32_t allocs;        // allocations served, arena or heap
+    uint32_t fallbacks;     // allocations that went to the heap
+    uint32_t fallback_failures;
+    uint32_t resets;
+} pb_arena_stats_t;
+
+typedef struct pb_arena_t {
+    ProtobufCAllocator allocator;   // pass &arena->allocator to protobuf-c
+    uint8_t* base;
+    size_t size;
+    size_t used;
+    size_t fallback_bytes;
+    void* fallback;                 // heap blocks to free on reset
+    pb_arena_stats_t stats;
+} pb_arena_t;
+
+void pb_arena_init(pb_arena_t* arena, uint8_t* buffer, size_t size);
+void* pb_arena_alloc(pb_arena_t* arena, size_t size);
+void pb_arena_reset(pb_arena_t* arena);
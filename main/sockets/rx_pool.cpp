@@ -0,0 +1,126 @@
+#include "rx_pool.h"
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+#include "metrics.h"
+
+static const char* TAG = "rx_pool";
+
+static_assert(CONFIG_LANTERN_RX_SMALL_SLOTS <= 32 && CONFIG_LANTERN_RX_LARGE_SLOTS <= 32, "free slots are tracked in a 32-bit mask");
+
+static uint8_t rx_small_data[CONFIG_LANTERN_RX_SMALL_SLOTS][CONFIG_LANTERN_RX_SMALL_SIZE];
+static rx_buf_t rx_small[CONFIG_LANTERN_RX_SMALL_SLOTS];
+static rx_buf_t rx_large[CONFIG_LANTERN_RX_LARGE_SLOTS];
+#ifdef CONFIG_LANTERN_STATIC_ALLOC
+static EXT_RAM_BSS_ATTR uint8_t rx_large_data[CONFIG_LANTERN_RX_LARGE_SLOTS][CONFIG_LANTERN_RX_LARGE_SIZE];
+#endif
+
+typedef struct rx_pool_t {
+    rx_buf_t* bufs;
+    uint32_t free_mask;
+    uint8_t slots;
+} rx_pool_t;
+
+static rx_pool_t rx_pools[RX_POOL_CLASSES] = {
+    { rx_small, 0, 0 },
+    { rx_large, 0, 0 },
+};
+
+static const metric_counter_t rx_exhausted_metric[RX_POOL_CLASSES] = { METRIC_RX_SMALL_EXHAUSTED, METRIC_RX_LARGE_EXHAUSTED };
+static const metric_gauge_t rx_peak_metric[RX_POOL_CLASSES] = { METRIC_RX_SMALL_PEAK, METRIC_RX_LARGE_PEAK };
+
+static portMUX_TYPE rx_pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void rx_pool_class_init(rx_pool_class_t pool, uint8_t slots, size_t slot_size) {
+    rx_pools[pool].free_mask = slots == 32 ? UINT32_MAX : (1u << slots) - 1;
+    rx_pools[pool].slots = slots;
+
+    for (uint8_t i = 0; i < slots; i++) {
+        rx_buf_t* buf = &rx_pools[pool].bufs[i];
+        buf->capacity = slot_size;
+        buf->len = 0;
+        buf->pool = pool;
+        buf->index = i;
+    }
+}
+
+void rx_pool_init() {
+    for (uint8_t i = 0; i < CONFIG_LANTERN_RX_SMALL_SLOTS; i++) {
+        rx_small[i].data = rx_small_data[i];
+    }
+    rx_pool_class_init(RX_POOL_SMALL, CONFIG_LANTERN_RX_SMALL_SLOTS, CONFIG_LANTERN_RX_SMALL_SIZE);
+
+    uint8_t large_slots = 0;
+    for (uint8_t i = 0; i < CONFIG_LANTERN_RX_LARGE_SLOTS; i++) {
+#ifdef CONFIG_LANTERN_STATIC_ALLOC
+        rx_large[i].data = rx_large_data[i];
+#else
+        rx_large[i].data = (uint8_t*)heap_caps_malloc(CONFIG_LANTERN_RX_LARGE_SIZE, MALLOC_CAP_SPIRAM);
+#endif
+        if (rx_large[i].data == NULL) {
+            ESP_LOGE(TAG, "malloc failed: large slot %d", i);
+            break;
+        }
+        large_slots++;
+    }
+    rx_pool_class_init(RX_POOL_LARGE, large_slots, CONFIG_LANTERN_RX_LARGE_SIZE);
+}
+
+static rx_buf_t* rx_pool_take(rx_pool_class_t pool) {
+    rx_pool_t* p = &rx_pools[pool];
+
+    if (p->free_mask == 0) {
+        metrics_count(rx_exhausted_metric[pool]);
+        return NULL;
+    }
+
+    uint8_t index = __builtin_ctz(p->free_mask);
+    p->free_mask &= ~(1u << index);
+    metrics_gauge_max(rx_peak_metric[pool], p->slots - __builtin_popcount(p->free_mask));
+    return &p->bufs[index];
+}
+
+rx_buf_t* rx_pool_acquire(size_t len) {
+    rx_buf_t* buf = NULL;
+
+    taskENTER_CRITICAL(&rx_pool_lock);
+    if (len <= CONFIG_LANTERN_RX_SMALL_SIZE) {
+        buf = rx_pool_take(RX_POOL_SMALL);
+    }
+    if (buf == NULL && len <= CONFIG_LANTERN_RX_LARGE_SIZE) {
+        buf = rx_pool_take(RX_POOL_LARGE);
+    }
+    taskEXIT_CRITICAL(&rx_pool_lock);
+
+    if (buf == NULL) {
+        bool oversize = len > CONFIG_LANTERN_RX_LARGE_SIZE;
+        metrics_count(METRIC_RX_DROPS);
+        if (oversize) {
+            metrics_count(METRIC_RX_OVERSIZE);
+        }
+        ESP_LOGE(TAG, "no receive buffer for %d bytes (%s)", (int)len, oversize ? "too large" : "pool exhausted");
+        return NULL;
+    }
+
+    buf->len = 0;
+    return buf;
+}
+
+void rx_pool_release(rx_buf_t* buf) {
+    if (buf == NULL) {
+        return;
+    }
+
+    taskENTER_CRITICAL(&rx_pool_lock);
+    rx_pools[buf->pool].free_mask |= 1u << buf->index;
+    taskEXIT_CRITICAL(&rx_pool_lock);
+}
+
+void rx_pool_drop(rx_buf_t* buf) {
+    metrics_count(METRIC_RX_DROPS);
+    rx_pool_release(buf);
+}
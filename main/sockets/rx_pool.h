@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Fixed pool of receive buffers for inbound websocket messages. Small
+// messages (SetColor, responses) land in internal RAM, anything bigger in one
+// of a few PSRAM slots that are allocated once at startup. The websocket event
+// handler reassembles fragments straight into a buffer (see rx_reassembly.h)
+// and hands it to the sockets task through xSocketsQueue; whoever holds the
+// handle releases it.
+//
+// Peak use, exhaustion and drops go to the metrics registry
+// (METRIC_RX_*_PEAK, METRIC_RX_*_EXHAUSTED, METRIC_RX_DROPS).
+
+typedef enum rx_pool_class_t {
+    RX_POOL_SMALL = 0,  // internal RAM
+    RX_POOL_LARGE,      // PSRAM
+    RX_POOL_CLASSES,
+} rx_pool_class_t;
+
+typedef struct rx_buf_t {
+    uint8_t* data;
+    size_t capacity;
+    size_t len;
+    uint8_t pool;       // rx_pool_class_t
+    uint8_t index;
+} rx_buf_t;
+
+void rx_pool_init();
+// Smallest free buffer that holds len bytes, or NULL (counted as a drop)
+rx_buf_t* rx_pool_acquire(size_t len);
+void rx_pool_release(rx_buf_t* buf);
+// For a message that could not be completed after it was acquired
+void rx_pool_drop(rx_buf_t* buf);
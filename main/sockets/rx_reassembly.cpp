@@ -0,0 +1,81 @@
+#include "rx_reassembly.h"
+
+#include <string.h>
+#include "esp_log.h"
+
+#include "ext_frame.h"
+
+static const char* TAG = "rx_reassembly";
+
+void rx_reassembly_init(rx_reassembly_t* r) {
+    r->rx = NULL;
+    r->frame_base = 0;
+}
+
+// Moves the message into a buffer of at least len bytes; drops it if there is none
+static bool rx_reassembly_grow(rx_reassembly_t* r, size_t len) {
+    rx_buf_t* bigger = rx_pool_acquire(len);
+    if (bigger == NULL) {
+        // acquire counted the drop
+        rx_pool_release(r->rx);
+        r->rx = NULL;
+        return false;
+    }
+
+    memcpy(bigger->data, r->rx->data, r->rx->len);
+    bigger->len = r->rx->len;
+    rx_pool_release(r->rx);
+    r->rx = bigger;
+    return true;
+}
+
+rx_buf_t* rx_reassembly_feed(rx_reassembly_t* r, bool continuation, bool fin,
+    size_t payload_len, size_t payload_offset, const uint8_t* data, size_t len) {
+    if (payload_offset == 0) {
+        if (!continuation) {
+            if (r->rx) {
+                ESP_LOGW(TAG, "dropping incomplete message (%d bytes)", (int)r->rx->len);
+                rx_pool_drop(r->rx);
+            }
+            r->rx = rx_pool_acquire(payload_len);
+            r->frame_base = 0;
+        }
+        else if (r->rx) {
+            r->frame_base = r->rx->len;
+            if (r->frame_base + payload_len > r->rx->capacity && !rx_reassembly_grow(r, r->frame_base + payload_len)) {
+                return NULL;
+            }
+        }
+    }
+
+    rx_buf_t* rx = r->rx;
+    if (rx == NULL) {
+        return NULL;
+    }
+
+    if (r->frame_base + payload_offset + len > rx->capacity) {
+        ESP_LOGE(TAG, "message outgrew its receive buffer (%d bytes)", (int)rx->capacity);
+        rx_pool_drop(rx);
+        r->rx = NULL;
+        return NULL;
+    }
+
+    memcpy(rx->data + r->frame_base + payload_offset, data, len);
+
+    // frame complete; the message is complete with its final frame
+    if (payload_offset + len < payload_len) {
+        return NULL;
+    }
+    rx->len = r->frame_base + payload_len;
+    if (!fin) {
+        return NULL;
+    }
+
+    r->rx = NULL;
+    return rx;
+}
+
+bool rx_reassembly_is_whole_stream_frame(bool fin, size_t payload_len, size_t payload_offset, const uint8_t* data, size_t len) {
+    return fin && payload_offset == 0 && len == payload_len && len > EXT_FRAME_HEADER_SIZE
+        && data[0] == EXT_FRAME_MARKER && data[1] == EXT_FRAME_PIXEL_STREAM;
+}
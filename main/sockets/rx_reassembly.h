@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rx_pool.h"
+
+// Reassembles inbound websocket messages into rx_pool buffers. A message is
+// one or more frames, every one after the first a continuation, and each
+// frame arrives in one or more chunks at increasing payload offsets. Only the
+// first frame's length is known when the buffer is picked, so a continuation
+// that does not fit moves the message into a buffer that holds it, e.g. from
+// a small slot to a large one.
+//
+// Used from the websocket event handler only. No FreeRTOS dependencies,
+// builds on the host against a stand-in pool.
+
+typedef struct rx_reassembly_t {
+    rx_buf_t* rx;           // message being reassembled, or NULL
+    size_t frame_base;      // where the current frame starts in rx
+} rx_reassembly_t;
+
+void rx_reassembly_init(rx_reassembly_t* r);
+
+// Feeds one chunk of a data frame. Returns the message once the chunk ends
+// its final (fin) frame; the caller then owns the buffer. NULL while more is
+// to come, or when the message was dropped: no buffer, too large, or a new
+// message started before it was complete.
+rx_buf_t* rx_reassembly_feed(rx_reassembly_t* r, bool continuation, bool fin,
+    size_t payload_len, size_t payload_offset, const uint8_t* data, size_t len);
+
+// Whether a chunk of a binary frame is a whole EXT_FRAME_PIXEL_STREAM
+// message: one final frame, delivered in one chunk. Those are played straight
+// from the transport buffer; a stream frame that was fragmented or chunked is
+// reassembled like any other message.
+bool rx_reassembly_is_whole_stream_frame(bool fin, size_t payload_len, size_t payload_offset, const uint8_t* data, size_t len);
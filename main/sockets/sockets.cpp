@@ -7,18 +7,30 @@
 #include "esp_http_client.h"
 #include "esp_wifi.h"
 #include "esp_app_desc.h"
+#include "esp_random.h"
 
 #include "kd_common.h"
 
 #include "cJSON.h"
-#include <esp_partition.h>
 
 #include "device-api.pb-c.h"
 #include "kd_global.pb-c.h"
 #include "kd_lantern.pb-c.h"
 
-#include <mbedtls/base64.h>
 #include "led.h"
+#include "esp_timer.h"
+#include "rx_pool.h"
+#include "rx_reassembly.h"
+#include "pb_arena.h"
+#include "tx_sched.h"
+#include "coredump_upload.h"
+#include "metrics.h"
+#include "metrics_report.h"
+#include "latency_trace.h"
+#include "dispatch.h"
+#include "backoff.h"
+#include "tls_session.h"
+#include "static_alloc.h"
 
 static const char* TAG = "sockets";
 TaskHandle_t xSocketsTask = NULL;
@@ -26,16 +38,73 @@ TaskHandle_t xSocketsTask = NULL;
 QueueHandle_t xSocketsQueue = NULL;
 esp_websocket_client_handle_t client = NULL;
 
+// The sockets task sleeps until one of these is set; it never polls
+#define SOCKETS_NOTIFY_RX (1 << 0)          // inbound message queued on xSocketsQueue
+#define SOCKETS_NOTIFY_TX (1 << 1)          // outbound message queued on tx_sched
+#define SOCKETS_NOTIFY_CONNECT (1 << 2)
+#define SOCKETS_NOTIFY_DISCONNECT (1 << 3)
+#define SOCKETS_NOTIFY_STREAM_STATS (1 << 4)
+#define SOCKETS_NOTIFY_SHUTDOWN (1 << 5)
+#define SOCKETS_NOTIFY_TELEMETRY (1 << 6)
+#define SOCKETS_NOTIFY_LOST (1 << 7)        // the websocket closed or failed to connect
+#define SOCKETS_NOTIFY_RECONNECT (1 << 8)   // reconnect_timer ran out
+
+// Runs only while the lantern is streaming
+static esp_timer_handle_t stream_stats_timer = NULL;
+// Runs only while connected
+static esp_timer_handle_t telemetry_timer = NULL;
+
+// The websocket client's own reconnect is off; the sockets task reconnects
+// after a backoff delay instead, see backoff.h
+static backoff_t reconnect_backoff;
+static esp_timer_handle_t reconnect_timer = NULL;
+static bool ws_wanted = false;      // the network is up
+static bool ws_running = false;     // the client is connecting or connected
+// from the websocket task
+static volatile int64_t ws_connected_us = 0;
+static volatile uint32_t ws_retry_hint_ms = 0;
+
+static void sockets_notify(uint32_t bits)
+{
+    // the task drains the outbox before it sleeps again, no need to wake itself
+    if (xSocketsTask && xTaskGetCurrentTaskHandle() != xSocketsTask) {
+        xTaskNotify(xSocketsTask, bits, eSetBits);
+    }
+}
+
+static void stream_stats_start()
+{
+    if (!esp_timer_is_active(stream_stats_timer)) {
+        esp_timer_start_periodic(stream_stats_timer, 1000000);
+    }
+}
+
+// Decoded inbound messages, and replies built while handling them, live here
+// until the message is done. Only the sockets task touches it.
+static uint8_t pb_arena_buffer[CONFIG_LANTERN_PB_ARENA_SIZE];
+static pb_arena_t pb_arena;
+
+// Inbound only; outbound messages go through tx_sched
 typedef struct ProcessableMessage_t {
-    char* message;
+    rx_buf_t* rx;       // pool buffer, released once handled
     size_t message_len;
-    bool is_outbox;
+    int64_t rx_us;      // first chunk seen, for latency traces
 } ProcessableMessage_t;
 
+#define SOCKETS_QUEUE_LENGTH 10
+#define SOCKETS_CERT_SIZE 4096
+
+static task_storage_t<CONFIG_LANTERN_SOCKETS_TASK_STACK> sockets_task_storage;
+static queue_storage_t<ProcessableMessage_t, SOCKETS_QUEUE_LENGTH> sockets_queue_storage;
+#ifdef CONFIG_LANTERN_STATIC_ALLOC
+static EXT_RAM_BSS_ATTR char sockets_cert[SOCKETS_CERT_SIZE];
+#endif
+
 static void websocket_event_handler(void* handler_args, esp_event_base_t base, int32_t event_id, void* event_data)
 {
     esp_websocket_event_data_t* data = (esp_websocket_event_data_t*)event_data;
-    static char* dbuf = NULL;
+    static rx_reassembly_t rx_reassembly = { NULL, 0 };
+    static int64_t rx_us = 0;
 
     switch (event_id) {
     case WEBSOCKET_EVENT_CONNECTED: {
@@ -60,38 +129,68 @@ static void websocket_event_handler(void* handler_args, esp_event_base_t base, i
 
         send_device_api_message(&device_api_message);
 
-        xTaskCreate(upload_coredump_task, "upload_coredump_task", 8192, NULL, 5, NULL);
+        ws_connected_us = esp_timer_get_time();
+        coredump_upload_start();
+        metrics_count(METRIC_WS_CONNECTS);
+#if CONFIG_LANTERN_TELEMETRY_INTERVAL_S > 0
+        esp_timer_stop(telemetry_timer);
+        esp_timer_start_periodic(telemetry_timer, CONFIG_LANTERN_TELEMETRY_INTERVAL_S * 1000000ULL);
+#endif
         break;
     }
     case WEBSOCKET_EVENT_DISCONNECTED:
-        ESP_LOGW(TAG, "disconnected");
+    case WEBSOCKET_EVENT_CLOSED:
+        esp_timer_stop(telemetry_timer);
+        sockets_notify(SOCKETS_NOTIFY_LOST);
+        break;
+    case WEBSOCKET_EVENT_ERROR:
+        if (data->error_handle.esp_ws_handshake_status_code >= 400) {
+            ESP_LOGW(TAG, "handshake rejected: %d", data->error_handle.esp_ws_handshake_status_code);
+            metrics_count(METRIC_WS_REJECTS);
+        }
         break;
     case WEBSOCKET_EVENT_DATA:
-        if (data->payload_offset == 0) {
-            free(dbuf);
-            dbuf = (char*)heap_caps_calloc(data->payload_len + 1, sizeof(char), MALLOC_CAP_SPIRAM);
-            if (dbuf == NULL) {
-                ESP_LOGE(TAG, "malloc failed: dbuf (%d)", data->payload_len);
-                return;
-            }
+        // Realtime frames skip the receive buffer and the sockets queue: the
+        // pixels go straight from the transport buffer into the jitter buffer
+        if (data->op_code == WS_TRANSPORT_OPCODES_BINARY && rx_reassembly_is_whole_stream_frame(data->fin,
+                data->payload_len, data->payload_offset, (const uint8_t*)data->data_ptr, data->data_len)) {
+            led_play_stream_frame((const uint8_t*)data->data_ptr + EXT_FRAME_HEADER_SIZE, data->data_len - EXT_FRAME_HEADER_SIZE);
+            stream_stats_start();
+            break;
         }
 
-        if (dbuf) {
-            memcpy(dbuf + data->payload_offset, data->data_ptr, data->data_len);
+        // control frames are answered by the client itself; a close may say when to come back
+        if (data->op_code & 0x08) {
+            if (data->op_code == WS_TRANSPORT_OPCODES_CLOSE) {
+                ws_retry_hint_ms = backoff_parse_close((const uint8_t*)data->data_ptr, data->data_len);
+            }
+            break;
         }
 
-        if (data->payload_len + data->payload_offset >= data->data_len) {
-            ProcessableMessage_t message;
-            message.message = dbuf;
-            message.message_len = data->payload_len;
-            message.is_outbox = false;
-
-            if (xQueueSend(xSocketsQueue, &message, pdMS_TO_TICKS(50)) != pdTRUE) {
-                ESP_LOGE(TAG, "failed to send message to queue");
-                free(dbuf);
-            }
+        // A message is one or more websocket frames (op_code 0 continues the
+        // previous one), each delivered in one or more chunks at payload_offset
+        if (data->payload_offset == 0 && data->op_code != WS_TRANSPORT_OPCODES_CONT) {
+            rx_us = esp_timer_get_time();
         }
 
+        ProcessableMessage_t message;
+        message.rx = rx_reassembly_feed(&rx_reassembly, data->op_code == WS_TRANSPORT_OPCODES_CONT, data->fin,
+            data->payload_len, data->payload_offset, (const uint8_t*)data->data_ptr, data->data_len);
+        if (message.rx == NULL) {
+            break;
+        }
+        message.message_len = message.rx->len;
+        message.rx_us = rx_us;
+
+        if (xQueueSend(xSocketsQueue, &message, pdMS_TO_TICKS(50)) != pdTRUE) {
+            ESP_LOGE(TAG, "failed to send message to queue");
+            metrics_count(METRIC_RX_QUEUE_DROPS);
+            rx_pool_drop(message.rx);
+            break;
+        }
+        metrics_count(METRIC_RX_MESSAGES);
+        metrics_gauge_max(METRIC_RX_QUEUE_DEPTH_MAX, uxQueueMessagesWaiting(xSocketsQueue));
+        sockets_notify(SOCKETS_NOTIFY_RX);
         break;
     default:
         break;
@@ -101,89 +200,192 @@ static void websocket_event_handler(void* handler_args, esp_event_base_t base, i
 void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
     if (event_base == WIFI_EVENT) {
         sockets_disconnect();
-        led_set_effect(LED_SOLID);
-        led_set_color(0, 255, 0);
-        led_set_brightness(255);
     }
     if (event_base == IP_EVENT) {
         sockets_connect();
-        led_set_effect(LED_OFF);
     }
 }
 
-void handle_global_message(Kd__KDGlobalMessage* message)
+static int sockets_send(const uint8_t* data, size_t len)
 {
-    switch (message->message_case) {
-    case KD__KDGLOBAL_MESSAGE__MESSAGE_JOIN_RESPONSE: {
-        bool needs_claimed = message->join_response->needs_claimed;
-        if (needs_claimed) {
-            ESP_LOGI(TAG, "device needs to be claimed");
-            char* claim_token = (char*)calloc(2048, sizeof(char));
-            size_t claim_token_len = 2048;
-            kd_common_get_claim_token(claim_token, &claim_token_len);
-
-            Kd__ClaimDevice claim_device = KD__CLAIM_DEVICE__INIT;
-            claim_device.claim_token = claim_token;
-
-            Kd__KDGlobalMessage claim_message = KD__KDGLOBAL_MESSAGE__INIT;
-            claim_message.message_case = KD__KDGLOBAL_MESSAGE__MESSAGE_CLAIM_DEVICE;
-            claim_message.claim_device = &claim_device;
-
-            Kd__DeviceAPIMessage device_api_message = KD__DEVICE_APIMESSAGE__INIT;
-            device_api_message.message_case = KD__DEVICE_APIMESSAGE__MESSAGE_KD_GLOBAL_MESSAGE;
-            device_api_message.kd_global_message = &claim_message;
-
-            send_device_api_message(&device_api_message);
-        }
-        else {
-            ESP_LOGI(TAG, "device is already claimed");
+    return esp_websocket_client_send_bin(client, (const char*)data, len, pdMS_TO_TICKS(1000));
+}
+
+static void stream_stats_timer_cb(void* arg)
+{
+    sockets_notify(SOCKETS_NOTIFY_STREAM_STATS);
+}
+
+// Lets the server measure end-to-end jitter of a realtime stream
+static void send_stream_stats()
+{
+    led_state_t state;
+    led_get_state(&state);
+    if (state.effect != LED_STREAM) {
+        esp_timer_stop(stream_stats_timer);
+        return;
+    }
+    if (!esp_websocket_client_is_connected(client)) {
+        return;
+    }
+
+    led_stream_stats_t stats;
+    led_get_stream_stats(&stats);
+    send_ext_frame(EXT_FRAME_STREAM_STATS, &stats, sizeof(stats), TX_CONTROL, TX_KEY_STREAM_STATS);
+}
+
+static void telemetry_timer_cb(void* arg)
+{
+    sockets_notify(SOCKETS_NOTIFY_TELEMETRY);
+}
+
+// kd-protobufs has no telemetry message, so the report goes out as an
+// extension frame carrying its own protobuf, see telemetry.proto
+static void send_telemetry()
+{
+    if (!esp_websocket_client_is_connected(client)) {
+        return;
+    }
+
+    metrics_gauge_set(METRIC_RX_QUEUE_DEPTH, uxQueueMessagesWaiting(xSocketsQueue));
+    // the arena is the sockets task's own, as is this
+    metrics_gauge_set(METRIC_PB_ARENA_PEAK, pb_arena.stats.peak);
+    metrics_gauge_set(METRIC_PB_ARENA_DEMAND_PEAK, pb_arena.stats.demand_peak);
+    metrics_gauge_set(METRIC_PB_ARENA_FALLBACKS, pb_arena.stats.fallbacks);
+    metrics_gauge_set(METRIC_PB_ARENA_FALLBACK_FAILURES, pb_arena.stats.fallback_failures);
+    uint8_t* frame = ext_frame_alloc(EXT_FRAME_TELEMETRY, METRICS_REPORT_MAX);
+    if (frame == NULL) {
+        return;
+    }
+
+    size_t len = metrics_report(frame + EXT_FRAME_HEADER_SIZE, METRICS_REPORT_MAX);
+    if (len == 0) {
+        free(frame);
+        return;
+    }
+    send_ext_frame_buffer(frame, EXT_FRAME_HEADER_SIZE + len, TX_BULK);
+}
+
+#ifdef CONFIG_LANTERN_RX_CAPTURE
+static void log_capture(const uint8_t* data, size_t len)
+{
+    static const char digits[] = "0123456789abcdef";
+    char* hex = (char*)malloc(len * 2 + 1);
+    if (hex == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        hex[2 * i] = digits[data[i] >> 4];
+        hex[2 * i + 1] = digits[data[i] & 0xf];
+    }
+    hex[len * 2] = '\0';
+    ESP_LOGI(TAG, "rx %lu %s", (unsigned long)(esp_timer_get_time() / 1000), hex);
+    free(hex);
+}
+#endif
+
+static void handle_inbound(const ProcessableMessage_t* message, int64_t dequeue_us)
+{
+    const uint8_t* data = message->rx->data;
+#ifdef CONFIG_LANTERN_RX_CAPTURE
+    // replay with host/bench/dispatch_bench
+    log_capture(data, message->message_len);
+#endif
+    bool is_ext_frame = message->message_len >= EXT_FRAME_HEADER_SIZE && data[0] == EXT_FRAME_MARKER;
+    // the trace frame arms a trace for the message after it
+    if (!is_ext_frame || data[1] != EXT_FRAME_TRACE) {
+        latency_trace_begin(message->rx_us, dequeue_us);
+    }
+
+    if (is_ext_frame) {
+        handle_ext_frame(data, message->message_len);
+        if (data[1] == EXT_FRAME_PIXEL_STREAM) {
+            stream_stats_start();
         }
-        break;
+        rx_pool_release(message->rx);
+        return;
     }
-    case KD__KDGLOBAL_MESSAGE__MESSAGE_OK_RESPONSE:
-        ESP_LOGI(TAG, "ok response");
-        break;
-    case KD__KDGLOBAL_MESSAGE__MESSAGE_ERROR_RESPONSE:
-        ESP_LOGE(TAG, "error response: %s", message->error_response->error_message);
-        break;
-    case KD__KDGLOBAL_MESSAGE__MESSAGE_RESTART:
-        esp_restart();
-    default:
-        break;
+
+    // decoded fields are copied into the arena, so the receive buffer can go right away
+    Kd__DeviceAPIMessage* device_api_message = kd__device_apimessage__unpack(&pb_arena.allocator, message->message_len, data);
+    rx_pool_release(message->rx);
+    if (device_api_message == NULL) {
+        ESP_LOGE(TAG, "failed to unpack socket message");
+        pb_arena_reset(&pb_arena);
+        return;
     }
+
+    handle_message(device_api_message, &pb_arena);
+    pb_arena_reset(&pb_arena);
 }
 
-void handle_lantern_message(Kd__KDLanternMessage* message)
+// Handles every inbound message queued since the last wakeup
+static void process_inbound()
 {
-    switch (message->message_case) {
-    case KD__KDLANTERN_MESSAGE__MESSAGE_SET_COLOR:
-        led_set_color(message->set_color->red, message->set_color->green, message->set_color->blue);
-        led_set_speed(message->set_color->effect_speed);
-        led_set_effect((LEDEffect_t)message->set_color->effect);
-        led_set_brightness(message->set_color->effect_brightness);
-        break;
-    case KD__KDLANTERN_MESSAGE__MESSAGE_TOUCH_EVENT_RESPONSE:
-        ESP_LOGI(TAG, "touch event response: %i", message->touch_event_response->success);
-        break;
-    default:
-        break;
+    ProcessableMessage_t message;
+    while (xQueueReceive(xSocketsQueue, &message, 0) == pdTRUE) {
+        int64_t start = esp_timer_get_time();
+        handle_inbound(&message, start);
+        latency_trace_end();
+        metrics_record(METRIC_RX_HANDLE_US, (uint32_t)(esp_timer_get_time() - start));
     }
 }
 
-void handle_message(Kd__DeviceAPIMessage* message)
+static void reconnect_timer_cb(void* arg)
 {
-    switch (message->message_case) {
-    case KD__DEVICE_APIMESSAGE__MESSAGE_KD_GLOBAL_MESSAGE:
-        handle_global_message(message->kd_global_message);
-        break;
-    case KD__DEVICE_APIMESSAGE__MESSAGE_KD_LANTERN_MESSAGE:
-        handle_lantern_message(message->kd_lantern_message);
-        break;
-    default:
-        break;
+    sockets_notify(SOCKETS_NOTIFY_RECONNECT);
+}
+
+static void schedule_reconnect(uint32_t delay_ms)
+{
+    ESP_LOGI(TAG, "connecting in %u ms", (unsigned)delay_ms);
+    metrics_gauge_set(METRIC_WS_BACKOFF_MS, delay_ms);
+    esp_timer_stop(reconnect_timer);
+    esp_timer_start_once(reconnect_timer, delay_ms * 1000ULL);
+}
+
+static void connection_lost()
+{
+    // a close and a disconnect event can both report the same loss
+    if (!ws_running) {
+        return;
+    }
+    ws_running = false;
+    ESP_LOGW(TAG, "disconnected");
+    metrics_count(METRIC_WS_DISCONNECTS);
+
+    int64_t connected_us = ws_connected_us;
+    ws_connected_us = 0;
+    uint32_t hint_ms = ws_retry_hint_ms;
+    ws_retry_hint_ms = 0;
+    if (!ws_wanted) {
+        return;
     }
 
-    kd__device_apimessage__free_unpacked(message, NULL);
+    // only a connection that held up earns a fresh start; one the server
+    // accepts and then drops again keeps backing off
+    if (connected_us && esp_timer_get_time() - connected_us >= CONFIG_LANTERN_RECONNECT_STABLE_S * 1000000LL) {
+        backoff_reset(&reconnect_backoff);
+    }
+    if (hint_ms) {
+        metrics_count(METRIC_WS_RETRY_HINTS);
+    }
+    schedule_reconnect(backoff_next(&reconnect_backoff, hint_ms));
+}
+
+static void reconnect()
+{
+    if (!ws_wanted || ws_running || esp_websocket_client_is_connected(client)) {
+        return;
+    }
+
+    ws_running = true;
+    metrics_count(METRIC_WS_ATTEMPTS);
+    if (esp_websocket_client_start(client) != ESP_OK) {
+        // the last attempt's client task is still winding down
+        esp_websocket_client_stop(client);
+        esp_websocket_client_start(client);
+    }
 }
 
 void sockets_task(void* pvParameter)
@@ -198,8 +400,8 @@ void sockets_task(void* pvParameter)
 
     if (kd_common_crypto_get_state() == CryptoState_t::CRYPTO_STATE_BAD_DS_PARAMS) {
         ESP_LOGE(TAG, "Bad DS params");
-        led_set_effect(LED_BLINK);
-        led_set_color(255, 0, 0);
+        led_show(LED_BLINK, 255, 0, 0, 255);
+        xSocketsTask = NULL;
         vTaskDelete(NULL);
     }
 
@@ -207,19 +409,42 @@ void sockets_task(void* pvParameter)
     esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL);
 
     esp_ds_data_ctx_t* ds_data_ctx = kd_common_crypto_get_ctx();
-    char* cert = (char*)calloc(4096, sizeof(char));
-    size_t cert_len = 4096;
+#ifdef CONFIG_LANTERN_STATIC_ALLOC
+    char* cert = sockets_cert;
+#else
+    char* cert = (char*)calloc(SOCKETS_CERT_SIZE, sizeof(char));
+#endif
+    size_t cert_len = SOCKETS_CERT_SIZE;
 
     kd_common_get_device_cert(cert, &cert_len);
 
+    bool devel = strcmp(FIRMWARE_VARIANT, "devel") == 0;
+
+#ifdef CONFIG_LANTERN_TLS_RESUME
+    // the client's own SSL transport cannot resume sessions; TLS is ours and
+    // the client only layers the websocket protocol over it
+    esp_transport_handle_t tls_transport = NULL;
+#ifdef CONFIG_LANTERN_DEVEL_TLS
+    tls_transport = tls_session_ws_transport(cert, cert_len + 1, ds_data_ctx, !devel);
+#else
+    if (!devel) {
+        tls_transport = tls_session_ws_transport(cert, cert_len + 1, ds_data_ctx, true);
+    }
+#endif
+#endif
+
     esp_websocket_client_config_t prod_websocket_cfg = {
         .uri = SOCKETS_URI,
         .port = 443,
+        .disable_auto_reconnect = true,
+#ifndef CONFIG_LANTERN_TLS_RESUME
         .client_cert = cert,
         .client_cert_len = cert_len + 1,
         .client_ds_data = ds_data_ctx,
         .crt_bundle_attach = esp_crt_bundle_attach,
-        .reconnect_timeout_ms = 5000,
+#else
+        .ext_transport = tls_transport,
+#endif
     };
 
     char headers[256];
@@ -227,17 +452,49 @@ void sockets_task(void* pvParameter)
 
     esp_websocket_client_config_t dev_websocket_cfg = {
         .host = "192.168.4.138",
+#ifndef CONFIG_LANTERN_DEVEL_TLS
         .port = 9091,
         .path = "/",
+        .disable_auto_reconnect = true,
         .transport = WEBSOCKET_TRANSPORT_OVER_TCP,
         .headers = headers,
         .crt_bundle_attach = esp_crt_bundle_attach,
-        .reconnect_timeout_ms = 5000,
+#else
+        .port = 9443,
+        .path = "/",
+        .disable_auto_reconnect = true,
+        .transport = WEBSOCKET_TRANSPORT_OVER_SSL,
+        .headers = headers,
+        .ext_transport = tls_transport,
+#endif
     };
 
+#ifdef CONFIG_LANTERN_TLS_RESUME
+#ifdef CONFIG_LANTERN_DEVEL_TLS
+    bool tls_wanted = true;
+#else
+    bool tls_wanted = !devel;
+#endif
+    if (tls_wanted && tls_transport == NULL) {
+        // still connect, through the client's own SSL transport; every
+        // handshake is then a full one
+        ESP_LOGE(TAG, "failed to create resuming TLS transport, sessions will not be resumed");
+        prod_websocket_cfg.client_cert = cert;
+        prod_websocket_cfg.client_cert_len = cert_len + 1;
+        prod_websocket_cfg.client_ds_data = ds_data_ctx;
+        prod_websocket_cfg.crt_bundle_attach = esp_crt_bundle_attach;
+#ifdef CONFIG_LANTERN_DEVEL_TLS
+        // the stand-in is self-signed, so no bundle, as with tls_transport
+        dev_websocket_cfg.client_cert = cert;
+        dev_websocket_cfg.client_cert_len = cert_len + 1;
+        dev_websocket_cfg.client_ds_data = ds_data_ctx;
+#endif
+    }
+#endif
+
     esp_websocket_client_config_t* websocket_cfg = NULL;
 
-    if (strcmp(FIRMWARE_VARIANT, "devel") == 0) {
+    if (devel) {
         websocket_cfg = &dev_websocket_cfg;
     }
     else {
@@ -247,80 +504,192 @@ void sockets_task(void* pvParameter)
     client = esp_websocket_client_init(websocket_cfg);
     esp_websocket_register_events(client, WEBSOCKET_EVENT_ANY, websocket_event_handler, (void*)client);
 
-    ProcessableMessage_t message;
-
     while (1)
     {
-        if (xQueueReceive(xSocketsQueue, &message, pdMS_TO_TICKS(10)) == pdTRUE) {
-            if (message.message == NULL) {
-                ESP_LOGE(TAG, "message is NULL");
-                continue;
-            }
+        uint32_t notified = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &notified, portMAX_DELAY);
+        metrics_count(METRIC_SOCKETS_WAKEUPS);
+
+        if (notified & SOCKETS_NOTIFY_SHUTDOWN) {
+            break;
+        }
 
-            if (message.is_outbox) {
-                esp_websocket_client_send_bin(client, message.message, message.message_len, pdMS_TO_TICKS(1000));
-                free(message.message);
-                continue;
+        if (notified & SOCKETS_NOTIFY_DISCONNECT) {
+            ws_wanted = false;
+            esp_timer_stop(reconnect_timer);
+            if (esp_websocket_client_is_connected(client)) {
+                esp_websocket_client_close(client, pdMS_TO_TICKS(1000));
             }
+            connection_lost();
+            led_show(LED_SOLID, 0, 255, 0, 255);
+        }
 
-            Kd__DeviceAPIMessage* device_api_message = kd__device_apimessage__unpack(NULL, message.message_len, (uint8_t*)message.message);
-            if (device_api_message == NULL) {
-                ESP_LOGE(TAG, "failed to unpack socket message");
-                free(message.message);
-                continue;
+        if (notified & SOCKETS_NOTIFY_CONNECT) {
+            ws_wanted = true;
+            // every lantern behind the same access point gets its address at once
+            if (!ws_running && !esp_timer_is_active(reconnect_timer)) {
+                schedule_reconnect(backoff_first(&reconnect_backoff));
             }
+            led_set_effect(LED_OFF);
+        }
+
+        if (notified & SOCKETS_NOTIFY_LOST) {
+            connection_lost();
+        }
+
+        if (notified & SOCKETS_NOTIFY_RECONNECT) {
+            reconnect();
+        }
 
-            handle_message(device_api_message);
+        if (notified & SOCKETS_NOTIFY_RX) {
+            metrics_count(METRIC_SOCKETS_RX_WAKEUPS);
+            process_inbound();
+        }
+
+        if (notified & SOCKETS_NOTIFY_STREAM_STATS) {
+            send_stream_stats();
+        }
+
+        if (notified & SOCKETS_NOTIFY_TELEMETRY) {
+            send_telemetry();
+        }
+
+        // replies and stats above may have queued more
+        if (notified & (SOCKETS_NOTIFY_TX | SOCKETS_NOTIFY_STREAM_STATS | SOCKETS_NOTIFY_TELEMETRY) || tx_sched_pending()) {
+            if (notified & SOCKETS_NOTIFY_TX) {
+                metrics_count(METRIC_SOCKETS_TX_WAKEUPS);
+            }
+            tx_sched_drain(sockets_send);
         }
     }
+
+    ESP_LOGI(TAG, "shutting down");
+    esp_timer_stop(stream_stats_timer);
+    esp_timer_stop(telemetry_timer);
+    esp_timer_stop(reconnect_timer);
+    esp_websocket_client_destroy(client);
+    client = NULL;
+    xSocketsTask = NULL;
+    vTaskDelete(NULL);
 }
 
 void sockets_init()
 {
-    xSocketsQueue = xQueueCreate(10, sizeof(ProcessableMessage_t));
+    xSocketsQueue = queue_create(&sockets_queue_storage);
+    rx_pool_init();
+    tx_sched_init();
+    pb_arena_init(&pb_arena, pb_arena_buffer, sizeof(pb_arena_buffer));
+    metrics_report_init();
+
+    esp_timer_create_args_t timer_args = {
+        .callback = stream_stats_timer_cb,
+        .name = "stream_stats",
+    };
+    esp_timer_create(&timer_args, &stream_stats_timer);
 
-    xTaskCreatePinnedToCore(sockets_task, "sockets", 4096, NULL, 5, &xSocketsTask, 1);
+    esp_timer_create_args_t telemetry_timer_args = {
+        .callback = telemetry_timer_cb,
+        .name = "telemetry",
+    };
+    esp_timer_create(&telemetry_timer_args, &telemetry_timer);
+
+    esp_timer_create_args_t reconnect_timer_args = {
+        .callback = reconnect_timer_cb,
+        .name = "reconnect",
+    };
+    esp_timer_create(&reconnect_timer_args, &reconnect_timer);
+    backoff_init(&reconnect_backoff, CONFIG_LANTERN_RECONNECT_BASE_MS, CONFIG_LANTERN_RECONNECT_CAP_S * 1000, esp_random());
+
+    xSocketsTask = task_create(&sockets_task_storage, sockets_task, "sockets", NULL, 5, 1);
 }
 
+// Connection changes are carried out by the sockets task; requests made
+// before it is ready are picked up once the client exists
 void sockets_connect()
 {
-    if (client == NULL) {
-        return;
+    sockets_notify(SOCKETS_NOTIFY_CONNECT);
+}
+
+void sockets_disconnect()
+{
+    sockets_notify(SOCKETS_NOTIFY_DISCONNECT);
+}
+
+void sockets_shutdown()
+{
+    sockets_notify(SOCKETS_NOTIFY_SHUTDOWN);
+}
+
+// Packs into a heap buffer for tx_sched
+static uint8_t* pack_device_api_message(Kd__DeviceAPIMessage* message, size_t* len)
+{
+    *len = kd__device_apimessage__get_packed_size(message);
+    uint8_t* buffer = (uint8_t*)heap_caps_calloc(*len, sizeof(uint8_t), MALLOC_CAP_SPIRAM);
+    if (buffer == NULL) {
+        ESP_LOGE(TAG, "failed to allocate message buffer");
+        return NULL;
     }
 
-    esp_websocket_client_start(client);
+    kd__device_apimessage__pack(message, buffer);
+    return buffer;
 }
 
-void sockets_disconnect()
+// Replies built on the sockets task go through tx_sched like everything
+// else, so they queue behind a pending touch instead of in front of it; the
+// task drains the queue as soon as the inbound message is handled
+void send_device_api_message(Kd__DeviceAPIMessage* message, tx_class_t cls, tx_key_t key)
 {
-    if (client != NULL) {
+    size_t len;
+    uint8_t* buffer = pack_device_api_message(message, &len);
+    if (buffer == NULL) {
         return;
     }
 
-    esp_websocket_client_close(client, pdMS_TO_TICKS(1000));
+    if (!tx_sched_push(cls, key, buffer, len)) {
+        ESP_LOGE(TAG, "outbound queue full, dropped message");
+        return;
+    }
+    sockets_notify(SOCKETS_NOTIFY_TX);
 }
 
-void send_device_api_message(Kd__DeviceAPIMessage* message)
+uint8_t* ext_frame_alloc(ext_frame_type_t type, size_t payload_len)
 {
-    size_t len = kd__device_apimessage__get_packed_size(message);
-    uint8_t* buffer = (uint8_t*)heap_caps_calloc(len, sizeof(uint8_t), MALLOC_CAP_SPIRAM);
-    if (buffer == NULL) {
+    uint8_t* frame = (uint8_t*)heap_caps_malloc(EXT_FRAME_HEADER_SIZE + payload_len, MALLOC_CAP_SPIRAM);
+    if (frame == NULL) {
         ESP_LOGE(TAG, "failed to allocate message buffer");
-        return;
+        return NULL;
     }
 
-    kd__device_apimessage__pack(message, buffer);
-    ProcessableMessage_t p_message;
-    p_message.message = (char*)buffer;
-    p_message.message_len = len;
-    p_message.is_outbox = true;
+    frame[0] = EXT_FRAME_MARKER;
+    frame[1] = type;
+    return frame;
+}
 
-    if (xQueueSend(xSocketsQueue, &p_message, pdMS_TO_TICKS(50)) != pdTRUE) {
-        ESP_LOGE(TAG, "failed to send message to queue");
+bool send_ext_frame_buffer(uint8_t* frame, size_t len, tx_class_t cls, tx_key_t key)
+{
+    if (!tx_sched_push(cls, key, frame, len)) {
+        ESP_LOGE(TAG, "outbound queue full, dropped message");
+        return false;
     }
+    sockets_notify(SOCKETS_NOTIFY_TX);
+    return true;
 }
 
-void notify_touch() {
+void send_ext_frame(ext_frame_type_t type, const void* payload, size_t len, tx_class_t cls, tx_key_t key)
+{
+    uint8_t* frame = ext_frame_alloc(type, len);
+    if (frame == NULL) {
+        return;
+    }
+
+    memcpy(frame + EXT_FRAME_HEADER_SIZE, payload, len);
+    send_ext_frame_buffer(frame, EXT_FRAME_HEADER_SIZE + len, cls, key);
+}
+
+// TouchEvent has no gesture field, so the gesture follows in an extension
+// frame; servers that only know TouchEvent see one touch per gesture. The two
+// are queued as a pair under one coalesce key, so a newer touch replaces both.
+void notify_touch(touch_gesture_t gesture) {
     Kd__TouchEvent event = KD__TOUCH_EVENT__INIT;
 
     Kd__KDLanternMessage message = KD__KDLANTERN_MESSAGE__INIT;
@@ -331,84 +700,22 @@ void notify_touch() {
     device_api_message.message_case = KD__DEVICE_APIMESSAGE__MESSAGE_KD_LANTERN_MESSAGE;
     device_api_message.kd_lantern_message = &message;
 
-    send_device_api_message(&device_api_message);
-}
-
-void upload_coredump_task(void* pvParameter) {
-    ESP_LOGI(TAG, "attempting coredump upload");
-
-    // Find the coredump partition
-    const esp_partition_t* core_dump_partition = esp_partition_find_first(
-        ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_COREDUMP, "coredump");
-
-    if (!core_dump_partition)
-    {
+    size_t len;
+    uint8_t* buffer = pack_device_api_message(&device_api_message, &len);
+    if (buffer == NULL) {
         return;
     }
 
-    // Read the core dump size
-    size_t core_dump_size = core_dump_partition->size;
-
-    size_t encoded_size = 0;
-    uint8_t* encoded_data = 0;
-    bool is_erased = true;
-
-    Kd__UploadCoreDump upload = KD__UPLOAD_CORE_DUMP__INIT;
-    Kd__DeviceAPIMessage device_api_message = KD__DEVICE_APIMESSAGE__INIT;
-    Kd__KDGlobalMessage global_message = KD__KDGLOBAL_MESSAGE__INIT;
-
-    //esp_app_desc
-    const esp_app_desc_t* app_desc = esp_app_get_description();
-
-    uint8_t* core_dump_data = (uint8_t*)heap_caps_calloc(core_dump_size + 1, sizeof(uint8_t), MALLOC_CAP_SPIRAM); // used as return, so freed in calling function
-    if (esp_partition_read(core_dump_partition, 0, core_dump_data, core_dump_size) != ESP_OK)
-    {
-        ESP_LOGE(TAG, "Failed to read core dump data");
-        goto exit;
-    }
-
-    // Check if coredump is erased (all 0xFF)
-    for (size_t i = 0; i < core_dump_size && is_erased; i++) {
-        is_erased &= (core_dump_data[i] == 0xFF);
-    }
-
-    if (is_erased) {
-        ESP_LOGI(TAG, "Core dump partition is empty");
-        goto exit;
-    }
-
-    // Calculate Base64 encoded size
-    mbedtls_base64_encode(NULL, 0, &encoded_size, core_dump_data, core_dump_size);
-    encoded_data = (uint8_t*)heap_caps_calloc(encoded_size + 1, sizeof(uint8_t), MALLOC_CAP_SPIRAM); // used as return, so freed in calling function
-    if (!encoded_data)
-    {
-        ESP_LOGE(TAG, "Failed to allocate memory for encoded data");
-        goto exit;
+    uint8_t* frame = ext_frame_alloc(EXT_FRAME_TOUCH_GESTURE, 1);
+    if (frame == NULL) {
+        free(buffer);
+        return;
     }
+    frame[EXT_FRAME_HEADER_SIZE] = gesture;
 
-    mbedtls_base64_encode(encoded_data, encoded_size, &encoded_size, core_dump_data, core_dump_size);
-
-    upload.core_dump.data = encoded_data;
-    upload.core_dump.len = encoded_size;
-    upload.firmware_project = strdup(app_desc->project_name);
-    upload.firmware_version = strdup(app_desc->version);
-    upload.firmware_variant = FIRMWARE_VARIANT;
-
-    device_api_message.message_case = KD__DEVICE_APIMESSAGE__MESSAGE_KD_GLOBAL_MESSAGE;
-    global_message.message_case = KD__KDGLOBAL_MESSAGE__MESSAGE_UPLOAD_CORE_DUMP;
-    global_message.upload_core_dump = &upload;
-    device_api_message.kd_global_message = &global_message;
-
-    send_device_api_message(&device_api_message);
-
-    //clear the coredump partition
-    if (esp_partition_erase_range(core_dump_partition, 0, core_dump_size) != ESP_OK)
-    {
-        ESP_LOGE(TAG, "Failed to erase core dump partition");
+    if (!tx_sched_push_pair(TX_INTERACTIVE, TX_KEY_TOUCH, buffer, len, frame, EXT_FRAME_HEADER_SIZE + 1)) {
+        ESP_LOGE(TAG, "outbound queue full, dropped message");
+        return;
     }
-
-exit:
-    free(core_dump_data);
-    free(encoded_data);
-    vTaskDelete(NULL);
-}
\ No newline at end of file
+    sockets_notify(SOCKETS_NOTIFY_TX);
+}
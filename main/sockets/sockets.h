@@ -3,13 +3,22 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include "device-api.pb-c.h"
+#include "ext_frame.h"
+#include "tx_sched.h"
+#include "touch_filter.h"
 
 #define SOCKETS_URI "wss://device.api.koiosdigital.net/"
 
 void sockets_init();
+// Ask the sockets task to (re)connect, disconnect or stop for good
 void sockets_disconnect();
 void sockets_connect();
+void sockets_shutdown();
 
-void notify_touch();
-void send_device_api_message(Kd__DeviceAPIMessage* message);
-void upload_coredump_task(void* pvParameter);
\ No newline at end of file
+void notify_touch(touch_gesture_t gesture);
+void send_device_api_message(Kd__DeviceAPIMessage* message, tx_class_t cls = TX_CONTROL, tx_key_t key = TX_KEY_NONE);
+void send_ext_frame(ext_frame_type_t type, const void* payload, size_t len, tx_class_t cls = TX_CONTROL, tx_key_t key = TX_KEY_NONE);
+// For payloads built in place: allocates a frame with the header filled in,
+// payload goes at EXT_FRAME_HEADER_SIZE. Sending takes ownership of the frame.
+uint8_t* ext_frame_alloc(ext_frame_type_t type, size_t payload_len);
+bool send_ext_frame_buffer(uint8_t* frame, size_t len, tx_class_t cls = TX_CONTROL, tx_key_t key = TX_KEY_NONE);
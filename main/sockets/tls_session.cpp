@@ -0,0 +1,349 @@
+#include "tls_session.h"
+
+#include "sdkconfig.h"
+#ifdef CONFIG_LANTERN_TLS_RESUME
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include "esp_log.h"
+#include "esp_tls.h"
+#include "esp_crt_bundle.h"
+#include "esp_transport_ws.h"
+#include "esp_app_desc.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/platform_util.h"
+
+#include "metrics.h"
+
+static const char* TAG = "tls_session";
+
+#define TLS_SESSION_NVS_NAMESPACE "tls_session"
+#define TLS_SESSION_NVS_MAX 4096
+
+typedef struct tls_transport_t {
+    esp_tls_t* tls;
+    esp_tls_cfg_t cfg;
+} tls_transport_t;
+
+// esp-tls hands sessions out as an opaque esp_tls_client_session_t, which is
+// a bare mbedtls_ssl_session (esp_tls_private.h). Telling a resumed handshake
+// from a full one and restoring a session from NVS need its insides;
+// esp_tls_free_client_session() frees ours like its own.
+typedef struct tls_session_layout_t {
+    mbedtls_ssl_session saved_session;
+} tls_session_layout_t;
+
+// Only touched from connect, i.e. the websocket client's task
+typedef struct tls_session_cache_t {
+    esp_tls_client_session_t* session;
+    uint32_t key;           // server, client certificate and firmware it belongs to
+    uint32_t master_crc;    // a resumed handshake keeps the master secret
+    bool nvs_loaded;
+} tls_session_cache_t;
+
+static tls_session_cache_t cache;
+
+static uint32_t session_master_crc(esp_tls_client_session_t* session) {
+    const mbedtls_ssl_session* s = &((tls_session_layout_t*)session)->saved_session;
+    return esp_rom_crc32_le(0, s->MBEDTLS_PRIVATE(master), sizeof(s->MBEDTLS_PRIVATE(master)));
+}
+
+static uint32_t session_key(const char* host, int port, const esp_tls_cfg_t* cfg) {
+    // a new image may trust a different set of CAs; a resumed session skips verification
+    const esp_app_desc_t* app_desc = esp_app_get_description();
+    uint32_t key = esp_rom_crc32_le(0, app_desc->app_elf_sha256, sizeof(app_desc->app_elf_sha256));
+    key = esp_rom_crc32_le(key, (const uint8_t*)host, strlen(host));
+    key = esp_rom_crc32_le(key, (const uint8_t*)&port, sizeof(port));
+    return esp_rom_crc32_le(key, cfg->clientcert_buf, cfg->clientcert_bytes);
+}
+
+#ifdef CONFIG_LANTERN_TLS_SESSION_NVS
+static void session_nvs_erase() {
+    nvs_handle_t nvs;
+    if (nvs_open(TLS_SESSION_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    nvs_erase_all(nvs);
+    nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+static void session_nvs_save(esp_tls_client_session_t* session, uint32_t key) {
+    const mbedtls_ssl_session* s = &((tls_session_layout_t*)session)->saved_session;
+    size_t len = 0;
+    mbedtls_ssl_session_save(s, NULL, 0, &len);
+    if (len == 0 || len > TLS_SESSION_NVS_MAX) {
+        return;
+    }
+    uint8_t* blob = (uint8_t*)malloc(len);
+    if (blob == NULL) {
+        return;
+    }
+
+    nvs_handle_t nvs;
+    if (mbedtls_ssl_session_save(s, blob, len, &len) == 0 && nvs_open(TLS_SESSION_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_set_u32(nvs, "key", key);
+        nvs_set_blob(nvs, "session", blob, len);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    // the blob holds the master secret
+    mbedtls_platform_zeroize(blob, len);
+    free(blob);
+}
+
+// The session saved for this key, NULL if there is none
+static esp_tls_client_session_t* session_nvs_load(uint32_t key) {
+    nvs_handle_t nvs;
+    if (nvs_open(TLS_SESSION_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return NULL;
+    }
+
+    uint32_t stored_key = 0;
+    size_t len = 0;
+    uint8_t* blob = NULL;
+    if (nvs_get_u32(nvs, "key", &stored_key) == ESP_OK && stored_key == key
+        && nvs_get_blob(nvs, "session", NULL, &len) == ESP_OK && len <= TLS_SESSION_NVS_MAX) {
+        blob = (uint8_t*)malloc(len);
+        if (blob && nvs_get_blob(nvs, "session", blob, &len) != ESP_OK) {
+            free(blob);
+            blob = NULL;
+        }
+    }
+    nvs_close(nvs);
+    if (blob == NULL) {
+        return NULL;
+    }
+
+    tls_session_layout_t* session = (tls_session_layout_t*)calloc(1, sizeof(tls_session_layout_t));
+    if (session) {
+        mbedtls_ssl_session_init(&session->saved_session);
+        if (mbedtls_ssl_session_load(&session->saved_session, blob, len) != 0) {
+            esp_tls_free_client_session((esp_tls_client_session_t*)session);
+            session = NULL;
+        }
+    }
+    mbedtls_platform_zeroize(blob, len);
+    free(blob);
+    return (esp_tls_client_session_t*)session;
+}
+#endif
+
+static void session_drop() {
+    if (cache.session) {
+        esp_tls_free_client_session(cache.session);
+        cache.session = NULL;
+    }
+#ifdef CONFIG_LANTERN_TLS_SESSION_NVS
+    session_nvs_erase();
+#endif
+}
+
+static void session_keep(esp_tls_client_session_t* session, uint32_t key, bool persist) {
+    if (cache.session) {
+        esp_tls_free_client_session(cache.session);
+    }
+    cache.session = session;
+    cache.key = key;
+    cache.master_crc = session_master_crc(session);
+#ifdef CONFIG_LANTERN_TLS_SESSION_NVS
+    if (persist) {
+        session_nvs_save(session, key);
+    }
+#endif
+}
+
+// The session to offer for this key, NULL for a full handshake
+static esp_tls_client_session_t* session_for(uint32_t key) {
+    if (cache.session && cache.key != key) {
+        ESP_LOGI(TAG, "server, certificate or firmware changed, dropping session");
+        session_drop();
+    }
+#ifdef CONFIG_LANTERN_TLS_SESSION_NVS
+    if (!cache.nvs_loaded) {
+        cache.nvs_loaded = true;
+        esp_tls_client_session_t* saved = session_nvs_load(key);
+        if (saved) {
+            session_keep(saved, key, false);
+        }
+    }
+#endif
+    return cache.session;
+}
+
+static int tls_close(esp_transport_handle_t t);
+
+static int tls_poll(esp_transport_handle_t t, int timeout_ms, bool write) {
+    tls_transport_t* tt = (tls_transport_t*)esp_transport_get_context_data(t);
+    if (tt->tls == NULL) {
+        return -1;
+    }
+    if (!write && esp_tls_get_bytes_avail(tt->tls) > 0) {
+        return 1;
+    }
+
+    int fd = -1;
+    if (esp_tls_get_conn_sockfd(tt->tls, &fd) != ESP_OK || fd < 0) {
+        return -1;
+    }
+    fd_set ready;
+    fd_set errors;
+    FD_ZERO(&ready);
+    FD_ZERO(&errors);
+    FD_SET(fd, &ready);
+    FD_SET(fd, &errors);
+    struct timeval timeout = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    int ret = select(fd + 1, write ? NULL : &ready, write ? &ready : NULL, &errors, timeout_ms < 0 ? NULL : &timeout);
+    if (ret > 0 && FD_ISSET(fd, &errors)) {
+        return -1;
+    }
+    return ret;
+}
+
+static int tls_poll_read(esp_transport_handle_t t, int timeout_ms) {
+    return tls_poll(t, timeout_ms, false);
+}
+
+static int tls_poll_write(esp_transport_handle_t t, int timeout_ms) {
+    return tls_poll(t, timeout_ms, true);
+}
+
+static int tls_connect(esp_transport_handle_t t, const char* host, int port, int timeout_ms) {
+    tls_close(t);
+    tls_transport_t* tt = (tls_transport_t*)esp_transport_get_context_data(t);
+    tt->tls = esp_tls_init();
+    if (tt->tls == NULL) {
+        return -1;
+    }
+
+    uint32_t key = session_key(host, port, &tt->cfg);
+    esp_tls_cfg_t cfg = tt->cfg;
+    cfg.timeout_ms = timeout_ms;
+    cfg.client_session = session_for(key);
+    bool offered = cfg.client_session != NULL;
+    if (offered) {
+        metrics_count(METRIC_TLS_RESUME_OFFERS);
+    }
+
+    int64_t start = esp_timer_get_time();
+    if (esp_tls_conn_new_sync(host, strlen(host), port, &cfg, tt->tls) <= 0) {
+        esp_tls_error_handle_t error = NULL;
+        esp_tls_get_error_handle(tt->tls, &error);
+        // not worth offering again if the server choked on it; a lost network keeps it
+        if (offered && error && error->last_error == ESP_ERR_MBEDTLS_SSL_HANDSHAKE_FAILED) {
+            ESP_LOGW(TAG, "handshake offering a session failed, dropping it");
+            session_drop();
+        }
+        esp_tls_conn_destroy(tt->tls);
+        tt->tls = NULL;
+        return -1;
+    }
+    uint32_t ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+
+    esp_tls_client_session_t* session = esp_tls_get_client_session(tt->tls);
+    bool resumed = offered && session && session_master_crc(session) == cache.master_crc;
+    if (resumed) {
+        metrics_count(METRIC_TLS_RESUMED);
+        metrics_record(METRIC_TLS_RESUMED_MS, ms);
+    }
+    else {
+        metrics_record(METRIC_TLS_FULL_MS, ms);
+    }
+    ESP_LOGI(TAG, "%s handshake in %u ms", resumed ? "resumed" : "full", (unsigned)ms);
+
+    // a resumed session may come with a renewed ticket; only a new session is worth a flash write
+    if (session) {
+        session_keep(session, key, !resumed);
+    }
+    return 0;
+}
+
+static int tls_read(esp_transport_handle_t t, char* buffer, int len, int timeout_ms) {
+    tls_transport_t* tt = (tls_transport_t*)esp_transport_get_context_data(t);
+    if (tt->tls == NULL) {
+        return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+    if (timeout_ms >= 0 && esp_tls_get_bytes_avail(tt->tls) <= 0) {
+        int ready = tls_poll_read(t, timeout_ms);
+        if (ready <= 0) {
+            return ready == 0 ? ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT : ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+        }
+    }
+
+    ssize_t ret = esp_tls_conn_read(tt->tls, buffer, len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_TIMEOUT) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    if (ret == 0) {
+        return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    }
+    return ret < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : (int)ret;
+}
+
+static int tls_write(esp_transport_handle_t t, const char* buffer, int len, int timeout_ms) {
+    tls_transport_t* tt = (tls_transport_t*)esp_transport_get_context_data(t);
+    if (tt->tls == NULL) {
+        return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+    int ready = tls_poll_write(t, timeout_ms);
+    if (ready <= 0) {
+        return ready == 0 ? ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT : ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+
+    ssize_t ret = esp_tls_conn_write(tt->tls, buffer, len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    return ret < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : (int)ret;
+}
+
+static int tls_close(esp_transport_handle_t t) {
+    tls_transport_t* tt = (tls_transport_t*)esp_transport_get_context_data(t);
+    if (tt->tls) {
+        esp_tls_conn_destroy(tt->tls);
+        tt->tls = NULL;
+    }
+    return 0;
+}
+
+static int tls_destroy(esp_transport_handle_t t) {
+    tls_close(t);
+    free(esp_transport_get_context_data(t));
+    return 0;
+}
+
+esp_transport_handle_t tls_session_ws_transport(const char* client_cert, size_t client_cert_len, void* ds_data, bool verify_server) {
+    tls_transport_t* tt = (tls_transport_t*)calloc(1, sizeof(tls_transport_t));
+    if (tt == NULL) {
+        return NULL;
+    }
+    esp_transport_handle_t t = esp_transport_init();
+    if (t == NULL) {
+        free(tt);
+        return NULL;
+    }
+
+    // fields of anonymous unions, no designated initializers
+    tt->cfg.clientcert_buf = (const unsigned char*)client_cert;
+    tt->cfg.clientcert_bytes = client_cert_len;
+    tt->cfg.ds_data = ds_data;
+    if (verify_server) {
+        tt->cfg.crt_bundle_attach = esp_crt_bundle_attach;
+    }
+
+    esp_transport_set_context_data(t, tt);
+    esp_transport_set_func(t, tls_connect, tls_read, tls_write, tls_close, tls_poll_read, tls_poll_write, tls_destroy);
+    esp_transport_set_default_port(t, 443);
+    esp_transport_handle_t ws = esp_transport_ws_init(t);
+    if (ws == NULL) {
+        esp_transport_destroy(t);
+    }
+    return ws;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_transport.h"
+
+// TLS for the device API connection that resumes sessions. Every reconnect
+// through esp_websocket_client's own SSL transport is a full mutual-TLS
+// handshake: certificate chain verification, key exchange and a client key
+// signature through the DS peripheral. This transport keeps the session of
+// the last full handshake and offers it on the next connect, as a session
+// ticket or, for servers without tickets, a session ID. A server that takes
+// it skips all of the above.
+//
+// The session is kept in RAM and, with CONFIG_LANTERN_TLS_SESSION_NVS, in NVS
+// across reboots. It is bound to the server, the client certificate and the
+// firmware image (and with it the CA bundle the server was verified against),
+// and dropped when any of them changes or a handshake offering it fails.
+//
+// Handshakes are counted in METRIC_TLS_RESUME_OFFERS and METRIC_TLS_RESUMED,
+// timed in METRIC_TLS_FULL_MS and METRIC_TLS_RESUMED_MS.
+
+// A websocket transport over a resuming TLS transport, for
+// esp_websocket_client_config_t.ext_transport. client_cert is PEM, its
+// length including the terminating NUL, and has to outlive the transport.
+// Without verify_server no CA bundle is attached, which esp-tls only accepts
+// with CONFIG_ESP_TLS_SKIP_SERVER_CERT_VERIFY; for self-signed stand-ins.
+// NULL if out of memory.
+esp_transport_handle_t tls_session_ws_transport(const char* client_cert, size_t client_cert_len, void* ds_data, bool verify_server);
@@ -0,0 +1,233 @@
+#include "tx_sched.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+#include "ext_frame.h"
+#include "metrics.h"
+
+typedef struct tx_entry_t {
+    uint8_t* buffer;
+    size_t len;
+    uint8_t* follow;    // sent right after buffer, or NULL
+    size_t follow_len;
+    int64_t queued_us;
+    tx_key_t key;
+} tx_entry_t;
+
+typedef struct tx_queue_t {
+    tx_entry_t entries[TX_SCHED_DEPTH];
+    uint8_t head;
+    uint8_t count;
+} tx_queue_t;
+
+static tx_queue_t tx_queues[TX_CLASSES];
+static portMUX_TYPE tx_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const metric_histogram_id_t tx_latency_metric[TX_CLASSES] = { METRIC_TX_INTERACTIVE_US, METRIC_TX_CONTROL_US, METRIC_TX_BULK_US };
+static const metric_gauge_t tx_depth_metric[TX_CLASSES] = { METRIC_TX_INTERACTIVE_DEPTH_MAX, METRIC_TX_CONTROL_DEPTH_MAX, METRIC_TX_BULK_DEPTH_MAX };
+static const metric_counter_t tx_coalesced_metric[TX_CLASSES] = { METRIC_TX_INTERACTIVE_COALESCED, METRIC_TX_CONTROL_COALESCED, METRIC_TX_BULK_COALESCED };
+static const metric_counter_t tx_dropped_metric[TX_CLASSES] = { METRIC_TX_INTERACTIVE_DROPS, METRIC_TX_CONTROL_DROPS, METRIC_TX_BULK_DROPS };
+
+#ifdef CONFIG_LANTERN_TX_BATCH
+// each message in a batch is prefixed with its length, u16 little endian
+#define TX_BATCH_ENTRY_HEADER 2
+static uint8_t tx_batch[CONFIG_LANTERN_TX_BATCH_BYTES];
+#endif
+
+static inline tx_entry_t* tx_entry(tx_queue_t* q, uint8_t i) {
+    return &q->entries[(q->head + i) % TX_SCHED_DEPTH];
+}
+
+void tx_sched_init() {
+    memset(tx_queues, 0, sizeof(tx_queues));
+}
+
+// Bytes the entry's messages take, with overhead added per message
+static inline size_t tx_entry_size(const tx_entry_t* e, size_t overhead) {
+    return overhead + e->len + (e->follow ? overhead + e->follow_len : 0);
+}
+
+bool tx_sched_push(tx_class_t cls, tx_key_t key, uint8_t* buffer, size_t len) {
+    return tx_sched_push_pair(cls, key, buffer, len, NULL, 0);
+}
+
+bool tx_sched_push_pair(tx_class_t cls, tx_key_t key, uint8_t* buffer, size_t len, uint8_t* follow, size_t follow_len) {
+    int64_t now = esp_timer_get_time();
+    tx_queue_t* q = &tx_queues[cls];
+    uint8_t* replaced = NULL;
+    uint8_t* replaced_follow = NULL;
+    bool queued = true;
+    uint8_t depth = 0;
+
+    taskENTER_CRITICAL(&tx_lock);
+
+    if (key != TX_KEY_NONE) {
+        for (uint8_t i = 0; i < q->count; i++) {
+            tx_entry_t* e = tx_entry(q, i);
+            if (e->key == key && now - e->queued_us < TX_SCHED_COALESCE_MS * 1000) {
+                // keeps its place and original queue time
+                replaced = e->buffer;
+                replaced_follow = e->follow;
+                e->buffer = buffer;
+                e->len = len;
+                e->follow = follow;
+                e->follow_len = follow_len;
+                break;
+            }
+        }
+    }
+
+    if (replaced == NULL) {
+        if (q->count == TX_SCHED_DEPTH) {
+            queued = false;
+        }
+        else {
+            tx_entry_t* e = tx_entry(q, q->count);
+            e->buffer = buffer;
+            e->len = len;
+            e->follow = follow;
+            e->follow_len = follow_len;
+            e->queued_us = now;
+            e->key = key;
+            q->count++;
+            depth = q->count;
+        }
+    }
+    taskEXIT_CRITICAL(&tx_lock);
+
+    if (replaced) {
+        metrics_count(tx_coalesced_metric[cls]);
+    }
+    metrics_gauge_max(tx_depth_metric[cls], depth);
+    free(replaced);
+    free(replaced_follow);
+    if (!queued) {
+        metrics_count(tx_dropped_metric[cls]);
+        free(buffer);
+        free(follow);
+    }
+    return queued;
+}
+
+bool tx_sched_pending() {
+    bool pending = false;
+    taskENTER_CRITICAL(&tx_lock);
+    for (int c = 0; c < TX_CLASSES; c++) {
+        pending |= tx_queues[c].count > 0;
+    }
+    taskEXIT_CRITICAL(&tx_lock);
+    return pending;
+}
+
+// Takes the next entry in priority order if its messages, plus overhead
+// bytes each, come to at most max_len bytes
+static bool tx_pop(size_t max_len, size_t overhead, tx_entry_t* entry, tx_class_t* cls) {
+    bool popped = false;
+
+    taskENTER_CRITICAL(&tx_lock);
+    for (int c = 0; c < TX_CLASSES; c++) {
+        tx_queue_t* q = &tx_queues[c];
+        if (q->count == 0) {
+            continue;
+        }
+        if (tx_entry_size(&q->entries[q->head], overhead) <= max_len) {
+            *entry = q->entries[q->head];
+            *cls = (tx_class_t)c;
+            q->head = (q->head + 1) % TX_SCHED_DEPTH;
+            q->count--;
+            popped = true;
+        }
+        break;
+    }
+    taskEXIT_CRITICAL(&tx_lock);
+    return popped;
+}
+
+static void tx_done(const tx_entry_t* entry, tx_class_t cls, bool ok, int64_t now) {
+    metrics_record(tx_latency_metric[cls], (uint32_t)(now - entry->queued_us));
+    if (!ok) {
+        metrics_count(tx_dropped_metric[cls]);
+    }
+
+    free(entry->buffer);
+    free(entry->follow);
+}
+
+#ifdef CONFIG_LANTERN_TX_BATCH
+static uint8_t* tx_batch_append(uint8_t* p, const uint8_t* message, size_t len) {
+    *p++ = len & 0xFF;
+    *p++ = len >> 8;
+    memcpy(p, message, len);
+    return p + len;
+}
+
+// Sends first plus as many following small messages as fit in one batch frame
+static void tx_send_batch(tx_send_fn_t send, const tx_entry_t* first, tx_class_t first_cls) {
+    tx_entry_t entries[TX_SCHED_DEPTH];
+    tx_class_t classes[TX_SCHED_DEPTH];
+    size_t count = 1;
+    entries[0] = *first;
+    classes[0] = first_cls;
+
+    size_t used = EXT_FRAME_HEADER_SIZE + tx_entry_size(first, TX_BATCH_ENTRY_HEADER);
+    while (count < TX_SCHED_DEPTH && used < sizeof(tx_batch)
+        && tx_pop(sizeof(tx_batch) - used, TX_BATCH_ENTRY_HEADER, &entries[count], &classes[count])) {
+        used += tx_entry_size(&entries[count], TX_BATCH_ENTRY_HEADER);
+        count++;
+    }
+
+    int result;
+    bool batched = count > 1 || first->follow != NULL;
+    if (!batched) {
+        result = send(first->buffer, first->len);
+    }
+    else {
+        uint8_t* p = tx_batch;
+        *p++ = EXT_FRAME_MARKER;
+        *p++ = EXT_FRAME_BATCH;
+        for (size_t i = 0; i < count; i++) {
+            p = tx_batch_append(p, entries[i].buffer, entries[i].len);
+            if (entries[i].follow) {
+                p = tx_batch_append(p, entries[i].follow, entries[i].follow_len);
+            }
+        }
+        result = send(tx_batch, p - tx_batch);
+    }
+
+    int64_t now = esp_timer_get_time();
+    metrics_count(METRIC_TX_SENDS);
+    if (batched) {
+        metrics_count(METRIC_TX_BATCHES);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        tx_done(&entries[i], classes[i], result >= 0, now);
+    }
+}
+#endif
+
+void tx_sched_drain(tx_send_fn_t send) {
+    tx_entry_t entry;
+    tx_class_t cls;
+
+    while (tx_pop(SIZE_MAX, 0, &entry, &cls)) {
+#ifdef CONFIG_LANTERN_TX_BATCH
+        if (EXT_FRAME_HEADER_SIZE + tx_entry_size(&entry, TX_BATCH_ENTRY_HEADER) <= sizeof(tx_batch)) {
+            tx_send_batch(send, &entry, cls);
+            continue;
+        }
+#endif
+        int result = send(entry.buffer, entry.len);
+        metrics_count(METRIC_TX_SENDS);
+        if (result >= 0 && entry.follow) {
+            result = send(entry.follow, entry.follow_len);
+            metrics_count(METRIC_TX_SENDS);
+        }
+
+        tx_done(&entry, cls, result >= 0, esp_timer_get_time());
+    }
+}
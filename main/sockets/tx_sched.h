@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Outbound message scheduler. Messages wait in one queue per priority class
+// and the sockets task drains them highest class first, so a coredump upload
+// never sits in front of a touch event. A message with a coalesce key replaces
+// a still-pending message with the same key queued within the coalesce window
+// instead of being sent again. With CONFIG_LANTERN_TX_BATCH, runs of small
+// messages are packed into one EXT_FRAME_BATCH frame per send.
+//
+// Per class, the time from queued to handed to the websocket client, the
+// peak depth and the coalesced and dropped messages go to the metrics
+// registry, see METRIC_TX_* in metrics.h.
+
+typedef enum tx_class_t {
+    TX_INTERACTIVE = 0, // user-visible events, e.g. touches
+    TX_CONTROL,         // protocol traffic and replies
+    TX_BULK,            // uploads
+    TX_CLASSES,
+} tx_class_t;
+
+typedef enum tx_key_t {
+    TX_KEY_NONE = 0,    // never coalesced
+    TX_KEY_TOUCH,
+    TX_KEY_STREAM_STATS,
+} tx_key_t;
+
+#define TX_SCHED_DEPTH 8
+#define TX_SCHED_COALESCE_MS 50
+
+// Returns the bytes written, or < 0 on failure
+typedef int (*tx_send_fn_t)(const uint8_t* data, size_t len);
+
+void tx_sched_init();
+// Takes ownership of a heap buffer; it is freed once sent, coalesced or dropped
+bool tx_sched_push(tx_class_t cls, tx_key_t key, uint8_t* buffer, size_t len);
+// Same for a message and one that must follow it, e.g. a TouchEvent and its
+// gesture frame. The two are sent back to back, and coalesced or dropped
+// together, so they never describe different touches.
+bool tx_sched_push_pair(tx_class_t cls, tx_key_t key, uint8_t* buffer, size_t len, uint8_t* follow, size_t follow_len);
+bool tx_sched_pending();
+// Sends everything queued, highest class first
+void tx_sched_drain(tx_send_fn_t send);
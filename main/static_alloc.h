@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_attr.h"
+
+// Storage for the firmware's long-lived tasks and queues. With
+// CONFIG_LANTERN_STATIC_ALLOC it is a static buffer: the RAM shows up in the
+// link map instead of the heap, and creating the task or queue cannot fail
+// at runtime. Without it the storage is empty and the kernel allocates from
+// the heap as usual. Declare one storage per task/queue at file scope.
+//
+// A task may end, but its storage is not reused for another; work that comes
+// and goes waits for a notification in one persistent task instead. Big static buffers are
+// declared EXT_RAM_BSS_ATTR where they live so they go to PSRAM .bss.
+
+template <size_t STACK_SIZE>
+struct task_storage_t {
+#ifdef CONFIG_LANTERN_STATIC_ALLOC
+    StackType_t stack[STACK_SIZE];  // bytes on ESP-IDF
+    StaticTask_t tcb;
+#endif
+};
+
+template <size_t STACK_SIZE>
+TaskHandle_t task_create(task_storage_t<STACK_SIZE>* storage, TaskFunction_t fn, const char* name, void* arg,
+    UBaseType_t priority, BaseType_t core = tskNO_AFFINITY) {
+#ifdef CONFIG_LANTERN_STATIC_ALLOC
+    return xTaskCreateStaticPinnedToCore(fn, name, STACK_SIZE, arg, priority, storage->stack, &storage->tcb, core);
+#else
+    TaskHandle_t handle = NULL;
+    xTaskCreatePinnedToCore(fn, name, STACK_SIZE, arg, priority, &handle, core);
+    return handle;
+#endif
+}
+
+template <typename T, size_t LENGTH>
+struct queue_storage_t {
+#ifdef CONFIG_LANTERN_STATIC_ALLOC
+    uint8_t items[LENGTH * sizeof(T)];
+    StaticQueue_t queue;
+#endif
+};
+
+template <typename T, size_t LENGTH>
+QueueHandle_t queue_create(queue_storage_t<T, LENGTH>* storage) {
+#ifdef CONFIG_LANTERN_STATIC_ALLOC
+    return xQueueCreateStatic(LENGTH, sizeof(T), storage->items, &storage->queue);
+#else
+    return xQueueCreate(LENGTH, sizeof(T));
+#endif
+}
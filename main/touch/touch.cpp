@@ -0,0 +1,164 @@
+#include "touch.h"
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/touch_pad.h"
+
+#include "sockets.h"
+#include "metrics.h"
+#include "touch_feedback.h"
+#include "pinout.h"
+#include "static_alloc.h"
+
+static const char* TAG = "touch";
+
+#define TOUCH_PAD ((touch_pad_t)TOUCH_PIN)
+#define TOUCH_INTERRUPTS (TOUCH_PAD_INTR_MASK_ACTIVE | TOUCH_PAD_INTR_MASK_INACTIVE)
+// a press seen this long after the last interrupt was found by polling
+#define TOUCH_DETECT_WINDOW_US 100000
+
+static TaskHandle_t touch_task_handle = NULL;
+static task_storage_t<CONFIG_LANTERN_TOUCH_TASK_STACK> touch_task_storage;
+static touch_filter_t touch_filter;
+static volatile int64_t touch_active_us = 0;
+
+// from TOUCH_GESTURE_TAP on
+static const metric_counter_t touch_gesture_metric[TOUCH_GESTURES - 1] = {
+    METRIC_TOUCH_TAPS, METRIC_TOUCH_DOUBLE_TAPS, METRIC_TOUCH_LONG_PRESSES,
+};
+
+static void IRAM_ATTR touch_isr(void* arg) {
+    uint32_t status = touch_pad_read_intr_status_mask();
+    if (status & TOUCH_PAD_INTR_MASK_ACTIVE) {
+        touch_active_us = esp_timer_get_time();
+    }
+    metrics_count(METRIC_TOUCH_INTERRUPTS);
+
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(touch_task_handle, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static void touch_task(void* pvParameter) {
+    uint32_t threshold = 0;
+    uint32_t rejected = touch_filter.rejected;
+    uint32_t recalibrations = touch_filter.recalibrations;
+
+    while (1) {
+        uint32_t period = touch_filter_busy(&touch_filter) ? TOUCH_ACTIVE_PERIOD_MS : TOUCH_IDLE_PERIOD_MS;
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(period));
+
+        uint32_t raw = 0;
+        touch_pad_read_raw_data(TOUCH_PAD, &raw);
+        int64_t now_us = esp_timer_get_time();
+        uint32_t now_ms = now_us / 1000;
+
+        bool was_pressed = touch_filter.pressed;
+        touch_filter_state_t was_state = touch_filter.state;
+        touch_gesture_t gesture = touch_filter_update(&touch_filter, now_ms, raw);
+
+        // show the local reaction before anything else
+        if (was_state == TOUCH_FILTER_IDLE && touch_filter.state == TOUCH_FILTER_PRESSED) {
+            touch_feedback_press();
+        }
+#ifdef CONFIG_LANTERN_TOUCH_TRACE
+        // replay with host/bench/touch_filter_bench
+        ESP_LOGI(TAG, "trace %lu %lu", (unsigned long)now_ms, (unsigned long)raw);
+#endif
+
+        if (touch_filter.pressed && !was_pressed) {
+            metrics_count(METRIC_TOUCH_PRESSES);
+            int64_t edge_us = touch_active_us;
+            if (edge_us && now_us - edge_us < TOUCH_DETECT_WINDOW_US) {
+                metrics_record(METRIC_TOUCH_DETECT_US, (uint32_t)(now_us - edge_us));
+            }
+        }
+        if (gesture != TOUCH_GESTURE_NONE) {
+            metrics_count(touch_gesture_metric[gesture - TOUCH_GESTURE_TAP]);
+            metrics_record(METRIC_TOUCH_GESTURE_MS, now_ms - touch_filter.gesture_ms);
+        }
+        // the filter keeps totals; the registry takes what they moved by
+        metrics_count(METRIC_TOUCH_REJECTED, touch_filter.rejected - rejected);
+        metrics_count(METRIC_TOUCH_RECALIBRATIONS, touch_filter.recalibrations - recalibrations);
+        rejected = touch_filter.rejected;
+        recalibrations = touch_filter.recalibrations;
+        metrics_gauge_set(METRIC_TOUCH_BASELINE, touch_filter_baseline(&touch_filter));
+        metrics_gauge_set(METRIC_TOUCH_THRESHOLD, touch_filter_press_delta(&touch_filter));
+
+        if (gesture != TOUCH_GESTURE_NONE) {
+            ESP_LOGI(TAG, "%s", touch_gesture_name(gesture));
+            notify_touch(gesture);
+            touch_feedback_sent();
+        }
+        else if (was_state != TOUCH_FILTER_IDLE && touch_filter.state == TOUCH_FILTER_IDLE) {
+            touch_feedback_cancel();
+        }
+
+        // keep the hardware's interrupt threshold with the baseline
+        uint32_t delta = touch_filter_press_delta(&touch_filter);
+        if (delta != threshold && delta > 0) {
+            touch_pad_set_thresh(TOUCH_PAD, delta);
+            threshold = delta;
+        }
+    }
+}
+
+void touch_init() {
+    touch_pad_init();
+    touch_pad_config(TOUCH_PAD);
+
+    touch_pad_set_measurement_interval(TOUCH_PAD_SLEEP_CYCLE_DEFAULT);
+    touch_pad_set_charge_discharge_times(TOUCH_PAD_MEASURE_CYCLE_DEFAULT);
+    touch_pad_set_voltage(TOUCH_PAD_HIGH_VOLTAGE_THRESHOLD, TOUCH_PAD_LOW_VOLTAGE_THRESHOLD, TOUCH_PAD_ATTEN_VOLTAGE_THRESHOLD);
+    touch_pad_set_idle_channel_connect(TOUCH_PAD_IDLE_CH_CONNECT_DEFAULT);
+    touch_pad_set_cnt_mode(TOUCH_PAD, TOUCH_PAD_SLOPE_DEFAULT, TOUCH_PAD_TIE_OPT_DEFAULT);
+
+    /* Denoise setting at TouchSensor 0. */
+    touch_pad_denoise_t denoise = {
+        /* The bits to be cancelled are determined according to the noise level. */
+        .grade = TOUCH_PAD_DENOISE_BIT4,
+        .cap_level = TOUCH_PAD_DENOISE_CAP_L4,
+    };
+    touch_pad_denoise_set_config(&denoise);
+    touch_pad_denoise_enable();
+
+    // The interrupt threshold is relative to the hardware's own benchmark,
+    // which needs its filter running
+    touch_filter_config_t filter = {
+        .mode = TOUCH_PAD_FILTER_IIR_16,
+        .debounce_cnt = 1,
+        .noise_thr = 0,
+        .jitter_step = 4,
+        .smh_lvl = TOUCH_PAD_SMOOTH_IIR_2,
+    };
+    touch_pad_filter_set_config(&filter);
+    touch_pad_filter_enable();
+
+    /* Enable touch sensor clock. Work mode is "timer trigger". */
+    touch_pad_set_fsm_mode(TOUCH_FSM_MODE_TIMER);
+    touch_pad_fsm_start();
+
+    touch_filter_settings_t settings = TOUCH_FILTER_SETTINGS_DEFAULT;
+    settings.press_permille = CONFIG_LANTERN_TOUCH_PRESS_PERMILLE;
+    settings.release_permille = CONFIG_LANTERN_TOUCH_RELEASE_PERMILLE;
+    settings.double_tap_ms = CONFIG_LANTERN_TOUCH_DOUBLE_TAP_MS;
+    settings.long_press_ms = CONFIG_LANTERN_TOUCH_LONG_PRESS_MS;
+    touch_filter_init(&touch_filter, &settings);
+    touch_feedback_init();
+
+    // one measurement to start the baseline from
+    vTaskDelay(pdMS_TO_TICKS(50));
+    uint32_t raw = 0;
+    touch_pad_read_raw_data(TOUCH_PAD, &raw);
+    touch_filter_update(&touch_filter, esp_timer_get_time() / 1000, raw);
+    touch_pad_set_thresh(TOUCH_PAD, touch_filter_press_delta(&touch_filter));
+
+    touch_task_handle = task_create(&touch_task_storage, touch_task, "touch", NULL, 6);
+
+    touch_pad_isr_register(touch_isr, NULL, (touch_pad_intr_mask_t)TOUCH_INTERRUPTS);
+    touch_pad_intr_enable((touch_pad_intr_mask_t)TOUCH_INTERRUPTS);
+}
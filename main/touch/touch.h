@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "touch_filter.h"
+
+// Touch pad driver. The touch peripheral measures on its own timer and raises
+// an interrupt when the reading crosses the press threshold (programmed from
+// the filter's baseline) or drops back; the touch task wakes on that, samples
+// every TOUCH_ACTIVE_PERIOD_MS while a gesture is in progress and only every
+// TOUCH_IDLE_PERIOD_MS otherwise, to keep the baseline current. Gestures are
+// forwarded with notify_touch().
+//
+// Interrupts, presses, rejects, recalibrations and gestures are counted, and
+// the baseline and threshold sampled, in the metrics registry, along with the
+// interrupt-to-press and press-to-gesture latencies (METRIC_TOUCH_*).
+
+#define TOUCH_ACTIVE_PERIOD_MS 10
+#define TOUCH_IDLE_PERIOD_MS 200
+
+void touch_init();
@@ -0,0 +1,227 @@
+#include "touch_feedback.h"
+
+#include <string.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "metrics.h"
+
+static const char* TAG = "touch_feedback";
+
+#define TOUCH_FEEDBACK_PULSE_MS 300
+// quick enough to read as a direct reaction, slow enough not to flash
+#define TOUCH_FEEDBACK_TRANSITION_MS 80
+
+typedef enum feedback_phase_t {
+    FEEDBACK_IDLE = 0,
+    FEEDBACK_PRESSED,   // shown, gesture not classified yet
+    FEEDBACK_SENT,      // TouchEvent queued, waiting for the server
+} feedback_phase_t;
+
+static portMUX_TYPE feedback_lock = portMUX_INITIALIZER_UNLOCKED;
+static feedback_phase_t feedback_phase = FEEDBACK_IDLE;
+static int64_t feedback_sent_us;
+static int64_t feedback_deadline_us;
+static esp_timer_handle_t feedback_timer = NULL;
+
+#ifdef CONFIG_LANTERN_TOUCH_FEEDBACK_TOGGLE
+static led_state_t feedback_before;
+static led_state_t feedback_predicted;
+// what the server last turned the lantern on with, the prediction for turning it on
+static led_state_t feedback_last_on;
+static bool feedback_have_last_on = false;
+#endif
+
+static void arm_timeout() {
+    feedback_deadline_us = esp_timer_get_time() + CONFIG_LANTERN_TOUCH_FEEDBACK_TIMEOUT_MS * 1000LL;
+    esp_timer_stop(feedback_timer);
+    esp_timer_start_once(feedback_timer, CONFIG_LANTERN_TOUCH_FEEDBACK_TIMEOUT_MS * 1000LL);
+}
+
+// Ends the pending prediction; call with feedback_lock held
+static void settle(bool hit) {
+    metrics_count(hit ? METRIC_TOUCH_HITS : METRIC_TOUCH_MISSES);
+    if (feedback_phase == FEEDBACK_SENT) {
+        metrics_record(METRIC_TOUCH_CONFIRM_MS, (uint32_t)((esp_timer_get_time() - feedback_sent_us) / 1000));
+    }
+    feedback_phase = FEEDBACK_IDLE;
+}
+
+static void rollback() {
+#ifdef CONFIG_LANTERN_TOUCH_FEEDBACK_TOGGLE
+    led_state_t state = feedback_before;
+    state.transition_ms = CONFIG_LANTERN_LED_TRANSITION_MS;
+    led_apply_state(&state);
+#endif
+}
+
+static void feedback_timeout_cb(void* arg) {
+    bool expired = false;
+    taskENTER_CRITICAL(&feedback_lock);
+    // a stale expiry from an earlier prediction is ignored
+    if (feedback_phase != FEEDBACK_IDLE && esp_timer_get_time() >= feedback_deadline_us) {
+        feedback_phase = FEEDBACK_IDLE;
+        metrics_count(METRIC_TOUCH_TIMEOUTS);
+        expired = true;
+    }
+    taskEXIT_CRITICAL(&feedback_lock);
+
+    if (expired) {
+        ESP_LOGW(TAG, "no answer to touch, rolling back");
+        rollback();
+    }
+}
+
+void touch_feedback_init() {
+    esp_timer_create_args_t timer_args = {
+        .callback = feedback_timeout_cb,
+        .name = "touch_feedback",
+    };
+    esp_timer_create(&timer_args, &feedback_timer);
+}
+
+void touch_feedback_press() {
+#if CONFIG_LANTERN_TOUCH_FEEDBACK_PULSE || CONFIG_LANTERN_TOUCH_FEEDBACK_TOGGLE
+#ifdef CONFIG_LANTERN_TOUCH_FEEDBACK_TOGGLE
+    led_state_t before;
+    led_get_state(&before);
+    // programs and streams are the server's to change
+    if (before.effect == LED_PROGRAM || before.effect == LED_STREAM) {
+        return;
+    }
+#endif
+
+    taskENTER_CRITICAL(&feedback_lock);
+    if (feedback_phase != FEEDBACK_IDLE) {
+        taskEXIT_CRITICAL(&feedback_lock);
+        return;
+    }
+    feedback_phase = FEEDBACK_PRESSED;
+    metrics_count(METRIC_TOUCH_PREDICTIONS);
+
+#ifdef CONFIG_LANTERN_TOUCH_FEEDBACK_TOGGLE
+    led_state_t predicted = before;
+    if (before.effect == LED_OFF || before.brightness == 0) {
+        if (feedback_have_last_on) {
+            predicted = feedback_last_on;
+        }
+        else {
+            led_state_init(&predicted);
+            predicted.effect = LED_SOLID;
+            memset(predicted.color, 255, sizeof(predicted.color));
+        }
+    }
+    else {
+        predicted.effect = LED_OFF;
+    }
+    predicted.transition_ms = TOUCH_FEEDBACK_TRANSITION_MS;
+    feedback_before = before;
+    feedback_predicted = predicted;
+#endif
+    taskEXIT_CRITICAL(&feedback_lock);
+
+    arm_timeout();
+#ifdef CONFIG_LANTERN_TOUCH_FEEDBACK_TOGGLE
+    led_apply_state(&predicted);
+#else
+    led_pulse(TOUCH_FEEDBACK_PULSE_MS);
+#endif
+#endif
+}
+
+void touch_feedback_cancel() {
+    bool cancelled = false;
+    taskENTER_CRITICAL(&feedback_lock);
+    if (feedback_phase == FEEDBACK_PRESSED) {
+        feedback_phase = FEEDBACK_IDLE;
+        metrics_count(METRIC_TOUCH_CANCELLED);
+        cancelled = true;
+    }
+    taskEXIT_CRITICAL(&feedback_lock);
+
+    if (cancelled) {
+        esp_timer_stop(feedback_timer);
+        rollback();
+    }
+}
+
+void touch_feedback_sent() {
+    bool sent = false;
+    taskENTER_CRITICAL(&feedback_lock);
+    if (feedback_phase == FEEDBACK_PRESSED) {
+        feedback_phase = FEEDBACK_SENT;
+        feedback_sent_us = esp_timer_get_time();
+        sent = true;
+    }
+    taskEXIT_CRITICAL(&feedback_lock);
+
+    // the server gets the full timeout from the moment it could know
+    if (sent) {
+        arm_timeout();
+    }
+}
+
+// Whether the server's state is what the prediction showed
+static bool matches(const led_state_t* a, const led_state_t* b) {
+    if (a->effect != b->effect) {
+        return false;
+    }
+    return a->effect == LED_OFF || (a->brightness == b->brightness && memcmp(a->color, b->color, sizeof(a->color)) == 0);
+}
+
+void touch_feedback_set_color(const led_state_t* state) {
+    bool settled = false;
+    bool hit = false;
+    taskENTER_CRITICAL(&feedback_lock);
+#ifdef CONFIG_LANTERN_TOUCH_FEEDBACK_TOGGLE
+    if (state->effect != LED_OFF && state->brightness != 0) {
+        feedback_last_on = *state;
+        feedback_have_last_on = true;
+    }
+    hit = matches(state, &feedback_predicted);
+#else
+    hit = true;
+#endif
+    if (feedback_phase != FEEDBACK_IDLE) {
+        settle(hit);
+        settled = true;
+    }
+    taskEXIT_CRITICAL(&feedback_lock);
+
+    if (settled) {
+        esp_timer_stop(feedback_timer);
+        if (!hit) {
+            ESP_LOGI(TAG, "touch prediction missed, taking the server's state");
+        }
+    }
+    // on a hit this is what is already showing and no crossfade starts
+    led_apply_state(state);
+}
+
+void touch_feedback_response(bool success) {
+    bool settled = false;
+    taskENTER_CRITICAL(&feedback_lock);
+    if (feedback_phase != FEEDBACK_IDLE) {
+#ifdef CONFIG_LANTERN_TOUCH_FEEDBACK_TOGGLE
+        // a success only says the touch arrived; the SetColor that follows decides
+        if (!success) {
+            settle(false);
+            settled = true;
+        }
+#else
+        settle(success);
+        settled = true;
+#endif
+    }
+    taskEXIT_CRITICAL(&feedback_lock);
+
+    if (settled) {
+        esp_timer_stop(feedback_timer);
+        if (!success) {
+            ESP_LOGI(TAG, "server refused the touch, rolling back");
+            rollback();
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "led.h"
+
+// Local reaction to a touch, shown as soon as the press is seen instead of
+// after the server round trip, then reconciled with the server's answer.
+//
+// CONFIG_LANTERN_TOUCH_FEEDBACK_PULSE flashes a pulse over whatever is
+// playing. It predicts only that the server accepts the touch: a
+// TouchEventResponse with success or a SetColor is a hit.
+//
+// CONFIG_LANTERN_TOUCH_FEEDBACK_TOGGLE switches the lantern to the state the
+// server is expected to send: off if it is on, else the last color the server
+// set. A SetColor for the same effect and color is a hit; any other SetColor
+// is a miss and simply takes over, crossfading from the prediction. A failed
+// TouchEventResponse, or no SetColor within
+// CONFIG_LANTERN_TOUCH_FEEDBACK_TIMEOUT_MS, rolls back to the state from
+// before the touch.
+//
+// One prediction is outstanding at a time; touches while one is pending are
+// sent as usual but not predicted.
+//
+// Predictions and how they ended, and the time from sending the touch to the
+// server's answer, go to the metrics registry (METRIC_TOUCH_PREDICTIONS and
+// after, METRIC_TOUCH_CONFIRM_MS) for tuning the timeout and the prediction.
+
+void touch_feedback_init();
+
+// From the touch task: the first press of a gesture was seen
+void touch_feedback_press();
+// From the touch task: the press ended without a gesture
+void touch_feedback_cancel();
+// From the touch task: the gesture's TouchEvent was queued
+void touch_feedback_sent();
+
+// From the sockets task: authoritative state from a SetColor, applied here
+void touch_feedback_set_color(const led_state_t* state);
+void touch_feedback_response(bool success);
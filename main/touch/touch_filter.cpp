@@ -0,0 +1,138 @@
+#include "touch_filter.h"
+
+#include <string.h>
+
+void touch_filter_init(touch_filter_t* filter, const touch_filter_settings_t* settings) {
+    memset(filter, 0, sizeof(*filter));
+    filter->settings = *settings;
+}
+
+static void update_baseline(touch_filter_t* filter, uint32_t raw, uint32_t release_at) {
+    uint32_t target = raw << 8;
+    uint8_t shift = filter->settings.baseline_shift;
+
+    if (target < filter->baseline_q8) {
+        // readings only drop below the baseline when it is stale, follow faster
+        filter->baseline_q8 -= (filter->baseline_q8 - target) >> (shift > 2 ? shift - 2 : 0);
+    }
+    else if (raw < release_at) {
+        // above that a finger may be approaching, leave the baseline alone
+        filter->baseline_q8 += (target - filter->baseline_q8) >> shift;
+    }
+}
+
+touch_gesture_t touch_filter_update(touch_filter_t* filter, uint32_t now_ms, uint32_t raw) {
+    const touch_filter_settings_t* c = &filter->settings;
+    if (filter->baseline_q8 == 0) {
+        filter->baseline_q8 = raw << 8;
+    }
+
+    uint32_t base = filter->baseline_q8 >> 8;
+    uint32_t press_at = base + base * c->press_permille / 1000;
+    uint32_t release_at = base + base * c->release_permille / 1000;
+
+    bool was_pressed = filter->pressed;
+    if (!filter->pressed && raw > press_at) {
+        filter->pressed = true;
+        filter->press_ms = now_ms;
+    }
+    else if (filter->pressed && raw < release_at) {
+        filter->pressed = false;
+    }
+
+    if (!filter->pressed) {
+        update_baseline(filter, raw, release_at);
+    }
+    else if (now_ms - filter->press_ms >= c->stuck_ms) {
+        filter->baseline_q8 = raw << 8;
+        filter->pressed = false;
+        filter->state = TOUCH_FILTER_IDLE;
+        filter->recalibrations++;
+        return TOUCH_GESTURE_NONE;
+    }
+
+    bool pressed_now = filter->pressed && !was_pressed;
+    touch_gesture_t gesture = TOUCH_GESTURE_NONE;
+
+    switch (filter->state) {
+    case TOUCH_FILTER_IDLE:
+        if (pressed_now) {
+            filter->state = TOUCH_FILTER_PRESSED;
+            filter->gesture_ms = filter->press_ms;
+        }
+        break;
+    case TOUCH_FILTER_PRESSED:
+        if (!filter->pressed) {
+            if (now_ms - filter->press_ms < c->min_press_ms) {
+                filter->rejected++;
+                filter->state = TOUCH_FILTER_IDLE;
+            }
+            else {
+                filter->release_ms = now_ms;
+                filter->state = TOUCH_FILTER_TAP_PENDING;
+            }
+        }
+        else if (now_ms - filter->press_ms >= c->long_press_ms) {
+            gesture = TOUCH_GESTURE_LONG_PRESS;
+            filter->state = TOUCH_FILTER_LONG_HELD;
+        }
+        break;
+    case TOUCH_FILTER_TAP_PENDING:
+        if (pressed_now) {
+            filter->state = TOUCH_FILTER_SECOND_PRESS;
+        }
+        else if (now_ms - filter->release_ms >= c->double_tap_ms) {
+            gesture = TOUCH_GESTURE_TAP;
+            filter->state = TOUCH_FILTER_IDLE;
+        }
+        break;
+    case TOUCH_FILTER_SECOND_PRESS:
+        if (!filter->pressed) {
+            if (now_ms - filter->press_ms < c->min_press_ms) {
+                // noise, still waiting for a second press
+                filter->rejected++;
+                filter->state = TOUCH_FILTER_TAP_PENDING;
+            }
+            else {
+                gesture = TOUCH_GESTURE_DOUBLE_TAP;
+                filter->state = TOUCH_FILTER_IDLE;
+            }
+        }
+        else if (now_ms - filter->press_ms >= c->long_press_ms) {
+            // the first press was a tap; this one goes on as a long press,
+            // reported on the next sample
+            gesture = TOUCH_GESTURE_TAP;
+            filter->gesture_ms = filter->press_ms;
+            filter->state = TOUCH_FILTER_PRESSED;
+        }
+        break;
+    case TOUCH_FILTER_LONG_HELD:
+        if (!filter->pressed) {
+            filter->state = TOUCH_FILTER_IDLE;
+        }
+        break;
+    }
+
+    return gesture;
+}
+
+bool touch_filter_busy(const touch_filter_t* filter) {
+    return filter->pressed || filter->state != TOUCH_FILTER_IDLE;
+}
+
+uint32_t touch_filter_baseline(const touch_filter_t* filter) {
+    return filter->baseline_q8 >> 8;
+}
+
+uint32_t touch_filter_press_delta(const touch_filter_t* filter) {
+    return touch_filter_baseline(filter) * filter->settings.press_permille / 1000;
+}
+
+const char* touch_gesture_name(touch_gesture_t gesture) {
+    switch (gesture) {
+    case TOUCH_GESTURE_TAP: return "tap";
+    case TOUCH_GESTURE_DOUBLE_TAP: return "double_tap";
+    case TOUCH_GESTURE_LONG_PRESS: return "long_press";
+    default: return "none";
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+// Touch decisions from raw touch sensor readings. The baseline is an IIR
+// average of the untouched reading, so slow drift from humidity, temperature
+// or the enclosure moves the thresholds with it. A press starts when the
+// reading rises press_permille above the baseline and ends when it falls
+// below release_permille (hysteresis), and presses are classified into
+// gestures by their timing.
+//
+// A tap is only reported once double_tap_ms has passed without a second
+// press. A press held past long_press_ms is a long press, reported while it is
+// still held. A reading that stays up for stuck_ms is taken as the new
+// baseline, e.g. after water on the enclosure.
+//
+// Pure and clock-agnostic: feed it samples with their time. No FreeRTOS
+// dependencies, builds on the host and replays recorded traces.
+
+typedef enum touch_gesture_t {
+    TOUCH_GESTURE_NONE = 0,
+    TOUCH_GESTURE_TAP,
+    TOUCH_GESTURE_DOUBLE_TAP,
+    TOUCH_GESTURE_LONG_PRESS,
+    TOUCH_GESTURES,
+} touch_gesture_t;
+
+typedef struct touch_filter_settings_t {
+    uint16_t press_permille;
+    uint16_t release_permille;
+    uint16_t min_press_ms;      // shorter presses are noise
+    uint16_t double_tap_ms;     // release to second press
+    uint16_t long_press_ms;
+    uint16_t stuck_ms;
+    uint8_t baseline_shift;     // IIR weight 1/2^shift per sample
+} touch_filter_settings_t;
+
+#define TOUCH_FILTER_SETTINGS_DEFAULT { \
+    .press_permille = 80, \
+    .release_permille = 40, \
+    .min_press_ms = 20, \
+    .double_tap_ms = 300, \
+    .long_press_ms = 600, \
+    .stuck_ms = 10000, \
+    .baseline_shift = 4, \
+}
+
+typedef enum touch_filter_state_t {
+    TOUCH_FILTER_IDLE = 0,
+    TOUCH_FILTER_PRESSED,       // first press of a gesture
+    TOUCH_FILTER_TAP_PENDING,   // released, waiting for a second press
+    TOUCH_FILTER_SECOND_PRESS,
+    TOUCH_FILTER_LONG_HELD,     // long press reported, waiting for release
+} touch_filter_state_t;
+
+typedef struct touch_filter_t {
+    touch_filter_settings_t settings;
+    uint32_t baseline_q8;       // 0 until the first sample
+    bool pressed;
+    touch_filter_state_t state;
+    uint32_t press_ms;          // start of the current press
+    uint32_t release_ms;
+    uint32_t gesture_ms;        // start of the first press of the gesture
+    uint32_t rejected;          // presses shorter than min_press_ms
+    uint32_t recalibrations;    // stuck readings taken as the baseline
+} touch_filter_t;
+
+void touch_filter_init(touch_filter_t* filter, const touch_filter_settings_t* settings);
+// Feeds one reading; returns a completed gesture, if any. Gestures that wait
+// on time (tap, long press) also complete from later samples, so keep feeding
+// while touch_filter_busy().
+touch_gesture_t touch_filter_update(touch_filter_t* filter, uint32_t now_ms, uint32_t raw);
+bool touch_filter_busy(const touch_filter_t* filter);
+uint32_t touch_filter_baseline(const touch_filter_t* filter);
+// Press threshold above the baseline, in raw units
+uint32_t touch_filter_press_delta(const touch_filter_t* filter);
+
+const char* touch_gesture_name(touch_gesture_t gesture);
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""Receives a core dump from a devel lantern the way the device API would.
+
+Acks EXT_FRAME_COREDUMP_CHUNK frames as they arrive, decompressing their
+heatshrink-format data (see main/sockets/lz_compress.h), checks the digest in
+EXT_FRAME_COREDUMP_DONE and writes the image to <dir>/<upload_id>.bin before
+answering COREDUMP_ACK_STORED, which makes the lantern erase its copy.
+Partial uploads are kept per upload_id, so a lantern that drops off halfway
+resumes where it stopped. --drop and --disconnect-after exercise that path.
+
+  tools/standin/coredump_server.py --dir dumps/
+  espcoredump.py info_corefile -c dumps/<id>.bin -t raw build/lantern.elf
+"""
+
+import argparse
+import asyncio
+import hashlib
+import os
+import random
+import struct
+
+import ws
+
+ACK_PROGRESS = 0
+ACK_STORED = 1
+ACK_REJECTED = 2
+ACK_RESUME = 3
+
+CHUNK_LZ = 1 << 0
+
+LZ_WINDOW_BITS = 10
+LZ_LOOKAHEAD_BITS = 5
+
+uploads = {}
+received = {}
+
+
+def lz_decode(data, out):
+    """Appends one flushed segment to out, which holds the image so far and so
+    the window. Leftover padding bits never make a whole token."""
+    bits = int.from_bytes(data, "big")
+    left = len(data) * 8
+
+    def get(n):
+        nonlocal left
+        if left < n:
+            raise EOFError
+        left -= n
+        return (bits >> left) & ((1 << n) - 1)
+
+    try:
+        while True:
+            if get(1):
+                out.append(get(8))
+                continue
+            v = get(LZ_WINDOW_BITS + LZ_LOOKAHEAD_BITS)
+            distance = (v >> LZ_LOOKAHEAD_BITS) + 1
+            for _ in range((v & ((1 << LZ_LOOKAHEAD_BITS) - 1)) + 1):
+                out.append(out[-distance])
+    except EOFError:
+        pass
+
+
+def ack(upload_id, offset, status):
+    return bytes([ws.EXT_FRAME_MARKER, ws.EXT_FRAME_COREDUMP_ACK]) + struct.pack("<IIB", upload_id, offset, status)
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=9091)
+    parser.add_argument("--dir", default=".", help="where finished images are written")
+    parser.add_argument("--drop", type=float, default=0, help="probability of ignoring a chunk")
+    parser.add_argument("--disconnect-after", type=int, default=0, help="close after this many chunks, once")
+    args = parser.parse_args()
+    os.makedirs(args.dir, exist_ok=True)
+    disconnect_after = args.disconnect_after
+
+    async def handler(conn):
+        nonlocal disconnect_after
+        print(f"lantern connected from {conn.peer[0]} ({conn.headers.get('x-common-name', '?')})")
+        chunks = 0
+        while True:
+            opcode, frame = await conn.recv()
+            for data in ws.unbatch(frame):
+                if len(data) < 2 or data[0] != ws.EXT_FRAME_MARKER:
+                    continue
+
+                if data[1] == ws.EXT_FRAME_COREDUMP_CHUNK:
+                    upload_id, offset, total = struct.unpack_from("<III", data, 2)
+                    image = uploads.setdefault(upload_id, bytearray())
+                    if random.random() < args.drop:
+                        continue
+                    if offset != len(image):
+                        await conn.send(ack(upload_id, len(image), ACK_RESUME))
+                        continue
+                    flags = data[14]
+                    if flags & CHUNK_LZ:
+                        lz_decode(data[15:], image)
+                    else:
+                        image += data[15:]
+                    wire = received.get(upload_id, 0) + len(data) - 15
+                    received[upload_id] = wire
+                    print(f"{upload_id:08x}: {len(image)}/{total}, {wire} bytes on the wire")
+                    await conn.send(ack(upload_id, len(image), ACK_PROGRESS))
+
+                    chunks += 1
+                    if disconnect_after and chunks >= disconnect_after:
+                        disconnect_after = 0
+                        print("disconnecting")
+                        await conn.close()
+                        return
+
+                elif data[1] == ws.EXT_FRAME_COREDUMP_DONE:
+                    upload_id, total = struct.unpack_from("<II", data, 2)
+                    digest = data[10:42]
+                    project, version, variant = data[42:].split(b"\0")[:3]
+                    image = uploads.get(upload_id, bytearray())
+                    if len(image) != total:
+                        await conn.send(ack(upload_id, len(image), ACK_RESUME))
+                        continue
+                    if hashlib.sha256(image).digest() != digest:
+                        print(f"{upload_id:08x}: digest mismatch, rejecting")
+                        uploads.pop(upload_id)
+                        await conn.send(ack(upload_id, 0, ACK_REJECTED))
+                        continue
+                    path = os.path.join(args.dir, f"{upload_id:08x}.bin")
+                    with open(path, "wb") as f:
+                        f.write(image)
+                    print(f"{upload_id:08x}: {total} bytes from {project.decode()} {version.decode()} "
+                          f"({variant.decode()}) written to {path}")
+                    uploads.pop(upload_id)
+                    await conn.send(ack(upload_id, total, ACK_STORED))
+
+    await ws.serve(handler, port=args.port)
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
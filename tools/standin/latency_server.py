@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+"""Measures command-to-photon latency of a devel lantern, stage by stage.
+
+Stands in for the device API: accepts the lantern's websocket and, every
+--interval seconds, pings it and then sends an EXT_FRAME_TRACE frame followed
+by a command. The lantern answers with an EXT_FRAME_TRACE_REPORT (see
+main/sockets/latency_trace.h) timing the command through each stage:
+
+  network   half the websocket ping round trip
+  queue     WEBSOCKET_EVENT_DATA to the sockets task taking it off xSocketsQueue
+  decode    to the handler (protobuf unpack, dispatch)
+  apply     to the new LED state being published
+  schedule  to the first frame rendered from it
+  wire      to that frame's RMT transmit being done
+
+The report's timestamps also give a round trip and clock offset the NTP way,
+printed per trace as a cross-check on the ping.
+
+The command is an animation program switching all pixels between two colors,
+or a packed Kd__DeviceAPIMessage given with --command (hex), e.g. a SetColor
+captured from the real server. Histograms are printed at the end.
+
+  tools/standin/latency_server.py --count 200 --interval 0.5
+"""
+
+import argparse
+import asyncio
+import struct
+import time
+
+import ws
+
+STAGES = ("queue", "decode", "apply", "schedule", "wire")
+NOT_REACHED = 0xFFFFFFFF
+
+
+def now_ms():
+    return int(time.monotonic() * 1000) & 0xFFFFFFFF
+
+
+def program(leds, rgb):
+    """One track, one key: every pixel a solid color. See led_program.h."""
+    header = b"LP" + struct.pack("<BBHBB", 1, 1, 1000, 0, 0)
+    track = struct.pack("<BBhBB", 0, leds, 0, 1, 0)
+    key = struct.pack("<HBBBB", 0, *rgb, 0)
+    return bytes([ws.EXT_FRAME_MARKER, ws.EXT_FRAME_ANIMATION_PROGRAM]) + header + track + key
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p))] if values else 0
+
+
+def histogram(name, values_us):
+    if not values_us:
+        print(f"{name}: no samples")
+        return
+    print(f"{name}: n={len(values_us)}  p50 {percentile(values_us, 0.5) / 1000:.2f} ms"
+          f"  p90 {percentile(values_us, 0.9) / 1000:.2f} ms  p99 {percentile(values_us, 0.99) / 1000:.2f} ms"
+          f"  max {max(values_us) / 1000:.2f} ms")
+    # log2 buckets in microseconds, like the firmware's histograms
+    buckets = {}
+    for v in values_us:
+        b = max(0, int(v).bit_length() - 1)
+        buckets[b] = buckets.get(b, 0) + 1
+    peak = max(buckets.values())
+    for b in range(min(buckets), max(buckets) + 1):
+        n = buckets.get(b, 0)
+        print(f"  {1 << b:>8} us  {n:>5}  {'#' * round(40 * n / peak)}")
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=9091)
+    parser.add_argument("--leds", type=int, default=10)
+    parser.add_argument("--count", type=int, default=100, help="traces to take")
+    parser.add_argument("--interval", type=float, default=1, help="seconds between traces")
+    parser.add_argument("--command", help="packed Kd__DeviceAPIMessage to trace instead, hex")
+    args = parser.parse_args()
+
+    samples = {name: [] for name in ("network",) + STAGES + ("total",)}
+    done = asyncio.Event()
+    finished = asyncio.Event()
+
+    async def receive(conn, pending):
+        while True:
+            opcode, frame = await conn.recv()
+            arrived = now_ms()
+            for data in ws.unbatch(frame):
+                if len(data) < 2 or data[0] != ws.EXT_FRAME_MARKER or data[1] != ws.EXT_FRAME_TRACE_REPORT:
+                    continue
+                trace_id, t0, t1, t2 = struct.unpack_from("<4I", data, 2)
+                stages = struct.unpack_from(f"<{len(STAGES)}I", data, 18)
+                rtt_ping = pending.pop(trace_id, None)
+                if rtt_ping is None:
+                    continue
+
+                # NTP: t0/t3 on this host, t1/t2 on the lantern
+                t3 = arrived
+                rtt = ((t3 - t0) - (t2 - t1)) & 0xFFFFFFFF
+                offset = ((t1 - t0) + (t2 - t3)) / 2
+
+                network_us = rtt_ping * 1e6 / 2
+                samples["network"].append(network_us)
+                previous = 0
+                row = [f"{trace_id:>5}", f"{network_us / 1000:>8.2f}"]
+                for name, us in zip(STAGES, stages):
+                    if us == NOT_REACHED:
+                        row.append(f"{'-':>8}")
+                        continue
+                    samples[name].append(us - previous)
+                    row.append(f"{(us - previous) / 1000:>8.2f}")
+                    previous = us
+                samples["total"].append(network_us + previous)
+                row.append(f"{(network_us + previous) / 1000:>8.2f}  rtt {rtt} ms  offset {offset:+.0f} ms")
+                print(" ".join(row))
+                if len(samples["total"]) >= args.count:
+                    done.set()
+
+    async def drive(conn, pending):
+        await asyncio.sleep(1)  # let the lantern join first
+        colors = ((255, 0, 0), (0, 0, 255))
+        for trace_id in range(1, args.count + 1):
+            rtt = await conn.ping()
+            if rtt is None:
+                print("ping timed out")
+                continue
+            pending[trace_id] = rtt
+            await conn.send(bytes([ws.EXT_FRAME_MARKER, ws.EXT_FRAME_TRACE]) + struct.pack("<II", trace_id, now_ms()))
+            if args.command:
+                await conn.send(bytes.fromhex(args.command))
+            else:
+                await conn.send(program(args.leds, colors[trace_id % 2]))
+            await asyncio.sleep(args.interval)
+        await asyncio.sleep(2)
+        done.set()
+
+    async def handler(conn):
+        print(f"lantern connected from {conn.peer[0]} ({conn.headers.get('x-common-name', '?')})")
+        print(f"{'trace':>5} {'network':>8} " + " ".join(f"{name:>8}" for name in STAGES) + f" {'total':>8}  (ms)")
+        pending = {}
+        tasks = [
+            asyncio.create_task(receive(conn, pending)),
+            asyncio.create_task(drive(conn, pending)),
+            asyncio.create_task(done.wait()),
+        ]
+        try:
+            await asyncio.wait(tasks, return_when=asyncio.FIRST_COMPLETED)
+        finally:
+            for task in tasks:
+                task.cancel()
+            finished.set()
+
+    server = asyncio.create_task(ws.serve(handler, port=args.port))
+    await finished.wait()
+    server.cancel()
+    for name, values in samples.items():
+        histogram(name, values)
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
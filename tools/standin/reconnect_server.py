@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+"""Plays a flaky device API to watch how lanterns reconnect.
+
+Stands in for the device API and misbehaves on a schedule, logging every
+websocket handshake a devel lantern makes: when it came, how long after that
+lantern's previous one, and what the server did with it.
+
+  --outage S        reset every connection for S seconds, starting at once,
+                    and drop the lanterns that were connected
+  --every S         repeat the outage every S seconds
+  --slow-accept S   wait S seconds before answering each upgrade
+  --reject P        answer a fraction P of upgrades with HTTP 503
+  --capacity N      take at most N handshakes per second, turn the rest away
+  --hint S          turn handshakes away by accepting them and closing with
+                    1013 and a retry-after of S seconds, which the firmware
+                    honors, instead of the HTTP 503 it cannot read a
+                    Retry-After from
+  --shed S          close accepted connections after S seconds, with the hint
+                    if there is one
+
+A summary per lantern and the busiest second are printed on exit, e.g. to see
+a lantern back off through a two minute outage:
+
+  tools/standin/reconnect_server.py --outage 120 --duration 400
+"""
+
+import argparse
+import asyncio
+import random
+import statistics
+import time
+
+import ws
+
+TRY_AGAIN_LATER = 1013
+
+
+class Lantern:
+    def __init__(self):
+        self.attempts = []      # (seconds since start, outcome)
+        self.connected = None   # the open connection
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=9091)
+    parser.add_argument("--outage", type=float, default=0, help="seconds the server is unreachable")
+    parser.add_argument("--every", type=float, default=0, help="repeat the outage this often (s)")
+    parser.add_argument("--slow-accept", type=float, default=0, help="delay before answering an upgrade (s)")
+    parser.add_argument("--reject", type=float, default=0, help="fraction of upgrades rejected")
+    parser.add_argument("--capacity", type=int, default=0, help="handshakes per second, 0 for no limit")
+    parser.add_argument("--hint", type=int, default=0, help="retry-after (s) to turn lanterns away with")
+    parser.add_argument("--shed", type=float, default=0, help="close connections after this long (s)")
+    parser.add_argument("--duration", type=float, default=0, help="stop after this long (s)")
+    args = parser.parse_args()
+
+    start = time.monotonic()
+    lanterns = {}
+    per_second = {}
+    was_down = False
+
+    def now():
+        return time.monotonic() - start
+
+    def down():
+        if not args.outage:
+            return False
+        t = now() % args.every if args.every else now()
+        return t < args.outage
+
+    def log(name, outcome):
+        lantern = lanterns.setdefault(name, Lantern())
+        t = now()
+        since = f"{t - lantern.attempts[-1][0]:7.1f} s after the last" if lantern.attempts else " " * 24
+        lantern.attempts.append((t, outcome))
+        print(f"{t:8.1f}  {name:<24} {since}  {outcome}")
+
+    async def admit(peer, path, headers):
+        name = headers.get("x-common-name", peer[0])
+        second = int(now())
+        per_second[second] = per_second.get(second, 0) + 1
+
+        if down():
+            log(name, "reset (outage)")
+            return ws.DROP
+        if args.slow_accept:
+            await asyncio.sleep(args.slow_accept)
+        over = args.capacity and per_second[second] > args.capacity
+        if over or random.random() < args.reject:
+            why = "over capacity" if over else "rejected"
+            if args.hint:
+                # answered in the handler with a close
+                log(name, f"{why}, closing with retry-after {args.hint} s")
+                headers["x-standin-turn-away"] = "1"
+                return None
+            log(name, f"{why}, HTTP 503")
+            return ws.Reject(503, headers={"Retry-After": "30"})
+        log(name, "accepted")
+        return None
+
+    async def handler(conn):
+        name = conn.headers.get("x-common-name", conn.peer[0])
+        reason = str(args.hint).encode()
+        if conn.headers.get("x-standin-turn-away"):
+            await conn.close(TRY_AGAIN_LATER, reason)
+            return
+
+        lanterns[name].connected = conn
+        try:
+            receive = asyncio.ensure_future(drain(conn))
+            shed = asyncio.ensure_future(asyncio.sleep(args.shed)) if args.shed else asyncio.get_running_loop().create_future()
+            done, _ = await asyncio.wait([receive, shed], return_when=asyncio.FIRST_COMPLETED)
+            if shed in done:
+                print(f"{now():8.1f}  {name:<24} shedding")
+                await conn.close(TRY_AGAIN_LATER if args.hint else 1001, reason if args.hint else b"")
+            receive.cancel()
+            shed.cancel()
+        finally:
+            lanterns[name].connected = None
+
+    async def drain(conn):
+        try:
+            while True:
+                await conn.recv()
+        except ws.Closed:
+            pass
+
+    async def outages():
+        nonlocal was_down
+        while True:
+            is_down = down()
+            if is_down and not was_down:
+                print(f"{now():8.1f}  --- outage")
+                for lantern in lanterns.values():
+                    if lantern.connected:
+                        lantern.connected.writer.transport.abort()
+            elif was_down and not is_down:
+                print(f"{now():8.1f}  --- back up")
+            was_down = is_down
+            await asyncio.sleep(0.1)
+
+    tasks = [asyncio.create_task(ws.serve(handler, port=args.port, admit=admit)), asyncio.create_task(outages())]
+    try:
+        if args.duration:
+            await asyncio.sleep(args.duration)
+        else:
+            await asyncio.gather(*tasks)
+    finally:
+        for task in tasks:
+            task.cancel()
+        summary(lanterns, per_second)
+
+
+def summary(lanterns, per_second):
+    print()
+    for name, lantern in sorted(lanterns.items()):
+        times = [t for t, _ in lantern.attempts]
+        gaps = [b - a for a, b in zip(times, times[1:])]
+        accepted = sum(1 for _, outcome in lantern.attempts if outcome == "accepted")
+        line = f"{name}: {len(times)} handshakes, {accepted} accepted"
+        if gaps:
+            line += f", gaps min {min(gaps):.1f} s  median {statistics.median(gaps):.1f} s  max {max(gaps):.1f} s"
+        print(line)
+    if per_second:
+        second, n = max(per_second.items(), key=lambda item: item[1])
+        print(f"busiest second: {n} handshakes at {second} s, {sum(per_second.values())} in total")
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
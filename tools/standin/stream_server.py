@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""Replays a realtime pixel stream to a devel lantern and prints its jitter stats.
+
+Stands in for the device API: accepts the lantern's websocket, ignores its
+protobuf traffic and sends EXT_FRAME_PIXEL_STREAM frames stamped with this
+host's clock. While streaming the lantern reports EXT_FRAME_STREAM_STATS once
+a second; the interesting columns are late/underruns (jitter the playout delay
+did not absorb) and err (how far behind its deadline each frame was shown).
+
+Network trouble can be added on purpose with --jitter and --stall to check the
+buffer absorbs what it should.
+
+  tools/standin/stream_server.py                      # generated rainbow chase
+  tools/standin/stream_server.py --file show.txt      # one frame per line, hex rgb
+"""
+
+import argparse
+import asyncio
+import random
+import struct
+import time
+
+import ws
+
+STATS_FIELDS = (
+    "received", "shown", "late", "overflow", "skipped",
+    "underruns", "held", "err_avg_ms", "err_max_ms", "depth_max",
+)
+
+
+def now_ms():
+    return int(time.monotonic() * 1000) & 0xFFFFFFFF
+
+
+def hue(h):
+    h = h % 256
+    region, up = divmod(h * 6, 256)
+    down = 255 - up
+    return [(255, up, 0), (down, 255, 0), (0, 255, up), (0, down, 255), (up, 0, 255), (255, 0, down)][region]
+
+
+def generated(leds):
+    k = 0
+    while True:
+        yield b"".join(bytes(hue(k * 4 + i * 256 // leds)) for i in range(leds))
+        k += 1
+
+
+def from_file(path):
+    with open(path) as f:
+        frames = [bytes.fromhex(line.strip()) for line in f if line.strip()]
+    while True:
+        yield from frames
+
+
+async def stream(conn, frames, args):
+    interval = 1.0 / args.fps
+    next_at = time.monotonic()
+    sent = 0
+    stall_at = time.monotonic() + args.stall_after if args.stall else None
+
+    for pixels in frames:
+        pts = struct.pack("<I", now_ms())
+        next_at += interval
+        sent += 1
+
+        if stall_at and time.monotonic() >= stall_at:
+            # frames keep their timestamps but queue up behind the outage
+            stall_at = None
+            backlog = [pts + pixels]
+            end = time.monotonic() + args.stall / 1000
+            while time.monotonic() < end:
+                await asyncio.sleep(interval)
+                backlog.append(struct.pack("<I", now_ms()) + next(frames))
+            for frame in backlog:
+                await conn.send(bytes([ws.EXT_FRAME_MARKER, ws.EXT_FRAME_PIXEL_STREAM]) + frame)
+            next_at = time.monotonic()
+            continue
+
+        if args.jitter:
+            await asyncio.sleep(random.uniform(0, args.jitter) / 1000)
+        await conn.send(bytes([ws.EXT_FRAME_MARKER, ws.EXT_FRAME_PIXEL_STREAM]) + pts + pixels)
+        await asyncio.sleep(max(0, next_at - time.monotonic()))
+
+
+async def receive(conn):
+    print(" ".join(f"{name:>10}" for name in STATS_FIELDS))
+    while True:
+        opcode, frame = await conn.recv()
+        for data in ws.unbatch(frame):
+            if len(data) >= 2 and data[0] == ws.EXT_FRAME_MARKER and data[1] == ws.EXT_FRAME_STREAM_STATS:
+                values = struct.unpack_from(f"<{len(STATS_FIELDS)}I", data, 2)
+                print(" ".join(f"{v:>10}" for v in values))
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=9091)
+    parser.add_argument("--fps", type=float, default=30)
+    parser.add_argument("--leds", type=int, default=10)
+    parser.add_argument("--file", help="frames to loop, one per line as hex rgb bytes")
+    parser.add_argument("--jitter", type=float, default=0, help="extra random send delay per frame, ms")
+    parser.add_argument("--stall", type=float, default=0, help="hold all frames for this long once, ms")
+    parser.add_argument("--stall-after", type=float, default=10, help="seconds into the stream")
+    args = parser.parse_args()
+
+    async def handler(conn):
+        print(f"lantern connected from {conn.peer[0]} ({conn.headers.get('x-common-name', '?')})")
+        frames = from_file(args.file) if args.file else generated(args.leds)
+        tasks = [asyncio.create_task(stream(conn, frames, args)), asyncio.create_task(receive(conn))]
+        try:
+            await asyncio.wait(tasks, return_when=asyncio.FIRST_EXCEPTION)
+        finally:
+            for task in tasks:
+                task.cancel()
+            print("lantern disconnected")
+
+    await ws.serve(handler, port=args.port)
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+"""Prints the telemetry reports of a devel lantern.
+
+Stands in for the device API: accepts the lantern's websocket, ignores its
+protobuf traffic and decodes the EXT_FRAME_TELEMETRY frames it sends every
+CONFIG_LANTERN_TELEMETRY_INTERVAL_S (main/metrics/telemetry.proto). Counters
+and histograms are shown as deltas against the previous report, which is what
+a fleet dashboard would plot.
+
+  tools/standin/telemetry_server.py
+"""
+
+import argparse
+import asyncio
+
+import ws
+
+# Mirrors the enums in main/metrics/metrics.h
+COUNTERS = (
+    "ws_connects", "ws_disconnects", "rx_messages", "rx_queue_drops",
+    "ws_attempts", "ws_rejects", "ws_retry_hints",
+    "tls_resume_offers", "tls_resumed",
+)
+GAUGES = (
+    "rx_queue_depth", "rx_queue_depth_max",
+    "heap_free", "heap_min_free", "heap_largest_block",
+    "psram_free", "psram_min_free", "psram_largest_block",
+    "cpu0_load", "cpu1_load", "ws_backoff_ms",
+)
+HISTOGRAMS = ("led_frame_us", "led_wire_us", "rx_handle_us", "tls_full_ms", "tls_resumed_ms")
+
+
+def varint(data, i):
+    v = shift = 0
+    while True:
+        b = data[i]
+        i += 1
+        v |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return v, i
+
+
+def fields(data):
+    """Yields (field, value) with bytes for length-delimited fields."""
+    i = 0
+    while i < len(data):
+        tag, i = varint(data, i)
+        if tag & 7 == 0:
+            v, i = varint(data, i)
+        elif tag & 7 == 2:
+            n, i = varint(data, i)
+            v, i = data[i:i + n], i + n
+        else:
+            raise ValueError(f"unexpected wire type {tag & 7}")
+        yield tag >> 3, v
+
+
+def packed(data):
+    out, i = [], 0
+    while i < len(data):
+        v, i = varint(data, i)
+        out.append(v)
+    return out
+
+
+def decode(data):
+    report = {"uptime_s": 0, "counters": [], "gauges": [], "histograms": [], "tasks": []}
+    for field, v in fields(data):
+        if field == 1:
+            report["uptime_s"] = v
+        elif field == 2:
+            report["counters"] = packed(v)
+        elif field == 3:
+            report["gauges"] = packed(v)
+        elif field == 4:
+            h = {"count": 0, "sum": 0, "max": 0, "buckets": []}
+            for f, x in fields(v):
+                h[("count", "sum", "max", "buckets")[f - 1]] = packed(x) if f == 4 else x
+            report["histograms"].append(h)
+        elif field == 5:
+            t = dict(fields(v))
+            report["tasks"].append((t.get(1, b"").decode(errors="replace"), t.get(2, 0)))
+    return report
+
+
+def percentile(buckets, p):
+    """Upper bound of the bucket holding the p-th percentile."""
+    total = sum(buckets)
+    seen = 0
+    for i, n in enumerate(buckets):
+        seen += n
+        if total and seen >= total * p:
+            return 0 if i == 0 else (1 << i) - 1
+    return 0
+
+
+def show(report, last):
+    delta = lambda now, before: (now - before) & 0xFFFFFFFF
+    if last and report["uptime_s"] < last["uptime_s"]:
+        print("lantern rebooted")
+        last = None
+
+    print(f"--- uptime {report['uptime_s']} s")
+    for name, v, before in zip(COUNTERS, report["counters"], last["counters"] if last else [0] * len(COUNTERS)):
+        print(f"  {name:<20} {delta(v, before):>10}  (total {v})")
+    counters = dict(zip(COUNTERS, report["counters"]))
+    before = dict(zip(COUNTERS, last["counters"])) if last else {}
+    offers = delta(counters.get("tls_resume_offers", 0), before.get("tls_resume_offers", 0))
+    if offers:
+        resumed = delta(counters.get("tls_resumed", 0), before.get("tls_resumed", 0))
+        print(f"  {'tls resumption':<20} {100 * resumed / offers:>9.0f}%  of {offers} offers")
+    for name, v in zip(GAUGES, report["gauges"]):
+        print(f"  {name:<20} {v:>10}")
+    for i, (name, h) in enumerate(zip(HISTOGRAMS, report["histograms"])):
+        before = last["histograms"][i] if last else {"count": 0, "sum": 0, "buckets": [0] * len(h["buckets"])}
+        count = delta(h["count"], before["count"])
+        buckets = [delta(a, b) for a, b in zip(h["buckets"], before["buckets"])]
+        avg = delta(h["sum"], before["sum"]) / count if count else 0
+        print(f"  {name:<20} {count:>10}  avg {avg:.0f}  p50 <{percentile(buckets, 0.5)}"
+              f"  p99 <{percentile(buckets, 0.99)}  max {h['max']} (since boot)")
+    for name, free in sorted(report["tasks"], key=lambda t: t[1]):
+        print(f"  stack {name:<16} {free:>8} bytes free")
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=9091)
+    args = parser.parse_args()
+
+    async def handler(conn):
+        print(f"lantern connected from {conn.peer[0]} ({conn.headers.get('x-common-name', '?')})")
+        last = None
+        try:
+            while True:
+                opcode, frame = await conn.recv()
+                for data in ws.unbatch(frame):
+                    if len(data) >= 2 and data[0] == ws.EXT_FRAME_MARKER and data[1] == ws.EXT_FRAME_TELEMETRY:
+                        report = decode(data[2:])
+                        show(report, last)
+                        last = report
+        except ws.Closed:
+            print("lantern disconnected")
+
+    await ws.serve(handler, port=args.port)
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+"""Checks that lanterns resume TLS sessions, and what resuming saves.
+
+Stands in for the device API over wss:// on port 9443, for devel builds with
+CONFIG_LANTERN_DEVEL_TLS. Logs every TLS handshake as full or resumed with how
+long it took on the server's side, from the ClientHello to the lantern's
+Finished, which includes the lantern's crypto. Each connection is closed after
+--hold seconds so the lantern comes back; holding longer than
+CONFIG_LANTERN_RECONNECT_STABLE_S keeps its reconnect delay at the base. The
+hit rate and the median full and resumed handshake are printed on exit.
+
+  --no-tickets   resume by session ID only, as a server without tickets would;
+                 OpenSSL forgets a session ID whose connection dropped without
+                 a close_notify, a ticket survives that
+  --client-ca F  ask for a client certificate and check it against F, so full
+                 handshakes include the lantern's DS signature like the real
+                 server's do; without it there is no client authentication
+  --cert/--key   server certificate, by default a throwaway self-signed one
+                 made with openssl
+  --self-test N  no lantern needed: makes N handshakes without and N offering
+                 the previous session with Python's TLS 1.2 client, prints
+                 both sides' times and fails if nothing was resumed
+
+  tools/standin/tls_server.py --client-ca device-ca.pem --hold 65
+"""
+
+import argparse
+import asyncio
+import os
+import socket
+import ssl
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+import ws
+
+
+class Handshakes:
+    def __init__(self):
+        self.full = []          # seconds
+        self.resumed = []
+        self.failed = 0
+        self.peers = set()
+        self.returning = 0      # handshakes from a peer seen before, i.e. could have resumed
+
+    def done(self, peer, ssl_object, seconds):
+        host = peer[0]
+        if ssl_object is None:
+            self.failed += 1
+            print(f"{host:<16} handshake failed after {seconds * 1000:.1f} ms")
+            return
+        if host in self.peers:
+            self.returning += 1
+        self.peers.add(host)
+        resumed = ssl_object.session_reused
+        (self.resumed if resumed else self.full).append(seconds)
+        print(f"{host:<16} {'resumed' if resumed else 'full':<8} {seconds * 1000:8.1f} ms  {ssl_object.version()} {ssl_object.cipher()[0]}")
+
+    def summary(self):
+        print()
+        print(f"{len(self.full)} full, {len(self.resumed)} resumed, {self.failed} failed handshakes")
+        if self.returning:
+            print(f"hit rate {100 * len(self.resumed) / self.returning:.0f}% of {self.returning} reconnects")
+        for name, times in (("full", self.full), ("resumed", self.resumed)):
+            if times:
+                print(f"{name:<8} median {statistics.median(times) * 1000:8.1f} ms  max {max(times) * 1000:8.1f} ms")
+        if self.full and self.resumed:
+            saved = statistics.median(self.full) - statistics.median(self.resumed)
+            print(f"resuming saves {saved * 1000:.1f} ms per handshake ({100 * saved / statistics.median(self.full):.0f}%)")
+
+
+def self_signed(directory):
+    cert = os.path.join(directory, "cert.pem")
+    key = os.path.join(directory, "key.pem")
+    subprocess.run(["openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes", "-days", "7",
+                    "-subj", "/CN=lantern-standin", "-keyout", key, "-out", cert],
+                   check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return cert, key
+
+
+def client(port, count):
+    """Blocking: count handshakes with a fresh session, then count offering the
+    last one. Returns the client side's (full, resumed) times in seconds."""
+    ctx = ssl.create_default_context()
+    ctx.check_hostname = False
+    ctx.verify_mode = ssl.CERT_NONE
+    # the lantern's mbedTLS is built without TLS 1.3
+    ctx.maximum_version = ssl.TLSVersion.TLSv1_2
+
+    times = ([], [])
+    session = None
+    for resume in (False, True):
+        for _ in range(count):
+            with socket.create_connection(("127.0.0.1", port)) as sock:
+                start = time.perf_counter()
+                with ctx.wrap_socket(sock, session=session if resume else None) as tls:
+                    elapsed = time.perf_counter() - start
+                    times[tls.session_reused].append(elapsed)
+                    session = tls.session
+                    tls.sendall(b"GET / HTTP/1.1\r\nHost: standin\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                                b"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nX-Common-Name: self-test\r\n\r\n")
+                    tls.recv(1024)
+                    # OpenSSL forgets a session ID whose connection ended without close_notify
+                    tls.unwrap()
+    return times
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=9443)
+    parser.add_argument("--hold", type=float, default=65, help="close each connection after this long (s)")
+    parser.add_argument("--no-tickets", action="store_true", help="resume by session ID only")
+    parser.add_argument("--client-ca", help="require a client certificate issued by this CA")
+    parser.add_argument("--cert", help="server certificate (PEM)")
+    parser.add_argument("--key", help="server key (PEM)")
+    parser.add_argument("--self-test", type=int, default=0, metavar="N", help="handshake with a local client N times each way")
+    args = parser.parse_args()
+
+    ctx = ssl.create_default_context(ssl.Purpose.CLIENT_AUTH)
+    with tempfile.TemporaryDirectory() as directory:
+        cert, key = (args.cert, args.key) if args.cert else self_signed(directory)
+        ctx.load_cert_chain(cert, key)
+    if args.no_tickets:
+        ctx.options |= ssl.OP_NO_TICKET
+    if args.client_ca:
+        ctx.load_verify_locations(args.client_ca)
+        ctx.verify_mode = ssl.CERT_REQUIRED
+
+    handshakes = Handshakes()
+
+    async def handler(conn):
+        try:
+            await asyncio.wait_for(drain(conn), args.hold)
+        except asyncio.TimeoutError:
+            await conn.close()
+
+    async def drain(conn):
+        while True:
+            await conn.recv()
+
+    server = asyncio.create_task(ws.serve(handler, port=args.port, ssl=ctx, tls_done=handshakes.done))
+    try:
+        if not args.self_test:
+            await server
+            return
+        await asyncio.sleep(0.5)
+        full, resumed = await asyncio.to_thread(client, args.port, args.self_test)
+        for name, times in (("full", full), ("resumed", resumed)):
+            if times:
+                print(f"client: {name:<8} median {statistics.median(times) * 1000:8.1f} ms")
+        if not resumed:
+            print("FAILED: no session was resumed")
+            sys.exit(1)
+    finally:
+        server.cancel()
+        handshakes.summary()
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,238 @@
+"""Minimal websocket server (RFC 6455) on the Python standard library.
+
+Just enough of the protocol to stand in for the device API on a LAN: binary
+and text messages, fragmented input, ping/pong and close. The devel firmware
+variant connects over plain ws:// to port 9091, or with
+CONFIG_LANTERN_DEVEL_TLS over wss:// to port 9443, see sockets.cpp.
+"""
+
+import asyncio
+import base64
+import hashlib
+import os
+import struct
+import time
+
+GUID = b"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+OP_CONT = 0x0
+OP_TEXT = 0x1
+OP_BINARY = 0x2
+OP_CLOSE = 0x8
+OP_PING = 0x9
+OP_PONG = 0xA
+
+# Extension frames, see main/sockets/ext_frame.h
+EXT_FRAME_MARKER = 0x00
+EXT_FRAME_ANIMATION_PROGRAM = 1
+EXT_FRAME_PIXEL_STREAM = 2
+EXT_FRAME_STREAM_STATS = 3
+EXT_FRAME_BATCH = 4
+EXT_FRAME_COREDUMP_CHUNK = 5
+EXT_FRAME_COREDUMP_DONE = 6
+EXT_FRAME_COREDUMP_ACK = 7
+EXT_FRAME_TOUCH_GESTURE = 8
+EXT_FRAME_TELEMETRY = 9
+EXT_FRAME_TRACE = 10
+EXT_FRAME_TRACE_REPORT = 11
+
+
+def unbatch(data):
+    """Splits an EXT_FRAME_BATCH frame into its messages; other frames pass through."""
+    if len(data) < 2 or data[0] != EXT_FRAME_MARKER or data[1] != EXT_FRAME_BATCH:
+        return [data]
+    messages = []
+    i = 2
+    while i + 2 <= len(data):
+        (n,) = struct.unpack_from("<H", data, i)
+        messages.append(data[i + 2:i + 2 + n])
+        i += 2 + n
+    return messages
+
+
+class Closed(Exception):
+    pass
+
+
+class Connection:
+    def __init__(self, reader, writer, path, headers):
+        self.reader = reader
+        self.writer = writer
+        self.path = path
+        self.headers = headers
+        self.peer = writer.get_extra_info("peername")
+        self._pongs = {}
+
+    async def send(self, payload, opcode=OP_BINARY):
+        header = bytearray([0x80 | opcode])
+        n = len(payload)
+        if n < 126:
+            header.append(n)
+        elif n < 1 << 16:
+            header.append(126)
+            header += struct.pack(">H", n)
+        else:
+            header.append(127)
+            header += struct.pack(">Q", n)
+        self.writer.write(bytes(header) + payload)
+        await self.writer.drain()
+
+    async def _frame(self):
+        try:
+            b0, b1 = await self.reader.readexactly(2)
+            n = b1 & 0x7F
+            if n == 126:
+                (n,) = struct.unpack(">H", await self.reader.readexactly(2))
+            elif n == 127:
+                (n,) = struct.unpack(">Q", await self.reader.readexactly(8))
+            mask = await self.reader.readexactly(4) if b1 & 0x80 else None
+            data = await self.reader.readexactly(n)
+        except (asyncio.IncompleteReadError, ConnectionError):
+            raise Closed()
+        if mask:
+            data = bytes(c ^ mask[i & 3] for i, c in enumerate(data))
+        return b0 & 0x80, b0 & 0x0F, data
+
+    async def recv(self):
+        """Returns (opcode, payload) of the next complete data message."""
+        message = bytearray()
+        opcode = None
+        while True:
+            fin, op, data = await self._frame()
+            if op == OP_PING:
+                await self.send(data, OP_PONG)
+                continue
+            if op == OP_PONG:
+                pong = self._pongs.pop(data, None)
+                if pong and not pong.done():
+                    pong.set_result(time.monotonic())
+                continue
+            if op == OP_CLOSE:
+                try:
+                    await self.send(data[:2], OP_CLOSE)
+                except ConnectionError:
+                    pass
+                raise Closed()
+            if op != OP_CONT:
+                opcode = op
+            message += data
+            if fin:
+                return opcode, bytes(message)
+
+    async def ping(self, timeout=5):
+        """Round trip of a ping in seconds, None on timeout. Pongs are picked
+        up by recv(), so something has to be receiving meanwhile."""
+        payload = os.urandom(8)
+        pong = asyncio.get_running_loop().create_future()
+        self._pongs[payload] = pong
+        sent = time.monotonic()
+        await self.send(payload, OP_PING)
+        try:
+            return await asyncio.wait_for(pong, timeout) - sent
+        except asyncio.TimeoutError:
+            self._pongs.pop(payload, None)
+            return None
+
+    async def close(self, code=1000, reason=b""):
+        try:
+            await self.send(struct.pack(">H", code) + reason, OP_CLOSE)
+        except ConnectionError:
+            pass
+        self.writer.close()
+
+
+class Reject:
+    """Returned by an admit callback to answer the upgrade with an HTTP error."""
+
+    def __init__(self, status=503, reason="Service Unavailable", headers=None):
+        self.status = status
+        self.reason = reason
+        self.headers = headers or {}
+
+
+# Returned by an admit callback to reset the connection without an answer
+DROP = object()
+
+
+async def _request(reader):
+    request = await reader.readuntil(b"\r\n\r\n")
+    lines = request.decode("latin-1").split("\r\n")
+    path = lines[0].split(" ")[1]
+    headers = {}
+    for line in lines[1:]:
+        if ":" in line:
+            k, v = line.split(":", 1)
+            headers[k.strip().lower()] = v.strip()
+    return path, headers
+
+
+async def _reject(writer, reject):
+    head = f"HTTP/1.1 {reject.status} {reject.reason}\r\nContent-Length: 0\r\nConnection: close\r\n"
+    head += "".join(f"{k}: {v}\r\n" for k, v in reject.headers.items())
+    writer.write((head + "\r\n").encode("latin-1"))
+    await writer.drain()
+
+
+async def _handshake(writer, headers):
+    accept = base64.b64encode(hashlib.sha1(headers["sec-websocket-key"].encode() + GUID).digest())
+    writer.write(
+        b"HTTP/1.1 101 Switching Protocols\r\n"
+        b"Upgrade: websocket\r\n"
+        b"Connection: Upgrade\r\n"
+        b"Sec-WebSocket-Accept: " + accept + b"\r\n\r\n"
+    )
+    await writer.drain()
+
+
+async def serve(handler, host="0.0.0.0", port=9091, admit=None, ssl=None, tls_done=None):
+    """Calls handler(conn) for every client until the process is stopped.
+
+    admit(peer, path, headers), if given, is awaited before the upgrade is
+    answered and may return a Reject or DROP to turn the client away.
+
+    With an SSLContext in ssl the server speaks wss://. tls_done(peer,
+    ssl_object, seconds), if given, is called after every TLS handshake with
+    how long it took, ssl_object None if it failed."""
+
+    async def on_client(reader, writer):
+        if ssl:
+            peer = writer.get_extra_info("peername")
+            start = time.monotonic()
+            try:
+                await writer.start_tls(ssl)
+            except (OSError, asyncio.IncompleteReadError):
+                if tls_done:
+                    tls_done(peer, None, time.monotonic() - start)
+                writer.transport.abort()
+                return
+            if tls_done:
+                tls_done(peer, writer.get_extra_info("ssl_object"), time.monotonic() - start)
+        try:
+            path, headers = await _request(reader)
+            verdict = await admit(writer.get_extra_info("peername"), path, headers) if admit else None
+            if verdict is DROP:
+                writer.transport.abort()
+                return
+            if isinstance(verdict, Reject):
+                await _reject(writer, verdict)
+                writer.close()
+                return
+            await _handshake(writer, headers)
+        except (asyncio.IncompleteReadError, KeyError, IndexError, ConnectionError):
+            writer.close()
+            return
+        conn = Connection(reader, writer, path, headers)
+        try:
+            await handler(conn)
+        except (Closed, ConnectionError):
+            pass
+        except asyncio.CancelledError:
+            # shutting down; on 3.11 a cancelled client task logs a spurious traceback
+            pass
+        finally:
+            writer.close()
+
+    server = await asyncio.start_server(on_client, host, port)
+    print(f"listening on {'wss' if ssl else 'ws'}://{host}:{port}/")
+    async with server:
+        await server.serve_forever()